@@ -13,6 +13,8 @@ InfluxDB::InfluxDB(QObject *parent, Loghandler* loghandler) : QObject(parent)
     m_dbUser = settings.value("username", QString()).toString();
     m_dbPassword = settings.value("password", QString()).toString();
 
+    m_pendingWrites = 0;
+
     m_networkManager = new QNetworkAccessManager();
     connect(m_networkManager, &QNetworkAccessManager::finished, this, &InfluxDB::slot_replyFinished);
 }
@@ -42,10 +44,29 @@ void InfluxDB::write(QByteArray payload)
     m_request.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded");
 
     m_networkManager->post(m_request, payload);
+    m_pendingWrites++;
+}
+
+void InfluxDB::waitForPendingWrites(int timeoutInMilliseconds)
+{
+    if (m_pendingWrites == 0)
+        return;
+
+    QEventLoop loop;
+    connect(this, &InfluxDB::signal_pendingWritesFinished, &loop, &QEventLoop::quit);
+    QTimer::singleShot(timeoutInMilliseconds, &loop, &QEventLoop::quit);
+    loop.exec();
+
+    if (m_pendingWrites > 0)
+        m_loghandler->slot_newEntry(LogEntry::Warning, "InfluxDB waitForPendingWrites", QString("%1 write requests are still pending, giving up.").arg(m_pendingWrites));
 }
 
 void InfluxDB::slot_replyFinished(QNetworkReply *reply)
 {
+    m_pendingWrites--;
+    if (m_pendingWrites == 0)
+        emit signal_pendingWritesFinished();
+
     if (reply->error()) {
         QString answer = reply->readAll();
         m_loghandler->slot_newEntry(LogEntry::Error, "InfluxDB slot_replyFinished", reply->errorString() + " " + answer);
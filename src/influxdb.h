@@ -6,6 +6,8 @@
 #include <QNetworkAccessManager>
 #include <QNetworkRequest>
 #include <QNetworkReply>
+#include <QEventLoop>
+#include <QTimer>
 #include "loghandler.h"
 
 class InfluxDB : public QObject
@@ -23,15 +25,20 @@ public:
 
     void write(QByteArray payload);
 
+    // Runs a local event loop until all write requests are answered or the timeout expired, used at shutdown
+    void waitForPendingWrites(int timeoutInMilliseconds);
+
 private:
     Loghandler* m_loghandler;
     QNetworkAccessManager* m_networkManager;
     QNetworkRequest m_request;
+    int m_pendingWrites;
 
 private slots:
     void slot_replyFinished(QNetworkReply *reply);
 
 signals:
+    void signal_pendingWritesFinished();
 
 };
 
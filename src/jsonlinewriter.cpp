@@ -0,0 +1,175 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#include "jsonlinewriter.h"
+
+JsonLineWriter::JsonLineWriter(QByteArray *buffer)
+{
+    m_buffer = buffer;
+    m_needsSeparator = false;
+}
+
+void JsonLineWriter::beginObject()
+{
+    appendSeparator();
+    m_buffer->append('{');
+    m_needsSeparator = false;
+}
+
+void JsonLineWriter::beginObject(const char *key)
+{
+    appendKey(key);
+    m_buffer->append('{');
+    m_needsSeparator = false;
+}
+
+void JsonLineWriter::endObject()
+{
+    m_buffer->append('}');
+    m_needsSeparator = true;
+}
+
+void JsonLineWriter::beginArray(const char *key)
+{
+    appendKey(key);
+    m_buffer->append('[');
+    m_needsSeparator = false;
+}
+
+void JsonLineWriter::endArray()
+{
+    m_buffer->append(']');
+    m_needsSeparator = true;
+}
+
+void JsonLineWriter::endLine()
+{
+    m_buffer->append('\n');
+    m_needsSeparator = false;
+}
+
+void JsonLineWriter::addString(const char *key, const QString &value)
+{
+    appendKey(key);
+    appendEscaped(value.toUtf8());
+    m_needsSeparator = true;
+}
+
+void JsonLineWriter::addString(const QString &key, const QString &value)
+{
+    appendSeparator();
+    appendEscaped(key.toUtf8());
+    m_buffer->append(':');
+    appendEscaped(value.toUtf8());
+    m_needsSeparator = true;
+}
+
+void JsonLineWriter::addString(const QString &value)
+{
+    appendSeparator();
+    appendEscaped(value.toUtf8());
+    m_needsSeparator = true;
+}
+
+void JsonLineWriter::addInt(const char *key, qint64 value)
+{
+    appendKey(key);
+    addInt(value);
+}
+
+void JsonLineWriter::addInt(qint64 value)
+{
+    appendSeparator();
+    char number[24];
+    int length = qsnprintf(number, sizeof(number), "%lld", (long long)value);
+    m_buffer->append(number, length);
+    m_needsSeparator = true;
+}
+
+void JsonLineWriter::addDouble(const char *key, double value)
+{
+    appendKey(key);
+    char number[32];
+    int length = qsnprintf(number, sizeof(number), "%.10g", value);
+    m_buffer->append(number, length);
+    m_needsSeparator = true;
+}
+
+void JsonLineWriter::addBool(const char *key, bool value)
+{
+    appendKey(key);
+    m_buffer->append(value ? "true" : "false");
+    m_needsSeparator = true;
+}
+
+int JsonLineWriter::size() const
+{
+    return m_buffer->size();
+}
+
+void JsonLineWriter::appendSeparator()
+{
+    if (m_needsSeparator)
+        m_buffer->append(',');
+    m_needsSeparator = false;
+}
+
+void JsonLineWriter::appendKey(const char *key)
+{
+    appendSeparator();
+    m_buffer->append('"');
+    m_buffer->append(key);
+    m_buffer->append("\":");
+}
+
+void JsonLineWriter::appendEscaped(const QByteArray &utf8)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+
+    m_buffer->append('"');
+    for (int i=0; i<utf8.size(); i++)
+    {
+        char c = utf8.at(i);
+        switch (c)
+        {
+        case '"':
+            m_buffer->append("\\\"");
+            break;
+        case '\\':
+            m_buffer->append("\\\\");
+            break;
+        case '\n':
+            m_buffer->append("\\n");
+            break;
+        case '\r':
+            m_buffer->append("\\r");
+            break;
+        case '\t':
+            m_buffer->append("\\t");
+            break;
+        default:
+            if ((unsigned char)c < 0x20)
+            {
+                m_buffer->append("\\u00");
+                m_buffer->append(hexDigits[(c >> 4) & 0x0f]);
+                m_buffer->append(hexDigits[c & 0x0f]);
+            }
+            else
+                m_buffer->append(c);    // Multibyte UTF-8 sequences are copied unchanged
+        }
+    }
+    m_buffer->append('"');
+}
@@ -0,0 +1,57 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#ifndef JSONLINEWRITER_H
+#define JSONLINEWRITER_H
+
+#include <QByteArray>
+#include <QString>
+
+// Minimal serializer for newline delimited JSON (one object per line).
+// Values are appended directly to a caller owned buffer, so the buffer can be reused for many lines
+// without building a QJsonDocument for each of them.
+class JsonLineWriter
+{
+public:
+    explicit JsonLineWriter(QByteArray* buffer);
+
+    void beginObject();
+    void beginObject(const char* key);
+    void endObject();
+    void beginArray(const char* key);
+    void endArray();
+    void endLine();     // Terminates the line after the outermost object
+
+    void addString(const char* key, const QString& value);
+    void addString(const QString& key, const QString& value);
+    void addString(const QString& value);   // Array element
+    void addInt(const char* key, qint64 value);
+    void addInt(qint64 value);              // Array element
+    void addDouble(const char* key, double value);
+    void addBool(const char* key, bool value);
+
+    int size() const;   // Current size of the buffer, e.g. to remember offsets of segments
+
+private:
+    QByteArray* m_buffer;
+    bool m_needsSeparator;
+
+    void appendSeparator();
+    void appendKey(const char* key);
+    void appendEscaped(const QByteArray& utf8);
+};
+
+#endif // JSONLINEWRITER_H
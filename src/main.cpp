@@ -15,7 +15,23 @@
 **********************************************************************/
 
 #include <QCoreApplication>
+#include <QSocketNotifier>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
 #include "maincontroller.h"
+#include "particlecounterimport.h"
+
+static int signalSocketPair[2];
+
+static void unixSignalHandler(int)
+{
+    // Only async-signal-safe calls are allowed here, the event loop is left by the socket notifier
+    char signalByte = 1;
+    if (::write(signalSocketPair[0], &signalByte, sizeof(signalByte)) < 0)
+        return;
+}
 
 int main(int argc, char *argv[])
 {
@@ -23,6 +39,28 @@ int main(int argc, char *argv[])
     QCoreApplication::setOrganizationName("openffucontrol");
     QCoreApplication::setOrganizationDomain("sme-gmbh.com");
     QCoreApplication::setApplicationName("openffucontrol-particleserver");
+
+    // Offline bulk provisioning: openffucontrol-particleserver --import FILE [--dryrun]
+    QStringList arguments = a.arguments();
+    int importIndex = arguments.indexOf("--import");
+    if (importIndex >= 0)
+        return ParticleCounterImport::importOffline(arguments.value(importIndex + 1), arguments.contains("--dryrun"));
+
+    // SIGTERM (e.g. systemctl stop) and SIGINT leave the event loop, so the destructors write pending changes to disk
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, signalSocketPair) == 0)
+    {
+        QSocketNotifier* signalNotifier = new QSocketNotifier(signalSocketPair[1], QSocketNotifier::Read, &a);
+        QObject::connect(signalNotifier, SIGNAL(activated(int)), &a, SLOT(quit()));
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = unixSignalHandler;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGTERM, &action, nullptr);
+        sigaction(SIGINT, &action, nullptr);
+    }
+
     MainController c;
 
     return a.exec();
@@ -35,13 +35,30 @@ MainController::MainController(QObject *parent) : QObject(parent)
     m_pcDatabase = new ParticleCounterDatabase(this, m_pcModbusSystem, m_influxDB, m_loghandler);
     m_pcDatabase->loadFromHdd();
 
-    m_remotecontroller = new RemoteController(this, m_pcDatabase, m_loghandler);
+    // The terminal server runs in its own thread, so slow or busy clients do not delay the bus communication.
+    // Its requests to the database are executed in this thread by the request queue.
+    m_terminalRequestQueue = new TerminalRequestQueue(this, m_pcDatabase);
+
+    m_remotecontroller = new RemoteController(nullptr, m_pcDatabase, m_terminalRequestQueue, m_loghandler);
+    m_remotecontroller->moveToThread(&m_terminalThread);
+    connect(&m_terminalThread, &QThread::started, m_remotecontroller, &RemoteController::slot_start);
+    connect(&m_terminalThread, &QThread::finished, m_remotecontroller, &QObject::deleteLater);
     connect(m_remotecontroller, &RemoteController::signal_connected, this, &MainController::slot_remoteControlConnected);
     connect(m_remotecontroller, &RemoteController::signal_disconnected, this, &MainController::slot_remoteControlDisconnected);
+    m_terminalThread.start();
 }
 
 MainController::~MainController()
 {
+    m_terminalThread.quit();
+    m_terminalThread.wait();
+
+    // Terminal requests are done now, so this is the last change of the particle counters
+    m_pcDatabase->flushChanges();
+
+    // The event loop is left already, so the last batch of points is sent before the influx client is destroyed
+    m_pcDatabase->flushPoints();
+    m_influxDB->waitForPendingWrites(5000);
 }
 
 // This slot is called as soon as the first server connects to the remotecontroller
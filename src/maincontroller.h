@@ -21,10 +21,12 @@
 #include <QTimer>
 #include <QList>
 #include <QSettings>
+#include <QThread>
 #include <libopenffucontrol-qtmodbus/modbus.h>
 #include "particlecountermodbussystem.h"
 #include "particlecounterdatabase.h"
 #include "remotecontroller.h"
+#include "terminalrequestqueue.h"
 #include "influxdb.h"
 #include "loghandler.h"
 
@@ -45,6 +47,8 @@ private:
     ParticleCounterDatabase* m_pcDatabase;
 
     RemoteController* m_remotecontroller;
+    TerminalRequestQueue* m_terminalRequestQueue;
+    QThread m_terminalThread;
 
     InfluxDB* m_influxDB;
 
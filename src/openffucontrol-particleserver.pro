@@ -43,28 +43,54 @@ unix {
 
 SOURCES += \
         influxdb.cpp \
+        jsonlinewriter.cpp \
         logentry.cpp \
         loghandler.cpp \
         main.cpp \
         maincontroller.cpp \
         particlecounter.cpp \
+        particlecounteraggregates.cpp \
+        particlecounteralarmengine.cpp \
+        particlecounterclassification.cpp \
+        particlecounterdownsampler.cpp \
         particlecounterdatabase.cpp \
+        particlecounterhistory.cpp \
+        particlecounterimport.cpp \
+        particlecounterinitscheduler.cpp \
         particlecountermodbussystem.cpp \
+        particlecounternormalization.cpp \
+        particlecounterregistry.cpp \
+        particlecountersamplingaligner.cpp \
+        particlecounterzoneaggregates.cpp \
         remoteclienthandler.cpp \
-        remotecontroller.cpp
+        remotecontroller.cpp \
+        terminalrequestqueue.cpp
 
 LIBS     += -lopenffucontrol-qtmodbus
 
 HEADERS += \
     influxdb.h \
+    jsonlinewriter.h \
     logentry.h \
     loghandler.h \
     maincontroller.h \
     particlecounter.h \
+    particlecounteraggregates.h \
+    particlecounteralarmengine.h \
+    particlecounterclassification.h \
+    particlecounterdownsampler.h \
     particlecounterdatabase.h \
+    particlecounterhistory.h \
+    particlecounterimport.h \
+    particlecounterinitscheduler.h \
     particlecountermodbussystem.h \
+    particlecounternormalization.h \
+    particlecounterregistry.h \
+    particlecountersamplingaligner.h \
+    particlecounterzoneaggregates.h \
     remoteclienthandler.h \
-    remotecontroller.h
+    remotecontroller.h \
+    terminalrequestqueue.h
 
 DISTFILES += \
     ../etc/config.ini.example \
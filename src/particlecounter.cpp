@@ -14,10 +14,9 @@
 ** along with this program. If not, see <http://www.gnu.org/licenses/>.
 **********************************************************************/
 
-#include <QFile>
 #include <QString>
 #include <QStringList>
-#include <QDir>
+#include <QUrl>
 #include "particlecounter.h"
 
 ParticleCounter::ParticleCounter(QObject *parent, ParticleCounterModbusSystem *pcModbusSystem, Loghandler* loghandler) : QObject(parent)
@@ -25,6 +24,7 @@ ParticleCounter::ParticleCounter(QObject *parent, ParticleCounterModbusSystem *p
     m_pcModbusSystem = pcModbusSystem;
     m_loghandler = loghandler;
 
+    m_registry = nullptr;
     m_dataChanged = false;
     setAutoSave(false);
 
@@ -34,7 +34,34 @@ ParticleCounter::ParticleCounter(QObject *parent, ParticleCounterModbusSystem *p
     m_modbusAddress = -1; // Invalid address
 
     m_samplingEnabled = true;
+    m_alignedSampling = false;
+    m_liveCountsIntervalInSeconds = 0;  // Live counts are off by default, archive datasets are the regular data source
+    m_archiveAcquisitionEnabled = true;
 
+    m_limits.valid = false;
+    for (int ch=0; ch<8; ch++)
+    {
+        m_limits.channel[ch].upperWarningLimit = 0;
+        m_limits.channel[ch].upperAlarmLimit = 0;
+        m_limits.channel[ch].warningDelay = 0;
+        m_limits.channel[ch].alarmDelay = 0;
+    }
+    m_limitsWritten = m_limits;
+    m_limitsWriteStatus = LIMITS_WRITE_NONE;
+    m_limitsWriteTelegramID = 0;
+    m_limitsReadbackTelegramID = 0;
+
+    m_sequenceNumber = 0;
+
+    m_initialized = false;
+    m_initRunning = false;
+    m_initTelegramID = 0;
+
+    m_deviceInfoValidated = false;
+    m_deviceInfoRequestRunning = false;
+    m_deviceInfoTelegramID = 0;
+
+    m_actualData.online = false;
     m_actualData.clockSettingLostCount = 0;
 
     for (int i=0; i<8; i++)
@@ -106,6 +133,7 @@ void ParticleCounter::setBusID(int busID)
     if (busID != m_busID)
     {
         m_busID = busID;
+        clearDeviceInfo();  // Cached device info belongs to the device at the old address
         m_dataChanged = true;
         emit signal_needsSaving();
     }
@@ -121,86 +149,178 @@ void ParticleCounter::setModbusAddress(int modbusAddress)
     if (m_modbusAddress != modbusAddress)
     {
         m_modbusAddress = modbusAddress;
+        clearDeviceInfo();
         m_dataChanged = true;
         emit signal_needsSaving();
     }
 }
 
-void ParticleCounter::init()
+int ParticleCounter::init()
 {
+    int telegramsBefore = m_transactionIDs.size();
+
     this->setClock();
     this->setConfigData(m_configData);
-    this->requestDeviceInfo();
-    this->setSamplingEnabled(true);
+    m_deviceInfoValidated = false;
+    if (m_deviceInfo.deviceIdString.isEmpty())
+        this->requestDeviceInfo();      // Nothing cached, needed for tagging right away
+    this->setSamplingEnabled(!m_alignedSampling);   // Aligned acquisition is started at the next boundary
     this->storeSettingsToFlash();
+    this->requestLimits();
     this->requestStatus();
+
+    int telegramCount = m_transactionIDs.size() - telegramsBefore;
+
+    m_initialized = false;
+    m_initRunning = (telegramCount > 0);
+    if (m_initRunning)
+        m_initTelegramID = m_transactionIDs.last();     // Status request, which is always the last telegram of the init
+
+    return telegramCount;
+}
+
+bool ParticleCounter::isInitialized() const
+{
+    return m_initialized;
+}
+
+bool ParticleCounter::isInitRunning() const
+{
+    return m_initRunning;
 }
 
 QString ParticleCounter::getData(QString key)
+{
+    return formatData(getState(), key);
+}
+
+ParticleCounter::State ParticleCounter::getState() const
+{
+    State state;
+    state.id = m_id;
+    state.busID = m_busID;
+    state.modbusAddress = m_modbusAddress;
+    state.actualData = m_actualData;
+    state.deviceInfo = m_deviceInfo;
+    state.deviceInfoValidated = m_deviceInfoValidated;
+    state.errorstateRegister = m_errorstateRegister;
+    state.liveCountsIntervalInSeconds = m_liveCountsIntervalInSeconds;
+    state.archiveAcquisitionEnabled = m_archiveAcquisitionEnabled;
+    state.zone = m_zone;
+    state.limits = m_limits;
+    state.limitsWriteStatus = m_limitsWriteStatus;
+    state.isoClass = -1;
+    state.zoneIsoClass = -1;
+    return state;
+}
+
+QString ParticleCounter::formatData(const State &state, QString key)
 {
     // ***** Static keys *****
     if (key == "id")
     {
-        return (QString().setNum(m_id));
+        return (QString().setNum(state.id));
     }
     else if (key == "busID")
     {
-        return (QString().setNum(getBusID()));
+        return (QString().setNum(state.busID));
     }
     else if (key == "unit")
     {
-        return (QString().setNum(getModbusAddress()));
+        return (QString().setNum(state.modbusAddress));
     }
     // ***** Actual keys *****
     else if (key == "online")
     {
-        return QString().setNum(m_actualData.online);
+        return QString().setNum(state.actualData.online);
     }
     else if (key == "lostTelegrams")
     {
-        return QString().sprintf("%lli", m_actualData.lostTelegrams);
+        return QString().sprintf("%lli", state.actualData.lostTelegrams);
     }
     else if (key == "lastSeen")
     {
-        return m_actualData.lastSeen.toString("yyyy.MM.dd-hh:mm:ss.zzz");
+        return state.actualData.lastSeen.toString("yyyy.MM.dd-hh:mm:ss.zzz");
     }
     else if (key == "clockSettingLostCount")
     {
-        return QString().sprintf("%i", m_actualData.clockSettingLostCount);
+        return QString().sprintf("%i", state.actualData.clockSettingLostCount);
+    }
+    else if (key == "statusString")
+    {
+        return state.actualData.statusString;
+    }
+    else if (key.startsWith("countChannel_"))
+    {
+        int channel = key.mid(13).toInt();
+        if ((channel >= 1) && (channel <= 8))
+            return QString().setNum(state.actualData.channelData[channel - 1].count);
+    }
+    else if (key == "timestamp")
+    {
+        return state.actualData.timestamp.toString("yyyy.MM.dd-hh:mm:ss");
+    }
+    else if (key == "liveCountsIntervalInSeconds")
+    {
+        return QString().setNum(state.liveCountsIntervalInSeconds);
+    }
+    else if (key == "archiveAcquisitionEnabled")
+    {
+        return QString().setNum(state.archiveAcquisitionEnabled);
+    }
+    else if (key == "zone")
+    {
+        return ("\"" + state.zone + "\"");
+    }
+    else if (key == "limitsWriteStatus")
+    {
+        return limitsWriteStatusName(state.limitsWriteStatus);
+    }
+    else if (key == "isoClass")
+    {
+        return (state.isoClass < 0) ? QString("none") : QString().sprintf("%.1f", state.isoClass);
+    }
+    else if (key == "zoneIsoClass")
+    {
+        return (state.zoneIsoClass < 0) ? QString("none") : QString().sprintf("%.1f", state.zoneIsoClass);
     }
     else if (key == "deviceInfo")
     {
-        return ("\"" + m_deviceInfo.deviceInfoString + "\"");
+        return ("\"" + state.deviceInfo.deviceInfoString + "\"");
     }
     else if (key == "deviceID")
     {
-        return ("\"" + m_deviceInfo.deviceIdString + "\"");
+        return ("\"" + state.deviceInfo.deviceIdString + "\"");
     }
     else if (key == "modbusRegistersetVersion")
     {
-        return ("\"" + m_deviceInfo.modbusRegistersetVersion + "\"");
+        return ("\"" + state.deviceInfo.modbusRegistersetVersion + "\"");
+    }
+    else if (key == "deviceInfoValidated")
+    {
+        return QString().setNum(state.deviceInfoValidated);
     }
     else if (key == "errorstring")
     {
         QString errorstring;
 
-        if (m_errorstateRegister.temperatureError)
+        if (state.errorstateRegister.temperatureError)
             errorstring += "error_temperatureError=1_";
-        if (m_errorstateRegister.sdCardError)
+        if (state.errorstateRegister.sdCardError)
             errorstring += "error_sdCardError=1_";
-        if (m_errorstateRegister.counterSettings)
+        if (state.errorstateRegister.counterSettings)
             errorstring += "error_counterSettings=1_";
-        if (m_errorstateRegister.acquisitionSettings)
+        if (state.errorstateRegister.acquisitionSettings)
             errorstring += "error_acquisitionSettings=1_";
-        if (m_errorstateRegister.remoteSettings)
+        if (state.errorstateRegister.remoteSettings)
             errorstring += "error_remoteSettings=1_";
-        if (m_errorstateRegister.filterSettings)
+        if (state.errorstateRegister.filterSettings)
             errorstring += "error_filterSettings=1_";
-        if (m_errorstateRegister.detectorLoop)
+        if (state.errorstateRegister.detectorLoop)
             errorstring += "error_detectorLoop=1_";
-        if (m_errorstateRegister.laserError)
+        if (state.errorstateRegister.laserError)
             errorstring += "error_laserError=1_";
-        if (m_errorstateRegister.flowError)
+        if (state.errorstateRegister.flowError)
             errorstring += "error_flowError=1_";
 
         if (errorstring.isEmpty())
@@ -222,6 +342,31 @@ void ParticleCounter::setData(QString key, QString value)
     {
         setModbusAddress(value.toInt());
     }
+    else if (key == "liveCountsIntervalInSeconds")
+    {
+        setLiveCountsInterval(value.toInt());
+    }
+    else if (key == "archiveAcquisitionEnabled")
+    {
+        setArchiveAcquisitionEnabled(value.toInt());
+    }
+    else if (key == "zone")
+    {
+        setZone(value);
+    }
+    else if (key.startsWith("limit"))
+    {
+        Limits limits = getLimitsToChange();
+        QMap<QString,QString> data;
+        data.insert(key, value);
+        QString error;
+        if (!limits.valid)
+            m_loghandler->slot_newEntry(LogEntry::Warning, "Particle Counter id=" + QString().setNum(m_id), "Limits not written, they have not been read yet.");
+        else if (applyLimitSettings(data, &limits, &error) < 0)
+            m_loghandler->slot_newEntry(LogEntry::Warning, "Particle Counter id=" + QString().setNum(m_id), error);
+        else
+            setLimits(limits);
+    }
 }
 
 void ParticleCounter::setSamplingEnabled(bool on)
@@ -252,6 +397,8 @@ void ParticleCounter::setSamplingEnabled(bool on)
     }
 
     m_samplingEnabled = on;
+    if (on)
+        m_samplingStartedAt = QDateTime::currentDateTime();
 }
 
 bool ParticleCounter::isSampling() const
@@ -259,6 +406,108 @@ bool ParticleCounter::isSampling() const
     return m_samplingEnabled;
 }
 
+void ParticleCounter::setAlignedSampling(bool on)
+{
+    m_alignedSampling = on;
+}
+
+bool ParticleCounter::isAlignedSampling() const
+{
+    return m_alignedSampling;
+}
+
+void ParticleCounter::markAsSampling()
+{
+    m_samplingEnabled = true;
+    m_samplingStartedAt = QDateTime::currentDateTime();
+}
+
+int ParticleCounter::getSamplingCycleInSeconds() const
+{
+    return m_configData.subsequentRinsingTimeInSeconds + m_configData.samplingTimeInSeconds;
+}
+
+void ParticleCounter::setLiveCountsInterval(int intervalInSeconds)
+{
+    if (intervalInSeconds < 0)
+        intervalInSeconds = 0;
+
+    if (intervalInSeconds != m_liveCountsIntervalInSeconds)
+    {
+        m_liveCountsIntervalInSeconds = intervalInSeconds;
+        m_dataChanged = true;
+        emit signal_needsSaving();
+    }
+}
+
+int ParticleCounter::getLiveCountsInterval() const
+{
+    return m_liveCountsIntervalInSeconds;
+}
+
+bool ParticleCounter::isLiveCountsRequestDue() const
+{
+    if ((m_liveCountsIntervalInSeconds == 0) || !m_actualData.online)
+        return false;
+
+    if (!m_lastLiveCountsRequest.isValid())
+        return true;
+
+    return (m_lastLiveCountsRequest.secsTo(QDateTime::currentDateTime()) >= m_liveCountsIntervalInSeconds);
+}
+
+void ParticleCounter::setArchiveAcquisitionEnabled(bool on)
+{
+    if (on != m_archiveAcquisitionEnabled)
+    {
+        m_archiveAcquisitionEnabled = on;
+        m_dataChanged = true;
+        emit signal_needsSaving();
+    }
+}
+
+void ParticleCounter::setZone(QString zone)
+{
+    zone = zone.trimmed();
+    if (zone == m_zone)
+        return;
+
+    m_zone = zone;
+    updateZoneTag();
+    m_dataChanged = true;
+    emit signal_needsSaving();
+}
+
+void ParticleCounter::updateZoneTag()
+{
+    m_zoneTag.clear();
+    if (m_zone.isEmpty())
+        return;
+
+    // Commas, equal signs and spaces have to be escaped in influx tag values
+    QByteArray tagValue = m_zone.toUtf8();
+    tagValue.replace('\\', "\\\\");
+    tagValue.replace(',', "\\,");
+    tagValue.replace('=', "\\=");
+    tagValue.replace(' ', "\\ ");
+    m_zoneTag = ",tag_room=" + tagValue;
+}
+
+QString ParticleCounter::getZone() const
+{
+    return m_zone;
+}
+
+QByteArray ParticleCounter::getZoneTag() const
+{
+    return m_zoneTag;
+}
+
+bool ParticleCounter::isArchiveAcquisitionEnabled() const
+{
+    return m_archiveAcquisitionEnabled;
+}
+
 void ParticleCounter::storeSettingsToFlash()
 {
     if (!isConfigured())
@@ -307,6 +556,11 @@ ParticleCounter::ActualData ParticleCounter::getActualData() const
     return m_actualData;
 }
 
+ParticleCounter::ArchiveDatasetSnapshotPtr ParticleCounter::getLatestArchiveDatasetSnapshot() const
+{
+    return m_latestArchiveDatasetSnapshot;
+}
+
 void ParticleCounter::requestDeviceInfo()
 {
     if (!isConfigured())
@@ -325,6 +579,21 @@ void ParticleCounter::requestDeviceInfo()
     m_transactionIDs.append(bus->readInputRegisters(m_modbusAddress, ParticleCounter::INPUT_REG_0001_0048_DeviceInfoString, 48));
     m_transactionIDs.append(bus->readInputRegisters(m_modbusAddress, ParticleCounter::INPUT_REG_0065_0080_DeviceIDString, 16));
     m_transactionIDs.append(bus->readInputRegisters(m_modbusAddress, ParticleCounter::INPUT_REG_0082_ModbusRegistersetVersion, 1));
+    m_deviceInfoTelegramID = m_transactionIDs.last();
+    m_deviceInfoRequestRunning = true;
+}
+
+bool ParticleCounter::isDeviceInfoRevalidationDue() const
+{
+    return (!m_deviceInfoValidated && !m_deviceInfoRequestRunning);
+}
+
+void ParticleCounter::clearDeviceInfo()
+{
+    m_deviceInfo.deviceInfoString.clear();
+    m_deviceInfo.deviceIdString.clear();
+    m_deviceInfo.modbusRegistersetVersion.clear();
+    m_deviceInfoValidated = false;
 }
 
 void ParticleCounter::requestStatus()
@@ -354,8 +623,30 @@ void ParticleCounter::requestStatus()
         m_transactionIDs.append(bus->readInputRegisters(m_modbusAddress, ParticleCounter::INPUT_REG_0089_StatusRegister, 1));
         m_transactionIDs.append(bus->readInputRegisters(m_modbusAddress, ParticleCounter::INPUT_REG_0096_ErrorstateRegister, 1));
         m_transactionIDs.append(bus->readInputRegisters(m_modbusAddress, ParticleCounter::INPUT_REG_0097_0112_PhysicalUnitString, 16));
-    //    m_transactionIDs.append(bus->readInputRegisters(m_modbusAddress, ParticleCounter::INPUT_REG_0257_LivecountsTimestampSeconds,
-    //                                                      ParticleCounter::INPUT_REG_0285_0286_LivecountsChannel8LH + 1 - ParticleCounter::INPUT_REG_0257_LivecountsTimestampSeconds + 1));
+    }
+}
+
+void ParticleCounter::requestLiveCounts()
+{
+    if (!isConfigured())
+    {
+        m_loghandler->slot_newEntry(LogEntry::Error, "Particle Counter id=" + QString().setNum(m_id), " not configured.");
+        return;
+    }
+
+    ModBus* bus = m_pcModbusSystem->getBusByID(m_busID);
+    if (bus == nullptr)
+    {
+        m_loghandler->slot_newEntry(LogEntry::Error, "Particle Counter id=" + QString().setNum(m_id), " Bus id " + QString().setNum(m_busID) + " not found.");
+        return;
+    }
+
+    if (m_actualData.online)
+    {
+        // The whole live block (timestamp and all channels) is read in one telegram
+        m_transactionIDs.append(bus->readInputRegisters(m_modbusAddress, ParticleCounter::INPUT_REG_0257_LivecountsTimestampSeconds,
+                                                        ParticleCounter::INPUT_REG_0285_0286_LivecountsChannel8LH + 1 - ParticleCounter::INPUT_REG_0257_LivecountsTimestampSeconds + 1));
+        m_lastLiveCountsRequest = QDateTime::currentDateTime();
     }
 }
 
@@ -446,6 +737,170 @@ void ParticleCounter::setConfigData(ConfigData data)
     m_transactionIDs.append(bus->writeSingleRegister(m_modbusAddress, ParticleCounter::HOLDING_REG_0005_SamplingTimeInSeconds, data.samplingTimeInSeconds));
 }
 
+void ParticleCounter::requestLimits()
+{
+    if (!isConfigured())
+        return;
+
+    ModBus* bus = m_pcModbusSystem->getBusByID(m_busID);
+    if (bus == nullptr)
+        return;
+
+    m_transactionIDs.append(bus->readHoldingRegisters(m_modbusAddress, ParticleCounter::HOLDING_REG_0033_0034_UpperWarningLimitChannel1LH,
+                                                      ParticleCounter::HOLDING_REG_0080_AlarmDelayChannel8 - ParticleCounter::HOLDING_REG_0033_0034_UpperWarningLimitChannel1LH + 1));
+}
+
+ParticleCounter::Limits ParticleCounter::getLimits() const
+{
+    return m_limits;
+}
+
+ParticleCounter::Limits ParticleCounter::getLimitsToChange() const
+{
+    if (m_limitsWriteStatus == LIMITS_WRITE_PENDING)
+        return m_limitsWritten;
+    return m_limits;
+}
+
+void ParticleCounter::setLimits(const Limits &limits)
+{
+    if (!isConfigured())
+        return;
+
+    ModBus* bus = m_pcModbusSystem->getBusByID(m_busID);
+    if (bus == nullptr)
+        return;
+
+    // The whole block of registers 33..80 is written with one telegram, 32 bit limits low word first
+    QList<quint16> data;
+    for (int ch=0; ch<8; ch++)
+    {
+        const ChannelLimits& channelLimits = limits.channel[ch];
+        data.append(channelLimits.upperWarningLimit & 0xffff);
+        data.append(channelLimits.upperWarningLimit >> 16);
+        data.append(channelLimits.upperAlarmLimit & 0xffff);
+        data.append(channelLimits.upperAlarmLimit >> 16);
+        data.append(channelLimits.warningDelay);
+        data.append(channelLimits.alarmDelay);
+    }
+
+    m_limitsWritten = limits;
+    m_limitsWriteStatus = LIMITS_WRITE_PENDING;
+    m_limitsWriteTelegramID = bus->writeMultipleRegisters(m_modbusAddress, ParticleCounter::HOLDING_REG_0033_0034_UpperWarningLimitChannel1LH, data);
+    m_transactionIDs.append(m_limitsWriteTelegramID);
+
+    // The bus processes the telegrams in order, so the read back returns the limits after the write
+    m_limitsReadbackTelegramID = bus->readHoldingRegisters(m_modbusAddress, ParticleCounter::HOLDING_REG_0033_0034_UpperWarningLimitChannel1LH,
+                                                           ParticleCounter::HOLDING_REG_0080_AlarmDelayChannel8 - ParticleCounter::HOLDING_REG_0033_0034_UpperWarningLimitChannel1LH + 1);
+    m_transactionIDs.append(m_limitsReadbackTelegramID);
+}
+
+ParticleCounter::LimitsWriteStatus ParticleCounter::getLimitsWriteStatus() const
+{
+    return m_limitsWriteStatus;
+}
+
+QString ParticleCounter::limitsWriteStatusName(LimitsWriteStatus status)
+{
+    switch (status)
+    {
+    case LIMITS_WRITE_PENDING:
+        return "pending";
+    case LIMITS_WRITE_VERIFIED:
+        return "verified";
+    case LIMITS_WRITE_MISMATCH:
+        return "mismatch";
+    case LIMITS_WRITE_LOST:
+        return "lost";
+    default:
+        return "none";
+    }
+}
+
+int ParticleCounter::applyLimitSettings(const QMap<QString, QString> &data, Limits *limits, QString *error)
+{
+    int channels = 0;
+
+    foreach (QString key, data.keys())
+    {
+        if (!key.startsWith("limit"))
+            continue;
+
+        bool ok;
+        int channel = key.mid(5).toInt(&ok);
+        if (!ok || (channel < 1) || (channel > 8))
+        {
+            *error = "Key \"" + key + "\" invalid, channels are limit1..limit8.";
+            return -1;
+        }
+
+        // WARNING,ALARM,WARNINGDELAY,ALARMDELAY - empty fields keep the value
+        QStringList fields = data.value(key).split(',');
+        if (fields.length() > 4)
+        {
+            *error = "Value of " + key + " invalid, expected WARNING,ALARM,WARNINGDELAY,ALARMDELAY.";
+            return -1;
+        }
+
+        ChannelLimits channelLimits = limits->channel[channel - 1];
+        for (int i=0; i<fields.length(); i++)
+        {
+            if (fields.at(i).isEmpty())
+                continue;
+
+            quint32 value = fields.at(i).toUInt(&ok);
+            if (!ok || ((i >= 2) && (value > 0xffff)))
+            {
+                *error = "Value of " + key + " invalid, expected WARNING,ALARM,WARNINGDELAY,ALARMDELAY.";
+                return -1;
+            }
+
+            switch (i)
+            {
+            case 0:
+                channelLimits.upperWarningLimit = value;
+                break;
+            case 1:
+                channelLimits.upperAlarmLimit = value;
+                break;
+            case 2:
+                channelLimits.warningDelay = value;
+                break;
+            case 3:
+                channelLimits.alarmDelay = value;
+                break;
+            }
+        }
+        limits->channel[channel - 1] = channelLimits;
+        channels++;
+    }
+
+    return channels;
+}
+
+void ParticleCounter::verifyLimits()
+{
+    QString module = "Particle Counter id=" + QString().setNum(m_id);
+    QString text = "Limits read back differ from the written limits.";
+
+    for (int ch=0; ch<8; ch++)
+    {
+        const ChannelLimits& expected = m_limitsWritten.channel[ch];
+        const ChannelLimits& actual = m_limits.channel[ch];
+        if ((expected.upperWarningLimit != actual.upperWarningLimit) || (expected.upperAlarmLimit != actual.upperAlarmLimit) ||
+            (expected.warningDelay != actual.warningDelay) || (expected.alarmDelay != actual.alarmDelay))
+        {
+            m_limitsWriteStatus = LIMITS_WRITE_MISMATCH;
+            m_loghandler->slot_newEntry(LogEntry::Error, module, text);
+            return;
+        }
+    }
+
+    m_limitsWriteStatus = LIMITS_WRITE_VERIFIED;
+    m_loghandler->slot_entryGone(LogEntry::Error, module, text);
+    m_loghandler->slot_entryGone(LogEntry::Error, module, "Writing limits failed, telegram lost.");
+}
+
 void ParticleCounter::requestClock()
 {
     if (!isConfigured())
@@ -478,15 +933,23 @@ void ParticleCounter::setClock()
     m_transactionIDs.append(bus->writeSingleRegister(m_modbusAddress, ParticleCounter::HOLDING_REG_0100_Command, ParticleCounter::COMMAND_0001_SetClock));
 }
 
-void ParticleCounter::save()
+bool ParticleCounter::save()
 {
     if (!m_dataChanged)
-        return;
+        return true;
 
-    QFile file(myFilename());
-    if (!file.open(QIODevice::WriteOnly))
-        return;
+    if (m_registry == nullptr)
+        return false;
+
+    bool ok = m_registry->put(m_id, toConfigLine());
+    if (ok)
+        m_dataChanged = false;
+
+    return ok;
+}
 
+QString ParticleCounter::toConfigLine() const
+{
     QString wdata;
 
     wdata.append(QString().sprintf("id=%i ", m_id));
@@ -498,33 +961,36 @@ void ParticleCounter::save()
     wdata.append(QString().sprintf("firstRinsingTimeInSeconds=%i ", m_configData.firstRinsingTimeInSeconds));
     wdata.append(QString().sprintf("subsequentRinsingTimeInSeconds=%i ", m_configData.subsequentRinsingTimeInSeconds));
     wdata.append(QString().sprintf("samplingTimeInSeconds=%i ", m_configData.samplingTimeInSeconds));
-    wdata.append(QString().sprintf("samplingEnabled=%i\n", m_samplingEnabled));
-
-    file.write(wdata.toUtf8());
-
-    file.close();
+    wdata.append(QString().sprintf("liveCountsIntervalInSeconds=%i ", m_liveCountsIntervalInSeconds));
+    wdata.append(QString().sprintf("archiveAcquisitionEnabled=%i ", m_archiveAcquisitionEnabled));
+    wdata.append(QString().sprintf("samplingEnabled=%i ", m_samplingEnabled));
+    // Device info strings may contain spaces, so they are percent encoded
+    wdata.append("deviceInfoString=" + QString::fromLatin1(QUrl::toPercentEncoding(m_deviceInfo.deviceInfoString)) + " ");
+    wdata.append("deviceIdString=" + QString::fromLatin1(QUrl::toPercentEncoding(m_deviceInfo.deviceIdString)) + " ");
+    wdata.append("modbusRegistersetVersion=" + QString::fromLatin1(QUrl::toPercentEncoding(m_deviceInfo.modbusRegistersetVersion)) + " ");
+    wdata.append("zone=" + QString::fromLatin1(QUrl::toPercentEncoding(m_zone)));
+
+    return wdata;
 }
 
-void ParticleCounter::setFiledirectory(QString path)
+void ParticleCounter::setRegistry(ParticleCounterRegistry *registry)
 {
-    if (!path.endsWith("/"))
-        path.append("/");
-    m_filepath = path;
-
-    QDir dir;
-    dir.mkpath(path);
+    m_registry = registry;
 }
 
-void ParticleCounter::load(QString filename)
+bool ParticleCounter::hasUnsavedChanges() const
 {
-    QFile file(filename);
-
-    if (!file.open(QIODevice::ReadOnly))
-        return;
+    return m_dataChanged;
+}
 
-    QString rdata = QString().fromUtf8(file.readLine());
+void ParticleCounter::markAsSaved()
+{
+    m_dataChanged = false;
+}
 
-    QStringList dataList = rdata.split(" ");
+void ParticleCounter::fromConfigLine(QString line)
+{
+    QStringList dataList = line.trimmed().split(" ");
     foreach (QString data, dataList)
     {
         QStringList pair = data.split("=");
@@ -576,13 +1042,42 @@ void ParticleCounter::load(QString filename)
             m_configData.samplingTimeInSeconds = value.toInt();
         }
 
+        if (key == "liveCountsIntervalInSeconds")
+        {
+            m_liveCountsIntervalInSeconds = qMax(0, value.toInt());
+        }
+
+        if (key == "archiveAcquisitionEnabled")
+        {
+            m_archiveAcquisitionEnabled = value.toInt();
+        }
+
         if (key == "samplingEnabled")
         {
             m_samplingEnabled = value.toInt();
         }
-    }
 
-    file.close();
+        if (key == "deviceInfoString")
+        {
+            m_deviceInfo.deviceInfoString = QUrl::fromPercentEncoding(value.trimmed().toLatin1());
+        }
+
+        if (key == "deviceIdString")
+        {
+            m_deviceInfo.deviceIdString = QUrl::fromPercentEncoding(value.trimmed().toLatin1());
+        }
+
+        if (key == "modbusRegistersetVersion")
+        {
+            m_deviceInfo.modbusRegistersetVersion = QUrl::fromPercentEncoding(value.trimmed().toLatin1());
+        }
+
+        if (key == "zone")
+        {
+            m_zone = QUrl::fromPercentEncoding(value.trimmed().toLatin1()).trimmed();
+            updateZoneTag();
+        }
+    }
 }
 
 void ParticleCounter::setAutoSave(bool on)
@@ -596,8 +1091,8 @@ void ParticleCounter::setAutoSave(bool on)
 
 void ParticleCounter::deleteFromHdd()
 {
-    QFile file(myFilename());
-    file.remove();
+    if (m_registry != nullptr)
+        m_registry->remove(m_id);
 }
 
 void ParticleCounter::deleteAllErrors()
@@ -618,10 +1113,6 @@ bool ParticleCounter::isThisYourTelegram(quint64 telegramID, bool deleteID)
     return found;
 }
 
-QString ParticleCounter::myFilename()
-{
-    return (m_filepath + QString().sprintf("particlecounter-%06i.csv", m_id));
-}
 
 bool ParticleCounter::isConfigured()
 {
@@ -649,12 +1140,40 @@ void ParticleCounter::processConfigData()
 //    setNmaxFromConfigData();
 }
 
+void ParticleCounter::publishActualData()
+{
+    ActualDataSnapshot* snapshot = new ActualDataSnapshot;
+    snapshot->id = m_id;
+    snapshot->busID = m_busID;
+    snapshot->sequenceNumber = ++m_sequenceNumber;
+    snapshot->actualData = m_actualData;
+    snapshot->deviceInfo = m_deviceInfo;
+    snapshot->zone = m_zone;
+    snapshot->zoneTag = m_zoneTag;
+
+    emit signal_ParticleCounterActualDataReceived(ActualDataSnapshotPtr(snapshot));
+}
+
+void ParticleCounter::publishArchiveDataset(const ArchiveDataset &archiveDataset)
+{
+    ArchiveDatasetSnapshot* snapshot = new ArchiveDatasetSnapshot;
+    snapshot->id = m_id;
+    snapshot->busID = m_busID;
+    snapshot->sequenceNumber = ++m_sequenceNumber;
+    snapshot->archiveData = archiveDataset;
+    snapshot->limits = m_limits;
+    snapshot->deviceInfo = m_deviceInfo;
+    snapshot->zone = m_zone;
+    snapshot->zoneTag = m_zoneTag;
+
+    m_latestArchiveDatasetSnapshot = ArchiveDatasetSnapshotPtr(snapshot);
+    emit signal_ParticleCounterArchiveDataReceived(m_latestArchiveDatasetSnapshot);
+}
+
 // ************************************************** Bus response handling **************************************************
 
 void ParticleCounter::slot_transactionLost(quint64 id)
 {
-    Q_UNUSED(id)
-
     // If the device has a lost telegram, mark it as offline and increment error counter
     m_actualData.lostTelegrams++;
     if (m_actualData.online)
@@ -662,16 +1181,73 @@ void ParticleCounter::slot_transactionLost(quint64 id)
         m_loghandler->slot_newEntry(LogEntry::Error, "Particle Counter id=" + QString().setNum(m_id), "Not online.");
         m_actualData.online = false;
     }
-//    emit signal_ParticleCounterActualDataHasChanged(m_id);
+
+    if (m_initRunning && (id == m_initTelegramID))
+    {
+        m_initRunning = false;
+        emit signal_initFinished(this, false);
+    }
+
+    if (m_deviceInfoRequestRunning && (id == m_deviceInfoTelegramID))
+        m_deviceInfoRequestRunning = false;     // Retried by the next revalidation
+
+    if ((m_limitsWriteStatus == LIMITS_WRITE_PENDING) && ((id == m_limitsWriteTelegramID) || (id == m_limitsReadbackTelegramID)))
+    {
+        m_limitsWriteStatus = LIMITS_WRITE_LOST;
+        m_loghandler->slot_newEntry(LogEntry::Error, "Particle Counter id=" + QString().setNum(m_id), "Writing limits failed, telegram lost.");
+    }
 }
 
-void ParticleCounter::slot_receivedHoldingRegisterData(quint64 telegramID, quint16 adr, quint16 reg, QList<quint16> data)
+void ParticleCounter::slot_receivedRegisterData(ModbusRegisterResponsePtr response)
 {
-    Q_UNUSED(telegramID)
+    if ((response->slaveAddress != m_modbusAddress) || (response->busID != m_busID))
+        return;
+
+    if (response->registerType == ModbusHoldingRegister)
+        processHoldingRegisterData(*response);
+    else
+    {
+        DeviceInfo previousDeviceInfo = m_deviceInfo;
+        processInputRegisterData(*response);
+        saveDeviceInfoIfChanged(previousDeviceInfo);
+    }
+
+    if (m_deviceInfoRequestRunning && (response->telegramID == m_deviceInfoTelegramID))
+    {
+        m_deviceInfoRequestRunning = false;
+        m_deviceInfoValidated = true;
+    }
 
-    if (adr != m_modbusAddress)
+    if ((m_limitsWriteStatus == LIMITS_WRITE_PENDING) && (response->telegramID == m_limitsReadbackTelegramID))
+        verifyLimits();
+
+    if (m_initRunning && (response->telegramID == m_initTelegramID))
+    {
+        m_initRunning = false;
+        m_initialized = true;
+        emit signal_initFinished(this, true);
+    }
+}
+
+void ParticleCounter::saveDeviceInfoIfChanged(const DeviceInfo &previousDeviceInfo)
+{
+    if ((previousDeviceInfo.deviceInfoString == m_deviceInfo.deviceInfoString) &&
+        (previousDeviceInfo.deviceIdString == m_deviceInfo.deviceIdString) &&
+        (previousDeviceInfo.modbusRegistersetVersion == m_deviceInfo.modbusRegistersetVersion))
         return;
 
+    if (!previousDeviceInfo.deviceIdString.isEmpty() && (previousDeviceInfo.deviceIdString != m_deviceInfo.deviceIdString))
+        m_loghandler->slot_newEntry(LogEntry::Warning, "Particle Counter id=" + QString().setNum(m_id),
+                                    "Device ID changed from \"" + previousDeviceInfo.deviceIdString + "\" to \"" + m_deviceInfo.deviceIdString + "\".");
+
+    m_dataChanged = true;
+    emit signal_needsSaving();
+}
+
+void ParticleCounter::processHoldingRegisterData(const ModbusRegisterResponse &response)
+{
+    quint16 reg = response.dataStartAddress;
+
     markAsOnline();
 
     QDateTime deviceRTC = QDateTime();
@@ -684,7 +1260,7 @@ void ParticleCounter::slot_receivedHoldingRegisterData(quint64 telegramID, quint
     quint16 months = 0;
     quint16 years = 0;
 
-    foreach(quint16 rawdata, data)
+    foreach(quint16 rawdata, response.data)
     {
         switch (reg)
         {
@@ -728,85 +1304,47 @@ void ParticleCounter::slot_receivedHoldingRegisterData(quint64 telegramID, quint
             deviceRTC.setDate(deviceDate);
             deviceRTC.setTime(deviceTime);
             break;
-        case ParticleCounter::HOLDING_REG_0033_0034_UpperWarningLimitChannel1LH:
-            break;
-        case ParticleCounter::HOLDING_REG_0035_0036_UpperAlarmLimitChannel1LH:
-            break;
-        case ParticleCounter::HOLDING_REG_0037_WarningDelayChannel1:
-            break;
-        case ParticleCounter::HOLDING_REG_0038_AlarmDelayChannel1:
-            break;
-        case ParticleCounter::HOLDING_REG_0039_0040_UpperWarningLimitChannel2LH:
-            break;
-        case ParticleCounter::HOLDING_REG_0041_0042_UpperAlarmLimitChannel2LH:
-            break;
-        case ParticleCounter::HOLDING_REG_0043_WarningDelayChannel2:
-            break;
-        case ParticleCounter::HOLDING_REG_0044_AlarmDelayChannel2:
-            break;
-        case ParticleCounter::HOLDING_REG_0045_0046_UpperWarningLimitChannel3LH:
-            break;
-        case ParticleCounter::HOLDING_REG_0047_0048_UpperAlarmLimitChannel3LH:
-            break;
-        case ParticleCounter::HOLDING_REG_0049_WarningDelayChannel3:
-            break;
-        case ParticleCounter::HOLDING_REG_0050_AlarmDelayChannel3:
-            break;
-        case ParticleCounter::HOLDING_REG_0051_0052_UpperWarningLimitChannel4LH:
-            break;
-        case ParticleCounter::HOLDING_REG_0053_0054_UpperAlarmLimitChannel4LH:
-            break;
-        case ParticleCounter::HOLDING_REG_0055_WarningDelayChannel4:
-            break;
-        case ParticleCounter::HOLDING_REG_0056_AlarmDelayChannel4:
-            break;
-        case ParticleCounter::HOLDING_REG_0057_0058_UpperWarningLimitChannel5LH:
-            break;
-        case ParticleCounter::HOLDING_REG_0059_0060_UpperAlarmLimitChannel5LH:
-            break;
-        case ParticleCounter::HOLDING_REG_0061_WarningDelayChannel5:
-            break;
-        case ParticleCounter::HOLDING_REG_0062_AlarmDelayChannel5:
-            break;
-        case ParticleCounter::HOLDING_REG_0063_0064_UpperWarningLimitChannel6LH:
-            break;
-        case ParticleCounter::HOLDING_REG_0065_0066_UpperAlarmLimitChannel6LH:
-            break;
-        case ParticleCounter::HOLDING_REG_0067_WarningDelayChannel6:
-            break;
-        case ParticleCounter::HOLDING_REG_0068_AlarmDelayChannel6:
-            break;
-        case ParticleCounter::HOLDING_REG_0069_0070_UpperWarningLimitChannel7LH:
-            break;
-        case ParticleCounter::HOLDING_REG_0071_0072_UpperAlarmLimitChannel7LH:
-            break;
-        case ParticleCounter::HOLDING_REG_0073_WarningDelayChannel7:
-            break;
-        case ParticleCounter::HOLDING_REG_0074_AlarmDelayChannel7:
-            break;
-        case ParticleCounter::HOLDING_REG_0075_0076_UpperWarningLimitChannel8LH:
-            break;
-        case ParticleCounter::HOLDING_REG_0077_0078_UpperAlarmLimitChannel8LH:
-            break;
-        case ParticleCounter::HOLDING_REG_0079_WarningDelayChannel8:
-            break;
-        case ParticleCounter::HOLDING_REG_0080_AlarmDelayChannel8:
-            break;
         case ParticleCounter::HOLDING_REG_0100_Command:
             break;
         default:
+            // Limits and delays of the eight channels are laid out in blocks of six registers, limits low word first
+            if ((reg >= ParticleCounter::HOLDING_REG_0033_0034_UpperWarningLimitChannel1LH) && (reg <= ParticleCounter::HOLDING_REG_0080_AlarmDelayChannel8))
+            {
+                int offset = reg - ParticleCounter::HOLDING_REG_0033_0034_UpperWarningLimitChannel1LH;
+                ChannelLimits& channelLimits = m_limits.channel[offset / 6];
+                switch (offset % 6)
+                {
+                case 0:
+                    channelLimits.upperWarningLimit = (channelLimits.upperWarningLimit & 0xffff0000) | rawdata;
+                    break;
+                case 1:
+                    channelLimits.upperWarningLimit = (channelLimits.upperWarningLimit & 0x0000ffff) | ((quint32)rawdata << 16);
+                    break;
+                case 2:
+                    channelLimits.upperAlarmLimit = (channelLimits.upperAlarmLimit & 0xffff0000) | rawdata;
+                    break;
+                case 3:
+                    channelLimits.upperAlarmLimit = (channelLimits.upperAlarmLimit & 0x0000ffff) | ((quint32)rawdata << 16);
+                    break;
+                case 4:
+                    channelLimits.warningDelay = rawdata;
+                    break;
+                case 5:
+                    channelLimits.alarmDelay = rawdata;
+                    break;
+                }
+                if (reg == ParticleCounter::HOLDING_REG_0080_AlarmDelayChannel8)
+                    m_limits.valid = true;
+            }
             break;
         }
     reg++;
     }
 }
 
-void ParticleCounter::slot_receivedInputRegisterData(quint64 telegramID, quint16 adr, quint16 reg, QList<quint16> data)
+void ParticleCounter::processInputRegisterData(const ModbusRegisterResponse &response)
 {
-    Q_UNUSED(telegramID)
-
-    if (adr != m_modbusAddress)
-        return;
+    quint16 reg = response.dataStartAddress;
 
     markAsOnline();
 
@@ -823,7 +1361,7 @@ void ParticleCounter::slot_receivedInputRegisterData(quint64 telegramID, quint16
 
     ArchiveDataset archiveDataset;
 
-    foreach(quint16 rawdata, data)
+    foreach(quint16 rawdata, response.data)
     {
         // Clear strings if first byte of corrsponding string is received because more will follow to complete the string in the same response
         if (reg == ParticleCounter::INPUT_REG_0001_0048_DeviceInfoString)
@@ -853,13 +1391,27 @@ void ParticleCounter::slot_receivedInputRegisterData(quint64 telegramID, quint16
             m_statusRegister.currentlyRinsing = (bool)((rawdata & (1 << 2)) >> 2);
             m_statusRegister.dataReady = (bool)((rawdata & (1 << 3)) >> 3);
 
+            if (m_alignedSampling && m_samplingEnabled && !m_statusRegister.deviceActive && (m_samplingStartedAt.secsTo(QDateTime::currentDateTime()) < 30))
+                break;      // The status was read before the aligned start reached the particle counter
             if (m_samplingEnabled != m_statusRegister.deviceActive)
             {
                 this->setClock();
                 this->setConfigData(m_configData);
-                this->requestDeviceInfo();
-                this->setSamplingEnabled(m_samplingEnabled);
-                m_loghandler->slot_newEntry(LogEntry::Warning, "Particle Counter id=" + QString().setNum(m_id), "Stopped working. Restarted.");
+                m_deviceInfoValidated = false;  // Revalidated lazily, the cached device info is used meanwhile
+                if (m_deviceInfo.deviceIdString.isEmpty())
+                    this->requestDeviceInfo();
+                if (m_alignedSampling && m_samplingEnabled)
+                {
+                    // A restart right away would leave the sampling window of the particle counter out of line
+                    this->setSamplingEnabled(false);
+                    m_loghandler->slot_newEntry(LogEntry::Warning, "Particle Counter id=" + QString().setNum(m_id), "Stopped working. Restart at the next sampling boundary.");
+                    emit signal_realignmentNeeded(this);
+                }
+                else
+                {
+                    this->setSamplingEnabled(m_samplingEnabled);
+                    m_loghandler->slot_newEntry(LogEntry::Warning, "Particle Counter id=" + QString().setNum(m_id), "Stopped working. Restarted.");
+                }
             }
             break;
         case ParticleCounter::INPUT_REG_0096_ErrorstateRegister:
@@ -1010,7 +1562,7 @@ void ParticleCounter::slot_receivedInputRegisterData(quint64 telegramID, quint16
         case ParticleCounter::INPUT_REG_0285_0286_LivecountsChannel8LH + 1:
             m_actualData.channelData[7].count += (quint32)rawdata << 16;
             // INPUT_REG_0285_0286_LivecountsChannel8LH + 1 is the last data we get from automatic query, so signal new data now
-            emit signal_ParticleCounterActualDataReceived(m_id, m_actualData, m_deviceInfo);
+            publishActualData();
             break;
         case ParticleCounter::INPUT_REG_0513_ArchiveDataSetTimestampSeconds:
             seconds = rawdata;
@@ -1122,7 +1674,7 @@ void ParticleCounter::slot_receivedInputRegisterData(quint64 telegramID, quint16
         case ParticleCounter::INPUT_REG_0543_0544_ArchiveDataSetChannel8LH + 1:
             archiveDataset.channelData[7].count += (quint32)rawdata << 16;
             if (archiveDataset.channelData[0].count != 0xffffffff)
-                emit signal_ParticleCounterArchiveDataReceived(m_id, archiveDataset, m_deviceInfo);
+                publishArchiveDataset(archiveDataset);
             break;
         default:
             break;
@@ -17,12 +17,13 @@
 #ifndef PARTICLECOUNTER_H
 #define PARTICLECOUNTER_H
 
-#include <QObject>
 #include <QObject>
 #include <QMap>
 #include <QDateTime>
+#include <QSharedPointer>
 #include "particlecountermodbussystem.h"
 #include "loghandler.h"
+#include "particlecounterregistry.h"
 
 class ParticleCounter : public QObject
 {
@@ -180,12 +181,68 @@ public:
         ChannelData channelData[8];
     } ArchiveDataset;
 
+    // Aggregates of the archive datasets over a rolling window, see ParticleCounterAggregates
+    typedef struct {
+        int windowInSeconds;
+        quint32 samples;        // Number of archive datasets in the window
+        quint64 sum[8];
+        quint32 max[8];
+    } WindowAggregate;
+
+    // Upper warning and alarm limits with their delays as stored in the particle counter (holding registers 33..80)
+    typedef struct {
+        quint32 upperWarningLimit;
+        quint32 upperAlarmLimit;
+        quint16 warningDelay;
+        quint16 alarmDelay;
+    } ChannelLimits;
+
+    typedef struct {
+        ChannelLimits channel[8];
+        bool valid;         // All limits have been read from the particle counter
+    } Limits;
+
+    // Written limits are read back and compared with the limits that have been sent
+    typedef enum {
+        LIMITS_WRITE_NONE = 0,
+        LIMITS_WRITE_PENDING = 1,
+        LIMITS_WRITE_VERIFIED = 2,
+        LIMITS_WRITE_MISMATCH = 3,
+        LIMITS_WRITE_LOST = 4
+    } LimitsWriteStatus;
+
     typedef struct {
         QString deviceInfoString;
         QString deviceIdString;
         QString modbusRegistersetVersion;
     } DeviceInfo;
 
+    // Immutable snapshots of decoded datasets as they are published to all consumers.
+    // The sequence number is counted per particle counter over both kinds of datasets.
+    typedef struct {
+        int id;
+        int busID;
+        quint64 sequenceNumber;
+        ActualData actualData;
+        DeviceInfo deviceInfo;
+        QString zone;
+        QByteArray zoneTag;
+    } ActualDataSnapshot;
+
+    typedef struct {
+        int id;
+        int busID;
+        quint64 sequenceNumber;
+        ArchiveDataset archiveData;
+        DeviceInfo deviceInfo;
+        QString zone;
+        QByteArray zoneTag;
+        Limits limits;
+    } ArchiveDatasetSnapshot;
+
+    typedef QSharedPointer<const ActualDataSnapshot> ActualDataSnapshotPtr;
+    typedef QSharedPointer<const ArchiveDatasetSnapshot> ArchiveDatasetSnapshotPtr;
+
     typedef struct {
         OutputDataFormat outputDataFormat;
         quint16 addupCount;
@@ -214,6 +271,26 @@ public:
         bool flowError;
     } ErrorstateRegister;
 
+    // Copy of the state of a particle counter as it is published to readers outside of the main thread
+    typedef struct {
+        int id;
+        int busID;
+        int modbusAddress;
+        ActualData actualData;
+        DeviceInfo deviceInfo;
+        bool deviceInfoValidated;
+        ErrorstateRegister errorstateRegister;
+        int liveCountsIntervalInSeconds;
+        bool archiveAcquisitionEnabled;
+        QString zone;
+        Limits limits;
+        LimitsWriteStatus limitsWriteStatus;
+        QList<WindowAggregate> aggregates;      // Filled in by the database
+        double isoClass;                        // ISO 14644-1 class, filled in by the database, -1 if not classified
+        double zoneIsoClass;
+        ArchiveDatasetSnapshotPtr latestArchiveDataset;    // Filled in by the database, null until the first archive dataset was read
+    } State;
+
     // Central id from the openFFUcontrol database
     int getId() const;
     void setId(int id);
@@ -226,32 +303,70 @@ public:
     int getModbusAddress() const;
     void setModbusAddress(int modbusAddress);
 
-    // Do all the initialization to get operational
-    void init();
+    // Do all the initialization to get operational. Returns the number of queued telegrams, 0 if nothing could be sent.
+    // signal_initFinished() is emitted as soon as the last telegram of the init has been answered or is lost.
+    int init();
+    bool isInitialized() const;     // The last init was answered by the particle counter
+    bool isInitRunning() const;
 
     // Get or set any data by name
     QString getData(QString key);
     void setData(QString key, QString value);
 
+    // Get the state of the particle counter and format data of a state by name
+    State getState() const;
+    static QString formatData(const State &state, QString key);
+
     // Start or Stop Sampling
     void setSamplingEnabled(bool on);
     bool isSampling() const;
 
+    // With aligned sampling the init leaves the acquisition stopped, it is started by ParticleCounterSamplingAligner
+    // at a wall clock boundary. If the particle counter stops working, signal_realignmentNeeded() is emitted instead of a restart.
+    void setAlignedSampling(bool on);
+    bool isAlignedSampling() const;
+    void markAsSampling();      // The acquisition has been started by a broadcast
+    int getSamplingCycleInSeconds() const;     // Subsequent rinsing time plus sampling time
+
+    // Read live counts every intervalInSeconds, 0 switches live acquisition off
+    void setLiveCountsInterval(int intervalInSeconds);
+    int getLiveCountsInterval() const;
+    bool isLiveCountsRequestDue() const;
+
+    // Read archive datasets (the regular measurement data) from the particle counter
+    void setArchiveAcquisitionEnabled(bool on);
+    bool isArchiveAcquisitionEnabled() const;
+
+    // Room or zone the particle counter is installed in, written as tag_room to the time series database. Empty if not assigned.
+    void setZone(QString zone);
+    QString getZone() const;
+    QByteArray getZoneTag() const;      // ",tag_room=<zone>" escaped for the influx line protocol, empty if no zone is assigned
+
     // Write acquisition parameters to permanent storage in order to load them at next startup
     void storeSettingsToFlash();
 
     // Get a list of data keys that this FFU can provide
-    QStringList getActualKeys();
+    static QStringList getActualKeys();
 
     // Get all actual data that this FFU can provide
     ActualData getActualData() const;
 
+    // Get the last published archive dataset, null if nothing has been published yet
+    ArchiveDatasetSnapshotPtr getLatestArchiveDatasetSnapshot() const;
+
     // This function triggers bus requests to get information about the device (serial number etc.)
     void requestDeviceInfo();
 
+    // The device info is saved with the config, so points are tagged with the serial number right after startup.
+    // The cached device info is revalidated at low priority when the bus is idle.
+    bool isDeviceInfoRevalidationDue() const;
+
     // This function triggers bus requests to get actual values, status, warnings and errors
     void requestStatus();
 
+    // This function triggers bus requests to get the live counts of the running sampling interval
+    void requestLiveCounts();
+
     // This function triggers bus requests to get current set of archive data values
     void requestArchiveDataset();
 
@@ -264,18 +379,37 @@ public:
     // This function triggers bus requests to set the necessary config data in the particle counter
     void setConfigData(ConfigData data);
 
+    // This function triggers one bus request to get the warning and alarm limits of all channels
+    void requestLimits();
+    Limits getLimits() const;
+    // Base of a change of the limits: While a write is pending these are the written limits, so a second change
+    // before the read back keeps the first one. Otherwise these are the limits read from the device.
+    Limits getLimitsToChange() const;
+
+    // This function triggers one bus request to write the limits of all channels and one to read them back
+    void setLimits(const Limits& limits);
+    LimitsWriteStatus getLimitsWriteStatus() const;
+    static QString limitsWriteStatusName(LimitsWriteStatus status);
+
+    // Apply entries "limitN=WARNING,ALARM,WARNINGDELAY,ALARMDELAY" (N = 1..8) of data to limits, empty fields keep the value.
+    // Returns the number of channels given, -1 if an entry can not be parsed.
+    static int applyLimitSettings(const QMap<QString,QString>& data, Limits* limits, QString* error);
+
     // This function triggers bus request to get current time from real time clock of the particle counter
     void requestClock();
 
     // This function triggers bus request to set current time in real time clock of the particle counter
     void setClock();
 
-    // Save the setpoints and config to file
-    void save();
-    void setFiledirectory(QString path);
+    // Save the setpoints and config to the registry
+    bool save();    // Returns false if the registry could not be written
+    void setRegistry(ParticleCounterRegistry* registry);
+    bool hasUnsavedChanges() const;
+    void markAsSaved();     // The config has been written by a batch of the database
 
-    // Load setpoints and config from file
-    void load(QString filename);
+    // Setpoints and config as a line of key=value pairs, this is the record of the registry
+    QString toConfigLine() const;
+    void fromConfigLine(QString line);
 
     // Set if changes of important setpoints and config should automatically updated on file if changed
     void setAutoSave(bool on);
@@ -302,14 +436,38 @@ private:
     DeviceInfo m_deviceInfo;
     StatusRegister m_statusRegister;
     ErrorstateRegister m_errorstateRegister;
+    Limits m_limits;
+    Limits m_limitsWritten;                     // Expected result of the read back
+    LimitsWriteStatus m_limitsWriteStatus;
+    quint64 m_limitsWriteTelegramID;
+    quint64 m_limitsReadbackTelegramID;
+    void verifyLimits();
     QString m_physicalUnit;
     bool m_samplingEnabled;
+    bool m_alignedSampling;
+    QDateTime m_samplingStartedAt;     // Status answers shortly after the start may still show the stopped acquisition
+    int m_liveCountsIntervalInSeconds;
+    QDateTime m_lastLiveCountsRequest;
+    bool m_archiveAcquisitionEnabled;
+    QString m_zone;
+    QByteArray m_zoneTag;   // Escaped once when the zone is set, it is appended to every point
+    void updateZoneTag();
+
+    quint64 m_sequenceNumber;
+
+    // The bus processes telegrams of a priority in order, so the init is finished when its last telegram is done
+    bool m_initialized;
+    bool m_initRunning;
+    quint64 m_initTelegramID;
+
+    bool m_deviceInfoValidated;         // Device info has been read from the device since the last init
+    bool m_deviceInfoRequestRunning;
+    quint64 m_deviceInfoTelegramID;     // Last telegram of the device info request
+    ArchiveDatasetSnapshotPtr m_latestArchiveDatasetSnapshot;
 
     bool m_dataChanged;
     bool m_autosave;
-    QString m_filepath;
-
-    QString myFilename();
+    ParticleCounterRegistry* m_registry;
 
     bool isConfigured();    // Returns false if either fanAddress or busID is not set
     void markAsOnline();
@@ -317,19 +475,34 @@ private:
     // This uses m_configData to configure particlecounter
     void processConfigData();
 
+    // Freeze the decoded data into a snapshot and publish it
+    void publishActualData();
+    void publishArchiveDataset(const ArchiveDataset &archiveDataset);
+
+    // Decoders for the register responses of the bus
+    void processHoldingRegisterData(const ModbusRegisterResponse &response);
+    void processInputRegisterData(const ModbusRegisterResponse &response);
+
+    void clearDeviceInfo();
+    void saveDeviceInfoIfChanged(const DeviceInfo &previousDeviceInfo);
+
 signals:
     void signal_needsSaving();
-    void signal_ParticleCounterActualDataReceived(int id, ActualData actualData, DeviceInfo deviceInfo);
-    void signal_ParticleCounterArchiveDataReceived(int id, ArchiveDataset archiveData, DeviceInfo deviceInfo);
+    void signal_initFinished(ParticleCounter* pc, bool success);
+    void signal_realignmentNeeded(ParticleCounter* pc);
+    void signal_ParticleCounterActualDataReceived(ParticleCounter::ActualDataSnapshotPtr snapshot);
+    void signal_ParticleCounterArchiveDataReceived(ParticleCounter::ArchiveDatasetSnapshotPtr snapshot);
 
 public slots:
     // High level bus response slots
     void slot_transactionLost(quint64 id);
-    void slot_receivedHoldingRegisterData(quint64 telegramID, quint16 adr, quint16 reg, QList<quint16> data);
-    void slot_receivedInputRegisterData(quint64 telegramID, quint16 adr, quint16 reg, QList<quint16> data);
+    void slot_receivedRegisterData(ModbusRegisterResponsePtr response);
 
 private slots:
     void slot_save();
 };
 
+Q_DECLARE_METATYPE(ParticleCounter::ActualDataSnapshotPtr)
+Q_DECLARE_METATYPE(ParticleCounter::ArchiveDatasetSnapshotPtr)
+
 #endif // PARTICLECOUNTER_H
@@ -0,0 +1,199 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#include <QStringList>
+#include "particlecounteraggregates.h"
+
+ParticleCounterAggregates::ParticleCounterAggregates(const QList<int> &windowsInSeconds, int bucketsPerWindow)
+{
+    bucketsPerWindow = qMax(1, bucketsPerWindow);
+
+    foreach (int windowInSeconds, windowsInSeconds)
+    {
+        Window window;
+        window.bucketWidthMs = qMax((qint64)1, (qint64)windowInSeconds * 1000 / bucketsPerWindow);
+        window.newestIndex = -1;
+        window.buckets.resize(bucketsPerWindow);
+        for (int i = 0; i < bucketsPerWindow; i++)
+        {
+            window.buckets[i].index = -1;
+            window.buckets[i].samples = 0;
+            for (int ch=0; ch<8; ch++)
+            {
+                window.buckets[i].sum[ch] = 0;
+                window.buckets[i].max[ch] = 0;
+            }
+        }
+        window.aggregate.windowInSeconds = windowInSeconds;
+        window.aggregate.samples = 0;
+        for (int ch=0; ch<8; ch++)
+        {
+            window.aggregate.sum[ch] = 0;
+            window.aggregate.max[ch] = 0;
+        }
+        window.maxOutdated = false;
+        window.lastPeriod = -1;
+        m_windows.append(window);
+    }
+
+    m_aggregatesOutdated = true;
+}
+
+void ParticleCounterAggregates::add(const ParticleCounter::ArchiveDataset &archiveDataset)
+{
+    qint64 timestampMs = archiveDataset.timestamp.toMSecsSinceEpoch();
+
+    for (int w = 0; w < m_windows.size(); w++)
+    {
+        Window& window = m_windows[w];
+        qint64 index = timestampMs / window.bucketWidthMs;
+        if ((window.newestIndex >= 0) && (index <= window.newestIndex - window.buckets.size()))
+            continue;   // Older than the window
+
+        advance(&window, index);
+
+        Bucket& bucket = window.buckets[index % window.buckets.size()];
+        bucket.samples++;
+        window.aggregate.samples++;
+        for (int ch=0; ch<8; ch++)
+        {
+            quint32 count = archiveDataset.channelData[ch].count;
+            bucket.sum[ch] += count;
+            bucket.max[ch] = qMax(bucket.max[ch], count);
+            window.aggregate.sum[ch] += count;
+            window.aggregate.max[ch] = qMax(window.aggregate.max[ch], count);
+        }
+    }
+
+    m_aggregatesOutdated = true;
+}
+
+void ParticleCounterAggregates::expire(qint64 timestampMs)
+{
+    for (int w = 0; w < m_windows.size(); w++)
+    {
+        Window& window = m_windows[w];
+        qint64 index = timestampMs / window.bucketWidthMs;
+        if (index > window.newestIndex)
+        {
+            advance(&window, index);
+            m_aggregatesOutdated = true;
+        }
+    }
+}
+
+QList<ParticleCounter::WindowAggregate> ParticleCounterAggregates::getAggregates()
+{
+    if (!m_aggregatesOutdated)
+        return m_aggregates;
+
+    m_aggregates.clear();
+    for (int w = 0; w < m_windows.size(); w++)
+    {
+        Window& window = m_windows[w];
+        updateMax(&window);
+        m_aggregates.append(window.aggregate);
+    }
+
+    m_aggregatesOutdated = false;
+    return m_aggregates;
+}
+
+QList<ParticleCounterAggregates::CompletedPeriod> ParticleCounterAggregates::takeCompletedPeriods(qint64 timestampMs)
+{
+    QList<CompletedPeriod> completedPeriods;
+
+    for (int w = 0; w < m_windows.size(); w++)
+    {
+        Window& window = m_windows[w];
+        qint64 windowMs = (qint64)window.aggregate.windowInSeconds * 1000;
+        qint64 period = timestampMs / windowMs;
+        if (period <= window.lastPeriod)
+            continue;
+
+        if (window.lastPeriod >= 0)
+        {
+            CompletedPeriod completedPeriod;
+            completedPeriod.periodEndMs = period * windowMs;
+            advance(&window, (completedPeriod.periodEndMs - 1) / window.bucketWidthMs);
+            updateMax(&window);
+            completedPeriod.aggregate = window.aggregate;
+            if (completedPeriod.aggregate.samples > 0)
+                completedPeriods.append(completedPeriod);
+            m_aggregatesOutdated = true;
+        }
+        window.lastPeriod = period;
+    }
+
+    return completedPeriods;
+}
+
+QList<int> ParticleCounterAggregates::parseWindows(QString windows)
+{
+    QList<int> windowsInSeconds;
+    foreach (QString window, windows.split(',', QString::SkipEmptyParts))
+    {
+        bool ok;
+        int windowInSeconds = window.trimmed().toInt(&ok);
+        if (ok && (windowInSeconds > 0))
+            windowsInSeconds.append(windowInSeconds);
+    }
+    return windowsInSeconds;
+}
+
+void ParticleCounterAggregates::advance(Window *window, qint64 index)
+{
+    if (index <= window->newestIndex)
+        return;
+
+    // Reuse the buckets between the newest one and index, at most the whole ring
+    qint64 first = qMax(window->newestIndex + 1, index - window->buckets.size() + 1);
+    for (qint64 i = first; i <= index; i++)
+    {
+        Bucket& bucket = window->buckets[i % window->buckets.size()];
+        if (bucket.samples > 0)
+        {
+            window->aggregate.samples -= bucket.samples;
+            for (int ch=0; ch<8; ch++)
+            {
+                window->aggregate.sum[ch] -= bucket.sum[ch];
+                bucket.sum[ch] = 0;
+                bucket.max[ch] = 0;
+            }
+            bucket.samples = 0;
+            window->maxOutdated = true;
+        }
+        bucket.index = i;
+    }
+    window->newestIndex = index;
+}
+
+void ParticleCounterAggregates::updateMax(Window *window)
+{
+    if (!window->maxOutdated)
+        return;
+
+    for (int ch=0; ch<8; ch++)
+    {
+        quint32 max = 0;
+        foreach (const Bucket& bucket, window->buckets)
+        {
+            max = qMax(max, bucket.max[ch]);
+        }
+        window->aggregate.max[ch] = max;
+    }
+    window->maxOutdated = false;
+}
@@ -0,0 +1,77 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#ifndef PARTICLECOUNTERAGGREGATES_H
+#define PARTICLECOUNTERAGGREGATES_H
+
+#include <QList>
+#include <QVector>
+#include "particlecounter.h"
+
+// Rolling window aggregates (sum, max and mean) of the archive datasets of a particle counter per channel.
+// Each window is split into a ring of buckets. A new dataset is added to the newest bucket and buckets that fall out
+// of the window are subtracted from the running sums, so the cost per dataset does not depend on the window length.
+// The maximum can not be subtracted, it is recalculated from the bucket maxima when a bucket has been dropped.
+class ParticleCounterAggregates
+{
+public:
+    ParticleCounterAggregates(const QList<int>& windowsInSeconds, int bucketsPerWindow);
+
+    void add(const ParticleCounter::ArchiveDataset& archiveDataset);
+
+    // Drop the buckets that are older than the windows ending at timestampMs
+    void expire(qint64 timestampMs);
+
+    // Aggregates of all windows, the list is shared with the caller and only recalculated after changes
+    QList<ParticleCounter::WindowAggregate> getAggregates();
+
+    // Downsampling: Each window also has fixed periods (multiples of its length since epoch). Before a dataset of
+    // timestampMs is added, this returns the windows whose period has ended since the last call, expired to the end of
+    // the period, so their aggregates cover exactly that period.
+    typedef struct {
+        qint64 periodEndMs;
+        ParticleCounter::WindowAggregate aggregate;
+    } CompletedPeriod;
+    QList<CompletedPeriod> takeCompletedPeriods(qint64 timestampMs);
+
+    static QList<int> parseWindows(QString windows);    // Comma separated window lengths in seconds
+
+private:
+    typedef struct {
+        qint64 index;       // Absolute bucket number: timestamp / bucket width
+        quint32 samples;
+        quint64 sum[8];
+        quint32 max[8];
+    } Bucket;
+
+    typedef struct {
+        qint64 bucketWidthMs;
+        qint64 newestIndex;
+        QVector<Bucket> buckets;
+        ParticleCounter::WindowAggregate aggregate;     // Running sums of all buckets in the ring
+        bool maxOutdated;
+        qint64 lastPeriod;
+    } Window;
+
+    QVector<Window> m_windows;
+    QList<ParticleCounter::WindowAggregate> m_aggregates;
+    bool m_aggregatesOutdated;
+
+    static void advance(Window* window, qint64 index);
+    static void updateMax(Window* window);
+};
+
+#endif // PARTICLECOUNTERAGGREGATES_H
@@ -0,0 +1,157 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#include <QStringList>
+#include "particlecounteralarmengine.h"
+
+ParticleCounterAlarmEngine::ParticleCounterAlarmEngine(const Overrides &overrides)
+{
+    m_overrides = overrides;
+
+    m_deviceLimitsNeeded = false;
+    for (int ch=0; ch<8; ch++)
+    {
+        if ((m_overrides.upperWarningLimit[ch] < 0) || (m_overrides.upperAlarmLimit[ch] < 0) ||
+                (m_overrides.warningDelayInSeconds[ch] < 0) || (m_overrides.alarmDelayInSeconds[ch] < 0))
+            m_deviceLimitsNeeded = true;
+    }
+}
+
+void ParticleCounterAlarmEngine::parseOverride(QString values, qint64 overrides[8])
+{
+    QStringList valueList = values.split(',');
+    for (int ch=0; ch<8; ch++)
+    {
+        bool ok;
+        qint64 value = valueList.value(ch).trimmed().toLongLong(&ok);
+        overrides[ch] = (ok && (value >= 0) && (value <= 0xffffffffll)) ? value : -1;
+    }
+}
+
+void ParticleCounterAlarmEngine::parseOverride(QString values, int overrides[8])
+{
+    QStringList valueList = values.split(',');
+    for (int ch=0; ch<8; ch++)
+    {
+        bool ok;
+        int value = valueList.value(ch).trimmed().toInt(&ok);
+        overrides[ch] = (ok && (value >= 0) && (value <= 0xffff)) ? value : -1;
+    }
+}
+
+QString ParticleCounterAlarmEngine::levelName(ParticleCounter::ChannelStatus level)
+{
+    if (level == ParticleCounter::ALARM)
+        return "alarm";
+    if (level == ParticleCounter::WARNING)
+        return "warning";
+    return "ok";
+}
+
+ParticleCounter::Limits ParticleCounterAlarmEngine::effectiveLimits(const ParticleCounter::Limits &deviceLimits) const
+{
+    ParticleCounter::Limits limits = deviceLimits;
+    limits.valid = deviceLimits.valid || !m_deviceLimitsNeeded;
+    for (int ch=0; ch<8; ch++)
+    {
+        ParticleCounter::ChannelLimits& channelLimits = limits.channel[ch];
+        if (m_overrides.upperWarningLimit[ch] >= 0)
+            channelLimits.upperWarningLimit = m_overrides.upperWarningLimit[ch];
+        if (m_overrides.upperAlarmLimit[ch] >= 0)
+            channelLimits.upperAlarmLimit = m_overrides.upperAlarmLimit[ch];
+        if (m_overrides.warningDelayInSeconds[ch] >= 0)
+            channelLimits.warningDelay = m_overrides.warningDelayInSeconds[ch];
+        if (m_overrides.alarmDelayInSeconds[ch] >= 0)
+            channelLimits.alarmDelay = m_overrides.alarmDelayInSeconds[ch];
+    }
+    return limits;
+}
+
+void ParticleCounterAlarmEngine::evaluate(int id, const ParticleCounter::Limits &deviceLimits, const ParticleCounter::ArchiveDataset &archiveDataset, QList<Transition> *transitions)
+{
+    ParticleCounter::Limits limits = effectiveLimits(deviceLimits);
+    if (!limits.valid)
+        return;     // The limits of the particle counter have not been read yet
+
+    if (!m_counters.contains(id))
+    {
+        QVector<ChannelState> channelStates(8);
+        for (int ch=0; ch<8; ch++)
+        {
+            channelStates[ch].level = ParticleCounter::OK;
+            channelStates[ch].warningSinceMs = -1;
+            channelStates[ch].alarmSinceMs = -1;
+        }
+        m_counters.insert(id, channelStates);
+    }
+
+    QVector<ChannelState>& channelStates = m_counters[id];
+    qint64 timestampMs = archiveDataset.timestamp.toMSecsSinceEpoch();
+
+    for (int ch=0; ch<8; ch++)
+    {
+        const ParticleCounter::ChannelLimits& channelLimits = limits.channel[ch];
+        ChannelState& channelState = channelStates[ch];
+        quint32 count = archiveDataset.channelData[ch].count;
+
+        bool warningExceeded = (channelLimits.upperWarningLimit > 0) && (count > channelLimits.upperWarningLimit);
+        bool alarmExceeded = (channelLimits.upperAlarmLimit > 0) && (count > channelLimits.upperAlarmLimit);
+
+        if (!warningExceeded)
+            channelState.warningSinceMs = -1;
+        else if (channelState.warningSinceMs < 0)
+            channelState.warningSinceMs = timestampMs;
+
+        if (!alarmExceeded)
+            channelState.alarmSinceMs = -1;
+        else if (channelState.alarmSinceMs < 0)
+            channelState.alarmSinceMs = timestampMs;
+
+        ParticleCounter::ChannelStatus level = ParticleCounter::OK;
+        if (alarmExceeded && (timestampMs - channelState.alarmSinceMs >= channelLimits.alarmDelay * 1000ll))
+            level = ParticleCounter::ALARM;
+        else if (warningExceeded && (timestampMs - channelState.warningSinceMs >= channelLimits.warningDelay * 1000ll))
+            level = ParticleCounter::WARNING;
+
+        if (level == channelState.level)
+            continue;
+
+        ParticleCounter::ChannelStatus limitLevel = (level == ParticleCounter::OK) ? channelState.level : level;
+        Transition transition;
+        transition.id = id;
+        transition.channel = ch + 1;
+        transition.previousLevel = channelState.level;
+        transition.level = level;
+        transition.count = count;
+        transition.limit = (limitLevel == ParticleCounter::ALARM) ? channelLimits.upperAlarmLimit : channelLimits.upperWarningLimit;
+        transition.timestamp = archiveDataset.timestamp;
+        transitions->append(transition);
+
+        channelState.level = level;
+    }
+}
+
+void ParticleCounterAlarmEngine::remove(int id)
+{
+    m_counters.remove(id);
+}
+
+ParticleCounter::ChannelStatus ParticleCounterAlarmEngine::getLevel(int id, int channel) const
+{
+    if (!m_counters.contains(id) || (channel < 1) || (channel > 8))
+        return ParticleCounter::OK;
+    return m_counters.value(id).at(channel - 1).level;
+}
@@ -0,0 +1,81 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#ifndef PARTICLECOUNTERALARMENGINE_H
+#define PARTICLECOUNTERALARMENGINE_H
+
+#include <QString>
+#include <QList>
+#include <QVector>
+#include <QHash>
+#include <QDateTime>
+#include "particlecounter.h"
+
+// Evaluation of the archive datasets against the upper warning and alarm limits of each channel.
+// The limits are read from the particle counters, each of them may be overridden for all particle counters in config.ini.
+// A channel enters WARNING or ALARM if its count exceeds the limit in all datasets for at least the delay in seconds and returns
+// to OK with the first dataset below the limit. A limit of 0 is disabled. Only used by the main thread.
+class ParticleCounterAlarmEngine
+{
+public:
+    typedef struct {
+        int id;
+        int channel;        // 1..8
+        ParticleCounter::ChannelStatus previousLevel;
+        ParticleCounter::ChannelStatus level;
+        quint32 count;
+        quint32 limit;      // Limit of the new level, limit of the previous level if the channel returns to OK
+        QDateTime timestamp;
+    } Transition;
+
+    // -1 keeps the value of the particle counter
+    typedef struct {
+        qint64 upperWarningLimit[8];
+        qint64 upperAlarmLimit[8];
+        int warningDelayInSeconds[8];
+        int alarmDelayInSeconds[8];
+    } Overrides;
+
+    explicit ParticleCounterAlarmEngine(const Overrides& overrides);
+
+    // Eight values separated by ',', empty values and a missing list keep the values of the particle counter
+    static void parseOverride(QString values, qint64 overrides[8]);
+    static void parseOverride(QString values, int overrides[8]);
+
+    static QString levelName(ParticleCounter::ChannelStatus level);     // ok, warning, alarm
+
+    // Limits of the particle counter with the overrides applied, not valid if the particle counter's limits are needed but unknown
+    ParticleCounter::Limits effectiveLimits(const ParticleCounter::Limits& deviceLimits) const;
+
+    // Evaluate a dataset, changes of the level of a channel are appended to transitions
+    void evaluate(int id, const ParticleCounter::Limits& deviceLimits, const ParticleCounter::ArchiveDataset& archiveDataset, QList<Transition>* transitions);
+    void remove(int id);
+
+    ParticleCounter::ChannelStatus getLevel(int id, int channel) const;     // channel 1..8, OK if not evaluated
+
+private:
+    typedef struct {
+        ParticleCounter::ChannelStatus level;
+        qint64 warningSinceMs;      // Timestamp of the first dataset of the running exceedance, -1 if not exceeded
+        qint64 alarmSinceMs;
+    } ChannelState;
+
+    Overrides m_overrides;
+    bool m_deviceLimitsNeeded;      // At least one value is not overridden
+    QHash<int, QVector<ChannelState> > m_counters;
+};
+
+#endif // PARTICLECOUNTERALARMENGINE_H
@@ -0,0 +1,158 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#include <math.h>
+#include <QStringList>
+#include "particlecounterclassification.h"
+
+ParticleCounterClassification::ParticleCounterClassification(const QList<double> &channelSizesInMicrometers, double flowRateInLitersPerMinute, int averagingDatasets)
+{
+    m_channelSizes = channelSizesInMicrometers;
+    m_flowRateInCubicMetersPerSecond = flowRateInLitersPerMinute / 1000.0 / 60.0;
+    m_averagingDatasets = qMax(1, averagingDatasets);
+}
+
+QList<double> ParticleCounterClassification::parseChannelSizes(QString sizes)
+{
+    QList<double> channelSizes;
+    foreach (QString sizeString, sizes.split(',', QString::SkipEmptyParts))
+    {
+        bool ok;
+        double size = sizeString.trimmed().toDouble(&ok);
+        if (!ok || (size <= 0) || (!channelSizes.isEmpty() && (size <= channelSizes.last())))
+            return QList<double>();
+        channelSizes.append(size);
+    }
+
+    if (channelSizes.size() != 8)
+        return QList<double>();
+
+    return channelSizes;
+}
+
+void ParticleCounterClassification::normalize(const ParticleCounter::ArchiveDataset &archiveDataset, double concentrations[8]) const
+{
+    quint32 counts[8];
+    for (int ch=0; ch<8; ch++)
+    {
+        counts[ch] = archiveDataset.channelData[ch].count;
+    }
+    ParticleCounterNormalization::Counts normalized;
+    ParticleCounterNormalization::normalize(counts, archiveDataset.outputDataFormat == ParticleCounter::CUMULATIVE, &normalized);
+    ParticleCounterNormalization::concentrations(normalized.cumulative, m_flowRateInCubicMetersPerSecond * archiveDataset.samplingTimeInSeconds, concentrations);
+}
+
+double ParticleCounterClassification::isoClass(double concentrationPerCubicMeter, double sizeInMicrometers)
+{
+    // Limit of class N: Cn = 10^N * (0.1 / D)^2.08
+    if (concentrationPerCubicMeter <= 0)
+        return 1.0;
+
+    double n = log10(concentrationPerCubicMeter) + 2.08 * log10(sizeInMicrometers / 0.1);
+    n = ceil(n * 10.0 - 0.01) / 10.0;    // The limits in the table of the standard are rounded
+    return qBound(1.0, n, 9.0);
+}
+
+double ParticleCounterClassification::add(int id, QString zone, const ParticleCounter::ArchiveDataset &archiveDataset)
+{
+    if (!m_counters.contains(id))
+    {
+        Counter counter;
+        counter.concentrations.fill(0, m_averagingDatasets * 8);
+        for (int ch=0; ch<8; ch++)
+        {
+            counter.sum[ch] = 0;
+        }
+        counter.datasets = 0;
+        counter.next = 0;
+        counter.isoClass = -1;
+        m_counters.insert(id, counter);
+    }
+
+    Counter& counter = m_counters[id];
+
+    double concentrations[8];
+    normalize(archiveDataset, concentrations);
+
+    // Replace the oldest dataset of the ring in the running sums
+    double* slot = counter.concentrations.data() + counter.next * 8;
+    for (int ch=0; ch<8; ch++)
+    {
+        counter.sum[ch] += concentrations[ch] - slot[ch];
+        slot[ch] = concentrations[ch];
+    }
+    counter.next = (counter.next + 1) % m_averagingDatasets;
+    if (counter.datasets < m_averagingDatasets)
+        counter.datasets++;
+
+    // The classification covers particle sizes from 0.1 to 5 micrometers
+    double worstClass = 1.0;
+    for (int ch=0; ch<8; ch++)
+    {
+        double size = m_channelSizes.at(ch);
+        if ((size < 0.1) || (size > 5.0))
+            continue;
+        worstClass = qMax(worstClass, isoClass(counter.sum[ch] / counter.datasets, size));
+    }
+    counter.isoClass = worstClass;
+
+    if (counter.zone != zone)
+    {
+        if (!counter.zone.isEmpty())
+        {
+            m_zoneClasses[counter.zone].remove(id);
+            if (m_zoneClasses[counter.zone].isEmpty())
+                m_zoneClasses.remove(counter.zone);
+        }
+        counter.zone = zone;
+    }
+    if (!zone.isEmpty())
+        m_zoneClasses[zone].insert(id, worstClass);
+
+    return worstClass;
+}
+
+void ParticleCounterClassification::remove(int id)
+{
+    QString zone = m_counters.value(id).zone;
+    if (!zone.isEmpty() && m_zoneClasses.contains(zone))
+    {
+        m_zoneClasses[zone].remove(id);
+        if (m_zoneClasses[zone].isEmpty())
+            m_zoneClasses.remove(zone);
+    }
+    m_counters.remove(id);
+}
+
+double ParticleCounterClassification::getClass(int id) const
+{
+    if (!m_counters.contains(id))
+        return -1;
+    return m_counters.value(id).isoClass;
+}
+
+double ParticleCounterClassification::getZoneClass(QString zone) const
+{
+    if (!m_zoneClasses.contains(zone))
+        return -1;
+
+    double worstClass = -1;
+    foreach (double isoClass, m_zoneClasses.value(zone))
+    {
+        worstClass = qMax(worstClass, isoClass);
+    }
+    return worstClass;
+}
@@ -0,0 +1,69 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#ifndef PARTICLECOUNTERCLASSIFICATION_H
+#define PARTICLECOUNTERCLASSIFICATION_H
+
+#include <QString>
+#include <QList>
+#include <QVector>
+#include <QHash>
+#include "particlecounter.h"
+#include "particlecounternormalization.h"
+
+// Cleanliness classification according to ISO 14644-1.
+// The counts of each channel are normalized to particles >= channel size per m³ of air using the sampling time of the dataset and the
+// flow rate of the particle counters. The class of a particle counter is the class met by the mean concentration of its last datasets,
+// the class of a zone is the worst class of its particle counters. Both are updated on each dataset. Only used by the main thread.
+class ParticleCounterClassification
+{
+public:
+    ParticleCounterClassification(const QList<double>& channelSizesInMicrometers, double flowRateInLitersPerMinute, int averagingDatasets);
+
+    // Eight ascending sizes separated by ',', an empty list is returned if the list is invalid
+    static QList<double> parseChannelSizes(QString sizes);
+
+    // Cumulative concentration (particles >= size of the channel per m³) of each channel
+    void normalize(const ParticleCounter::ArchiveDataset& archiveDataset, double concentrations[8]) const;
+
+    // Lowest class (in steps of 0.1, limited to 1..9) whose limit concentration for sizeInMicrometers is not exceeded
+    static double isoClass(double concentrationPerCubicMeter, double sizeInMicrometers);
+
+    // Add a dataset and return the updated class of the particle counter
+    double add(int id, QString zone, const ParticleCounter::ArchiveDataset& archiveDataset);
+    void remove(int id);
+
+    double getClass(int id) const;              // -1 if no dataset has been added yet
+    double getZoneClass(QString zone) const;    // -1 if the zone has no classified particle counter
+
+private:
+    typedef struct {
+        QString zone;
+        QVector<double> concentrations;     // Ring of the last datasets, 8 per dataset
+        double sum[8];
+        int datasets;
+        int next;
+        double isoClass;
+    } Counter;
+
+    QList<double> m_channelSizes;
+    double m_flowRateInCubicMetersPerSecond;
+    int m_averagingDatasets;
+    QHash<int, Counter> m_counters;
+    QHash<QString, QHash<int, double> > m_zoneClasses;     // zone -> id -> class
+};
+
+#endif // PARTICLECOUNTERCLASSIFICATION_H
@@ -26,14 +26,92 @@ ParticleCounterDatabase::ParticleCounterDatabase(QObject *parent, ParticleCounte
 
     m_loghandler = loghandler;
 
+    qRegisterMetaType<ParticleCounter::ActualDataSnapshotPtr>("ParticleCounter::ActualDataSnapshotPtr");
+    qRegisterMetaType<ParticleCounter::ArchiveDatasetSnapshotPtr>("ParticleCounter::ArchiveDatasetSnapshotPtr");
+    qRegisterMetaType<ParticleCounterDatabase::LiveUpdatePtr>("ParticleCounterDatabase::LiveUpdatePtr");
+    qRegisterMetaType<ParticleCounterDatabase::AlarmUpdatePtr>("ParticleCounterDatabase::AlarmUpdatePtr");
+
     m_settings = new QSettings("/etc/openffucontrol/particleserver/config.ini", QSettings::IniFormat);
+    m_settings->beginGroup("interfacesParticleCounterModBus");
+    m_defaultLiveCountsIntervalInSeconds = m_settings->value("liveCountsIntervalInSeconds", 0).toInt();
+    m_timer_saveChanges.setInterval(m_settings->value("saveDelayInMs", 2000).toInt());
+    m_historySize = m_settings->value("historySize", 1440).toUInt();
+    m_settings->endGroup();
+    m_settings->beginGroup("aggregates");
+    m_aggregateWindows = ParticleCounterAggregates::parseWindows(m_settings->value("windowsInSeconds", "300,3600,86400").toString());
+    m_aggregateBucketsPerWindow = m_settings->value("bucketsPerWindow", 60).toInt();
+    m_writeAggregatePoints = m_settings->value("writePoints", false).toBool();
+    m_settings->endGroup();
+    m_settings->beginGroup("downsampling");
+    m_downsampler = nullptr;
+    m_writeRawData = true;
+    if (m_settings->value("enabled", false).toBool())
+    {
+        QList<ParticleCounterDownsampler::Rollup> rollups = ParticleCounterDownsampler::parseRollups(
+                    m_settings->value("rollups", "60:particles_1m,900:particles_15m,3600:particles_1h").toString());
+        m_downsampler = new ParticleCounterDownsampler(rollups, readCountFormat("asDelivered", true));
+        m_writeRawData = m_settings->value("writeRawData", true).toBool();
+    }
+    m_settings->endGroup();
+    m_settings->beginGroup("classification");
+    m_classification = nullptr;
+    m_flowRateInLitersPerMinute = m_settings->value("flowRateInLitersPerMinute", 28.3).toDouble();
+    if (m_settings->value("enabled", false).toBool())
+    {
+        QList<double> channelSizes = ParticleCounterClassification::parseChannelSizes(
+                    m_settings->value("channelSizesInMicrometers", "0.3,0.5,0.7,1.0,2.0,3.0,5.0,10.0").toString());
+        if (channelSizes.isEmpty())
+            m_loghandler->slot_newEntry(LogEntry::Error, "ParticleCounterDatabase", "Invalid channelSizesInMicrometers, classification is switched off.");
+        else
+            m_classification = new ParticleCounterClassification(channelSizes, m_flowRateInLitersPerMinute,
+                                                                 m_settings->value("averagingDatasets", 10).toInt());
+    }
+    m_settings->endGroup();
+    m_settings->beginGroup("alarms");
+    m_alarmEngine = nullptr;
+    if (m_settings->value("enabled", false).toBool())
+    {
+        ParticleCounterAlarmEngine::Overrides overrides;
+        ParticleCounterAlarmEngine::parseOverride(m_settings->value("upperWarningLimits").toString(), overrides.upperWarningLimit);
+        ParticleCounterAlarmEngine::parseOverride(m_settings->value("upperAlarmLimits").toString(), overrides.upperAlarmLimit);
+        ParticleCounterAlarmEngine::parseOverride(m_settings->value("warningDelaysInSeconds").toString(), overrides.warningDelayInSeconds);
+        ParticleCounterAlarmEngine::parseOverride(m_settings->value("alarmDelaysInSeconds").toString(), overrides.alarmDelayInSeconds);
+        m_alarmEngine = new ParticleCounterAlarmEngine(overrides);
+    }
+    m_settings->endGroup();
+    m_settings->beginGroup("zones");
+    m_zoneAggregates = nullptr;
+    if (m_settings->value("writeAggregates", true).toBool())
+        m_zoneAggregates = new ParticleCounterZoneAggregates(m_settings->value("intervalInSeconds", 60).toInt(),
+                                                             m_settings->value("gracePeriodInSeconds", 120).toInt(),
+                                                             readCountFormat("asDelivered", true));
+    m_settings->endGroup();
     m_settings->beginGroup("influxDB");
+    m_sinkStatus.changeOnlyWrites = m_settings->value("changeOnlyWrites", false).toBool();
+    m_sinkStatus.heartbeatIntervalInSeconds = m_settings->value("heartbeatIntervalInSeconds", 900).toInt();
+    m_sinkStatus.pointsWritten = 0;
+    m_sinkStatus.pointsSuppressed = 0;
+    m_sinkStatus.zoneDatasetsDropped = 0;
+    m_rawCountFormat = readCountFormat("asDelivered", false);
+    m_sinkStatus.batchWindowInSeconds = m_settings->value("batchWindowInSeconds", 0).toInt();
+    m_sinkStatus.batchesWritten = 0;
+    m_pointBatchLines = 0;
+
+    m_initScheduler = new ParticleCounterInitScheduler(this, m_pcModbusSystem, m_loghandler);
+    m_samplingAligner = new ParticleCounterSamplingAligner(this, m_pcModbusSystem, m_loghandler);
+    m_registry = new ParticleCounterRegistry(this, "/var/openffucontrol/particlecounters/");
+    m_historyDirectory = "/var/openffucontrol/particlecounters/history/";
+    QDir().mkpath(m_historyDirectory);
 
     // High level bus-system response connections
-    connect(m_pcModbusSystem, &ParticleCounterModbusSystem::signal_receivedHoldingRegisterData, this, &ParticleCounterDatabase::slot_receivedHoldingRegisterData);
-    connect(m_pcModbusSystem, &ParticleCounterModbusSystem::signal_receivedInputRegisterData, this, &ParticleCounterDatabase::slot_receivedInputRegisterData);
+    // Register responses are dispatched directly, so the shared response is never copied into a queued event.
+    connect(m_pcModbusSystem, &ParticleCounterModbusSystem::signal_receivedRegisterData, this, &ParticleCounterDatabase::slot_receivedRegisterData, Qt::DirectConnection);
     connect(m_pcModbusSystem, &ParticleCounterModbusSystem::signal_transactionLost, this, &ParticleCounterDatabase::slot_transactionLost);
 
+    // Changes of particle counters are written in one batch when this timer fires
+    connect(&m_timer_saveChanges, &QTimer::timeout, this, &ParticleCounterDatabase::flushChanges);
+    m_timer_saveChanges.setSingleShot(true);
+
     // Timer for cyclic poll task to get the status of Particle Counters
     connect(&m_timer_pollStatus, &QTimer::timeout, this, &ParticleCounterDatabase::slot_timer_pollStatus_fired);
     m_timer_pollStatus.setInterval(2000);
@@ -43,47 +121,138 @@ ParticleCounterDatabase::ParticleCounterDatabase(QObject *parent, ParticleCounte
     connect(&m_timer_checkRealTimeClocks, &QTimer::timeout, this, &ParticleCounterDatabase::slot_timer_checkRealTimeClocks_fired);
     m_timer_checkRealTimeClocks.setInterval(3600000 * 12);  // Every 12 hours RTC of particle counters are set to Server UTC Clock.
     m_timer_checkRealTimeClocks.start();
-}
 
-void ParticleCounterDatabase::loadFromHdd()
-{
-    QString directory = "/var/openffucontrol/particlecounters/";
-    QDirIterator iterator(directory, QStringList() << "*.csv", QDir::Files, QDirIterator::NoIteratorFlags);
+    // Timer for cyclic publishing of the database snapshot for readers in other threads
+    connect(&m_timer_publishSnapshot, &QTimer::timeout, this, &ParticleCounterDatabase::slot_publishSnapshot);
+    m_timer_publishSnapshot.setInterval(1000);
+    m_timer_publishSnapshot.start();
+    slot_publishSnapshot();
 
-    QStringList filepaths;
+    // Timer for completing the rollup periods of particle counters that stopped delivering datasets
+    if (m_downsampler != nullptr)
+    {
+        connect(&m_timer_flushRollups, &QTimer::timeout, this, &ParticleCounterDatabase::slot_timer_flushRollups_fired);
+        m_timer_flushRollups.setInterval(60000);
+        m_timer_flushRollups.start();
+    }
 
-    while(iterator.hasNext())
+    // Timer for writing the zone aggregates after their grace period
+    if (m_zoneAggregates != nullptr)
     {
-        filepaths.append(iterator.next());
+        connect(&m_timer_flushZoneAggregates, &QTimer::timeout, this, &ParticleCounterDatabase::slot_timer_flushZoneAggregates_fired);
+        m_timer_flushZoneAggregates.setInterval(10000);
+        m_timer_flushZoneAggregates.start();
     }
 
-    filepaths.sort();
+    // Timer for writing the collected points in one request, started by the first point of a batch
+    connect(&m_timer_flushPoints, &QTimer::timeout, this, &ParticleCounterDatabase::flushPoints);
+    m_timer_flushPoints.setSingleShot(true);
+    m_timer_flushPoints.setInterval(m_sinkStatus.batchWindowInSeconds * 1000);
+}
 
-    foreach(QString filepath, filepaths)
+void ParticleCounterDatabase::loadFromHdd()
+{
+    QList<QString> configs;
+    QString error;
+    if (!m_registry->open(&configs, &error, true))
+    {
+        m_loghandler->slot_newEntry(LogEntry::Error, "ParticleCounterDatabase", error);
+        return;
+    }
+
+    foreach(QString config, configs)
     {
         ParticleCounter* newPc = new ParticleCounter(this, m_pcModbusSystem, m_loghandler);
-        newPc->load(filepath);
-        newPc->setFiledirectory(directory);
-        //connect(newPc, &ParticleCounter::signal_ParticleCounterActualDataReceived, this, &ParticleCounterDatabase::signal_ParticleCounterActualDataHasChanged);
-        connect(newPc, &ParticleCounter::signal_ParticleCounterActualDataReceived, this, &ParticleCounterDatabase::slot_ParticleCounterActualDataReceived);
-        connect(newPc, &ParticleCounter::signal_ParticleCounterArchiveDataReceived, this, &ParticleCounterDatabase::slot_ParticleCounterArchiveDataReceived);
+        newPc->setLiveCountsInterval(m_defaultLiveCountsIntervalInSeconds);   // Counters may override this in their config
+        newPc->fromConfigLine(config);
+        newPc->setRegistry(m_registry);
+        connectParticleCounter(newPc);
+        openHistory(newPc->getId());
+        m_aggregates.insert(newPc->getId(), new ParticleCounterAggregates(m_aggregateWindows, m_aggregateBucketsPerWindow));
         m_particlecounters.append(newPc);
 
-        newPc->init();
+        m_initScheduler->enqueue(newPc);    // Inits are spread over time, see ParticleCounterInitScheduler
     }
+
+    slot_publishSnapshot();
 }
 
-void ParticleCounterDatabase::saveToHdd()
+ParticleCounterDatabase::SnapshotPtr ParticleCounterDatabase::getSnapshot()
 {
-    QString path = "/var/openffucontrol/particlecounters/";
+    QMutexLocker locker(&m_snapshotMutex);
+    return m_snapshot;
+}
+
+ParticleCounterHistoryPtr ParticleCounterDatabase::getHistory(int id)
+{
+    QMutexLocker locker(&m_historyMutex);
+    return m_histories.value(id);
+}
+
+void ParticleCounterDatabase::openHistory(int id)
+{
+    if (m_historySize == 0)
+        return;     // History is switched off
+
+    QString error;
+    ParticleCounterHistoryPtr history = ParticleCounterHistory::open(m_historyDirectory + QString().sprintf("particlecounter-%06i.history", id),
+                                                                     m_historySize, &error);
+    if (history.isNull())
+    {
+        m_loghandler->slot_newEntry(LogEntry::Error, "ParticleCounterDatabase", error);
+        return;
+    }
+
+    QMutexLocker locker(&m_historyMutex);
+    m_histories.insert(id, history);
+}
 
+void ParticleCounterDatabase::removeHistory(int id)
+{
+    {
+        QMutexLocker locker(&m_historyMutex);
+        m_histories.remove(id);     // Readers in other threads may still hold the mapping until they are done
+    }
+    QFile::remove(m_historyDirectory + QString().sprintf("particlecounter-%06i.history", id));
+}
+
+void ParticleCounterDatabase::saveToHdd()
+{
     foreach (ParticleCounter* pc, m_particlecounters)
     {
-        pc->setFiledirectory(path);
         pc->save();
     }
 }
 
+void ParticleCounterDatabase::flushChanges()
+{
+    m_timer_saveChanges.stop();
+    if (m_particleCountersToSave.isEmpty())
+        return;
+
+    QList<QPair<int, QString> > records;
+    records.reserve(m_particleCountersToSave.size());
+    foreach (ParticleCounter* pc, m_particleCountersToSave)
+    {
+        if (pc->hasUnsavedChanges())
+            records.append(QPair<int, QString>(pc->getId(), pc->toConfigLine()));
+    }
+
+    if (!m_registry->putBatch(records))
+    {
+        m_loghandler->slot_newEntry(LogEntry::Error, "ParticleCounterDatabase", "Unable to write " + m_registry->getFilename() + ", retrying.");
+        m_timer_saveChanges.start();
+        return;
+    }
+    m_loghandler->slot_entryGone(LogEntry::Error, "ParticleCounterDatabase", "Unable to write " + m_registry->getFilename() + ", retrying.");
+
+    foreach (ParticleCounter* pc, m_particleCountersToSave)
+    {
+        pc->markAsSaved();
+    }
+    m_particleCountersToSave.clear();
+}
+
 QList<ModBus *> *ParticleCounterDatabase::getBusList()
 {
     return m_pcModbusList;
@@ -91,24 +260,69 @@ QList<ModBus *> *ParticleCounterDatabase::getBusList()
 
 QString ParticleCounterDatabase::addParticleCounter(int id, int busID, int modbusAddress)
 {
+    // A second particle counter with the same id would overwrite the registry record, aggregates and history of the first one
+    ParticleCounterImport::Entry entry;
+    entry.lineNumber = 0;
+    entry.id = id;
+    entry.busID = busID;
+    entry.modbusAddress = modbusAddress;
+    QStringList errors;
+    if (!ParticleCounterImport::validateAgainst(QList<ParticleCounterImport::Entry>() << entry, m_particlecounters, &errors))
+        return errors.join("\n") + "\nError[ParticleCounterDatabase]: ID " + QString().setNum(id) + " not added.";
+
     ParticleCounter* newPc = new ParticleCounter(this, m_pcModbusSystem, m_loghandler);
-    newPc->setFiledirectory("/var/openffucontrol/particlecounters/");
+    newPc->setRegistry(m_registry);
     newPc->setAutoSave(false);
     newPc->setId(id);
     newPc->setBusID(busID);
     newPc->setModbusAddress(modbusAddress);
-    newPc->setAutoSave(true);
+    newPc->setLiveCountsInterval(m_defaultLiveCountsIntervalInSeconds);
     newPc->save();
-//    connect(newPc, &ParticleCounter::signal_ParticleCounterActualDataHasChanged, this, &ParticleCounterDatabase::signal_ParticleCounterActualDataHasChanged);
-    connect(newPc, &ParticleCounter::signal_ParticleCounterActualDataReceived, this, &ParticleCounterDatabase::slot_ParticleCounterActualDataReceived);
-    connect(newPc, &ParticleCounter::signal_ParticleCounterArchiveDataReceived, this, &ParticleCounterDatabase::slot_ParticleCounterArchiveDataReceived);
+    connectParticleCounter(newPc);
+    openHistory(id);
+    m_aggregates.insert(id, new ParticleCounterAggregates(m_aggregateWindows, m_aggregateBucketsPerWindow));
     m_particlecounters.append(newPc);
 
-    newPc->init();
+    m_initScheduler->enqueue(newPc, true);  // Initialized before counters that wait since startup
 
     return "OK[ParticleCounterDatabase]: Added ID " + QString().setNum(id);
 }
 
+QString ParticleCounterDatabase::importParticleCounters(QString csv, bool dryRun)
+{
+    QList<ParticleCounterImport::Entry> entries;
+    QStringList errors;
+
+    if (!ParticleCounterImport::parse(csv, m_pcModbusList->size(), &entries, &errors) ||
+        !ParticleCounterImport::validateAgainst(entries, m_particlecounters, &errors))
+    {
+        return errors.join("\n") + "\nError[ParticleCounterDatabase]: Import aborted, nothing imported.";
+    }
+
+    if (dryRun)
+        return "OK[ParticleCounterDatabase]: " + QString().setNum(entries.size()) + " particle counters are valid, nothing imported (dry run).";
+
+    QList<ParticleCounter*> created;
+    QString error;
+    if (!ParticleCounterImport::createParticleCounters(entries, this, m_pcModbusSystem, m_loghandler, m_registry,
+                                                       m_defaultLiveCountsIntervalInSeconds, &created, &error))
+    {
+        return error;
+    }
+
+    foreach (ParticleCounter* pc, created)
+    {
+        connectParticleCounter(pc);
+        openHistory(pc->getId());
+        m_aggregates.insert(pc->getId(), new ParticleCounterAggregates(m_aggregateWindows, m_aggregateBucketsPerWindow));
+        m_particlecounters.append(pc);
+        m_initScheduler->enqueue(pc);
+    }
+
+    return "OK[ParticleCounterDatabase]: Imported " + QString().setNum(created.size()) + " particle counters, "
+            + QString().setNum(m_initScheduler->getSizeOfQueue()) + " waiting for initialization.";
+}
+
 QString ParticleCounterDatabase::deleteParticleCounter(int id)
 {
     ParticleCounter* pc = getParticleCounterByID(id);
@@ -118,9 +332,19 @@ QString ParticleCounterDatabase::deleteParticleCounter(int id)
     bool ok = m_particlecounters.removeOne(pc);
     if (ok)
     {
-        //disconnect(pc, &ParticleCounter::signal_ParticleCounterActualDataHasChanged, this, &ParticleCounterDatabase::signal_ParticleCounterActualDataHasChanged);
-        disconnect(pc, &ParticleCounter::signal_ParticleCounterActualDataReceived, this, &ParticleCounterDatabase::slot_ParticleCounterActualDataReceived);
-        disconnect(pc, &ParticleCounter::signal_ParticleCounterArchiveDataReceived, this, &ParticleCounterDatabase::slot_ParticleCounterArchiveDataReceived);
+        disconnectParticleCounter(pc);
+        m_particleCountersToSave.remove(pc);
+        m_initScheduler->remove(pc);
+        m_samplingAligner->remove(pc);
+        removeHistory(id);
+        delete m_aggregates.take(id);
+        if (m_downsampler != nullptr)
+            m_downsampler->remove(id);
+        m_lastWrittenChannels.remove(id);
+        if (m_classification != nullptr)
+            m_classification->remove(id);
+        if (m_alarmEngine != nullptr)
+            m_alarmEngine->remove(id);
         pc->deleteFromHdd();
         pc->deleteAllErrors();
         delete pc;
@@ -205,19 +429,69 @@ QString ParticleCounterDatabase::setParticleCounterData(int id, QMap<QString, QS
     if (pc == nullptr)
         return "Warning[ParticleCounterDatabase]: ID " + QString().setNum(id) + " not found.";
 
+    // The limits of all channels are written as one block, so the limitN entries are collected first
+    ParticleCounter::Limits limits = pc->getLimitsToChange();
+    QString error;
+    int limitChannels = ParticleCounter::applyLimitSettings(dataMap, &limits, &error);
+    if (limitChannels < 0)
+        return "Error[ParticleCounterDatabase]: " + error;
+    if ((limitChannels > 0) && !limits.valid)
+        return "Warning[ParticleCounterDatabase]: Limits of ID " + QString().setNum(id) + " have not been read yet, nothing set.";
+
     QString dataString;
 
     foreach(QString key, dataMap.keys())
     {
         QString value = dataMap.value(key);
-        pc->setData(key, value);
+        if (!key.startsWith("limit"))
+            pc->setData(key, value);
 
         dataString.append(" " + key + ":" + value);
     }
 
+    if (limitChannels > 0)
+        pc->setLimits(limits);
+
     return "OK[ParticleCounterDatabase]: Setting data:" + dataString;
 }
 
+QString ParticleCounterDatabase::setLimits(int busID, QMap<QString, QString> profile)
+{
+    // Validate the profile once, so it is applied to all particle counters or to none
+    ParticleCounter::Limits limits = ParticleCounter::Limits();
+    QString error;
+    int limitChannels = ParticleCounter::applyLimitSettings(profile, &limits, &error);
+    if (limitChannels < 0)
+        return "Error[ParticleCounterDatabase]: " + error;
+    if (limitChannels == 0)
+        return "Error[ParticleCounterDatabase]: No limits given, use --limitN=WARNING,ALARM,WARNINGDELAY,ALARMDELAY.";
+
+    // Each particle counter gets its own block write and read back. They are queued back to back,
+    // so the bus works through them without waiting for the terminal.
+    int written = 0;
+    QStringList skipped;
+    foreach (ParticleCounter* pc, getParticleCounters(busID))
+    {
+        limits = pc->getLimitsToChange();
+        if (!limits.valid)
+        {
+            skipped.append(QString().setNum(pc->getId()));
+            continue;
+        }
+        ParticleCounter::applyLimitSettings(profile, &limits, &error);
+        pc->setLimits(limits);
+        written++;
+    }
+
+    if ((written == 0) && skipped.isEmpty())
+        return "Warning[ParticleCounterDatabase]: No particle counters at bus " + QString().setNum(busID) + ".";
+
+    QString response = "OK[ParticleCounterDatabase]: Writing limits to " + QString().setNum(written) + " particle counters at bus " + QString().setNum(busID) + ".";
+    if (!skipped.isEmpty())
+        response += " Skipped (limits not read yet): " + skipped.join(",");
+    return response;
+}
+
 ParticleCounter *ParticleCounterDatabase::getParticleCounterByTelegramID(quint64 telegramID)
 {
     foreach (ParticleCounter* pc, m_particlecounters) {
@@ -231,55 +505,164 @@ ParticleCounter *ParticleCounterDatabase::getParticleCounterByTelegramID(quint64
     return nullptr;    // TransactionID not initiated by pc requests, so it came frome somebody else
 }
 
-void ParticleCounterDatabase::slot_transactionFinished()
+void ParticleCounterDatabase::connectParticleCounter(ParticleCounter *pc)
 {
-    // Do nothing
+    connect(pc, &ParticleCounter::signal_ParticleCounterActualDataReceived, this, &ParticleCounterDatabase::slot_ParticleCounterActualDataReceived);
+    connect(pc, &ParticleCounter::signal_ParticleCounterArchiveDataReceived, this, &ParticleCounterDatabase::slot_ParticleCounterArchiveDataReceived);
+    connect(pc, &ParticleCounter::signal_needsSaving, this, &ParticleCounterDatabase::slot_particleCounterNeedsSaving);
+    m_samplingAligner->add(pc);
 }
 
-void ParticleCounterDatabase::slot_transactionLost(quint64 telegramID)
+void ParticleCounterDatabase::disconnectParticleCounter(ParticleCounter *pc)
 {
-    ParticleCounter* pc = getParticleCounterByTelegramID(telegramID);
-    if (pc == nullptr)
+    disconnect(pc, &ParticleCounter::signal_ParticleCounterActualDataReceived, this, &ParticleCounterDatabase::slot_ParticleCounterActualDataReceived);
+    disconnect(pc, &ParticleCounter::signal_ParticleCounterArchiveDataReceived, this, &ParticleCounterDatabase::slot_ParticleCounterArchiveDataReceived);
+    disconnect(pc, &ParticleCounter::signal_needsSaving, this, &ParticleCounterDatabase::slot_particleCounterNeedsSaving);
+}
+
+ParticleCounterDatabase::LiveUpdatePtr ParticleCounterDatabase::makeLiveUpdate(ParticleCounter::ActualDataSnapshotPtr snapshot)
+{
+    // Example:
+    // 'ActualData from id=2 busID=0 online=1 lostTelegrams=0 lastSeen=... statusString=healthy timestamp=... countChannel_1=15 ... countChannel_8=0'
+    const ParticleCounter::ActualData &actualData = snapshot->actualData;
+
+    LiveUpdate* liveUpdate = new LiveUpdate;
+    liveUpdate->id = snapshot->id;
+    liveUpdate->busID = snapshot->busID;
+
+    QByteArray &line = liveUpdate->line;
+    line.reserve(256);
+    line.append("ActualData from id=" + QByteArray::number(snapshot->id));
+    line.append(" busID=" + QByteArray::number(snapshot->busID));
+    line.append(" online=" + QByteArray::number(actualData.online));
+    line.append(" lostTelegrams=" + QByteArray::number(actualData.lostTelegrams));
+    line.append(" lastSeen=" + actualData.lastSeen.toString("yyyy.MM.dd-hh:mm:ss.zzz").toUtf8());
+    line.append(" statusString=" + actualData.statusString.toUtf8());
+    line.append(" timestamp=" + actualData.timestamp.toString("yyyy.MM.dd-hh:mm:ss").toUtf8());
+    for (int ch=0; ch<8; ch++)
     {
-        // Somebody other than the pc requested that response, so do nothing with the response at this point
-        m_loghandler->slot_newEntry(LogEntry::Error, "ParticleCounterDatabase slot_transactionLost", "Telegram id mismatch.");
-        return;
+        liveUpdate->channelSegmentOffsets[ch] = line.size();
+        line.append(" countChannel_" + QByteArray::number(actualData.channelData[ch].channel) + "=" + QByteArray::number(actualData.channelData[ch].count));
     }
-    pc->slot_transactionLost(telegramID);
+    liveUpdate->channelSegmentOffsets[8] = line.size();
+    line.append("\r\n");
+
+    // {"type":"actualData","id":2,"busID":0,"online":true,...,"countChannel_1":15,...,"countChannel_8":0}
+    liveUpdate->jsonLine.reserve(320);
+    JsonLineWriter json(&liveUpdate->jsonLine);
+    json.beginObject();
+    json.addString("type", "actualData");
+    json.addInt("id", snapshot->id);
+    json.addInt("busID", snapshot->busID);
+    json.addBool("online", actualData.online);
+    json.addInt("lostTelegrams", actualData.lostTelegrams);
+    json.addString("lastSeen", actualData.lastSeen.toString(Qt::ISODateWithMs));
+    json.addString("statusString", actualData.statusString);
+    json.addString("timestamp", actualData.timestamp.toString(Qt::ISODate));
+    for (int ch=0; ch<8; ch++)
+    {
+        liveUpdate->jsonChannelSegmentOffsets[ch] = json.size();
+        json.addInt(QByteArray("countChannel_" + QByteArray::number(actualData.channelData[ch].channel)).constData(), actualData.channelData[ch].count);
+    }
+    liveUpdate->jsonChannelSegmentOffsets[8] = json.size();
+    json.endObject();
+    json.endLine();
+
+    return LiveUpdatePtr(liveUpdate);
 }
 
-void ParticleCounterDatabase::slot_receivedHoldingRegisterData(quint64 telegramID, quint16 adr, quint16 reg, QList<quint16> data)
+ParticleCounterDatabase::LiveUpdatePtr ParticleCounterDatabase::makeLiveUpdate(ParticleCounter::ArchiveDatasetSnapshotPtr snapshot)
 {
+    // Example:
+    // 'ArchiveData from id=2 busID=0 timestamp=... samplingTimeInSeconds=59 outputDataFormat=1 countChannel_1=15 ... countChannel_8=0'
+    const ParticleCounter::ArchiveDataset &archiveData = snapshot->archiveData;
+
+    LiveUpdate* liveUpdate = new LiveUpdate;
+    liveUpdate->id = snapshot->id;
+    liveUpdate->busID = snapshot->busID;
+
+    QByteArray &line = liveUpdate->line;
+    line.reserve(256);
+    line.append("ArchiveData from id=" + QByteArray::number(snapshot->id));
+    line.append(" busID=" + QByteArray::number(snapshot->busID));
+    line.append(" timestamp=" + archiveData.timestamp.toString("yyyy.MM.dd-hh:mm:ss").toUtf8());
+    line.append(" samplingTimeInSeconds=" + QByteArray::number(archiveData.samplingTimeInSeconds));
+    line.append(" outputDataFormat=" + QByteArray::number(archiveData.outputDataFormat));
+    for (int ch=0; ch<8; ch++)
+    {
+        liveUpdate->channelSegmentOffsets[ch] = line.size();
+        line.append(" countChannel_" + QByteArray::number(archiveData.channelData[ch].channel) + "=" + QByteArray::number(archiveData.channelData[ch].count));
+    }
+    liveUpdate->channelSegmentOffsets[8] = line.size();
+    line.append("\r\n");
+
+    // {"type":"archiveData","id":2,"busID":0,"timestamp":"...",...,"countChannel_1":15,...,"countChannel_8":0}
+    liveUpdate->jsonLine.reserve(320);
+    JsonLineWriter json(&liveUpdate->jsonLine);
+    json.beginObject();
+    json.addString("type", "archiveData");
+    json.addInt("id", snapshot->id);
+    json.addInt("busID", snapshot->busID);
+    json.addString("timestamp", archiveData.timestamp.toString(Qt::ISODate));
+    json.addInt("samplingTimeInSeconds", archiveData.samplingTimeInSeconds);
+    json.addInt("outputDataFormat", archiveData.outputDataFormat);
+    for (int ch=0; ch<8; ch++)
+    {
+        liveUpdate->jsonChannelSegmentOffsets[ch] = json.size();
+        json.addInt(QByteArray("countChannel_" + QByteArray::number(archiveData.channelData[ch].channel)).constData(), archiveData.channelData[ch].count);
+    }
+    liveUpdate->jsonChannelSegmentOffsets[8] = json.size();
+    json.endObject();
+    json.endLine();
+
+    return LiveUpdatePtr(liveUpdate);
+}
+
+void ParticleCounterDatabase::slot_transactionFinished()
+{
+    // Do nothing
+}
+
+void ParticleCounterDatabase::slot_transactionLost(quint64 telegramID)
+{
+    if (m_samplingAligner->isBroadcastTelegram(telegramID))
+        return;     // Broadcasts are not answered
+
     ParticleCounter* pc = getParticleCounterByTelegramID(telegramID);
     if (pc == nullptr)
     {
         // Somebody other than the pc requested that response, so do nothing with the response at this point
-        m_loghandler->slot_newEntry(LogEntry::Error, "ParticleCounterDatabase slot_receivedHoldingRegisterData", "Telegram id mismatch.");
+        m_loghandler->slot_newEntry(LogEntry::Error, "ParticleCounterDatabase slot_transactionLost", "Telegram id mismatch.");
         return;
     }
-    pc->slot_receivedHoldingRegisterData(telegramID, adr, reg, data);
+    pc->slot_transactionLost(telegramID);
 }
 
-void ParticleCounterDatabase::slot_receivedInputRegisterData(quint64 telegramID, quint16 adr, quint16 reg, QList<quint16> data)
+void ParticleCounterDatabase::slot_receivedRegisterData(ModbusRegisterResponsePtr response)
 {
-    ParticleCounter* pc = getParticleCounterByTelegramID(telegramID);
+    ParticleCounter* pc = getParticleCounterByTelegramID(response->telegramID);
     if (pc == nullptr)
     {
         // Somebody other than the pc requested that response, so do nothing with the response at this point
-        m_loghandler->slot_newEntry(LogEntry::Error, "ParticleCounterDatabase slot_receivedInputRegisterData", "Telegram id mismatch.");
+        m_loghandler->slot_newEntry(LogEntry::Error, "ParticleCounterDatabase slot_receivedRegisterData", "Telegram id mismatch.");
         return;
     }
-    pc->slot_receivedInputRegisterData(telegramID, adr, reg, data);
+    pc->slot_receivedRegisterData(response);
 }
 
-void ParticleCounterDatabase::slot_ParticleCounterActualDataReceived(int id, ParticleCounter::ActualData actualData, ParticleCounter::DeviceInfo deviceInfo)
+void ParticleCounterDatabase::slot_ParticleCounterActualDataReceived(ParticleCounter::ActualDataSnapshotPtr snapshot)
 {
     // Example of payload:
     // 'particles,tag_id=2,tag_channel=1,tag_room=iso5-Raum id=2i,channel=1i,counts=15i 1678388136783721259'
 
     QString measurementName = m_settings->value("measurementName", QString()).toString();
 
-    deviceInfo.deviceIdString.remove(QRegExp("\\D"));    // Remove all non-digits
+    const int id = snapshot->id;
+    const ParticleCounter::ActualData &actualData = snapshot->actualData;
+    QString serialnumber = snapshot->deviceInfo.deviceIdString;
+    serialnumber.remove(QRegExp("\\D"));    // Remove all non-digits
+
+    emit signal_liveUpdate(makeLiveUpdate(snapshot));
 
     // Separate data points in influx for each channel of the particle counter
     for (int ch=0; ch<8; ch++)
@@ -289,53 +672,467 @@ void ParticleCounterDatabase::slot_ParticleCounterActualDataReceived(int id, Par
         QByteArray payload;
         payload.append(measurementName.toUtf8() + ",");
         payload.append("tag_id=" + QByteArray().setNum(id) + ",");
-        payload.append("tag_serialnumber='" + deviceInfo.deviceIdString.toUtf8() + "',");
+        payload.append("tag_serialnumber='" + serialnumber.toUtf8() + "',");
         payload.append("tag_channel=" + QByteArray().setNum(actualData.channelData[ch].channel));
-        // tbd!!
-        //    payload.append(",tag_room=" + responseData.value("room").toUtf8());
+        payload.append(snapshot->zoneTag);
         payload.append(" ");
         payload.append("id=" + QByteArray().setNum(id) + "i,");
-        payload.append("serialnumber='" + deviceInfo.deviceIdString.toUtf8() + "',");
+        payload.append("serialnumber='" + serialnumber.toUtf8() + "',");
         payload.append("channel=" + QByteArray().setNum(actualData.channelData[ch].channel) + "i,");
         payload.append("counts=" + QByteArray().setNum(actualData.channelData[ch].count) + "i ");
         qulonglong timestamp = actualData.timestamp.toMSecsSinceEpoch() * 1000000ull;    // Write timestamp to influx in nanoseconds since epoch
         payload.append(QString().setNum(timestamp));
-        m_influxDB->write(payload);
+        writePoint(payload);
     }
 }
 
-void ParticleCounterDatabase::slot_ParticleCounterArchiveDataReceived(int id, ParticleCounter::ArchiveDataset archiveData, ParticleCounter::DeviceInfo deviceInfo)
+void ParticleCounterDatabase::slot_ParticleCounterArchiveDataReceived(ParticleCounter::ArchiveDatasetSnapshotPtr snapshot)
 {
     // Example of payload:
     // 'particles,tag_id=2,tag_channel=1,tag_room=iso5-Raum id=2i,channel=1i,counts=15i 1678388136783721259'
 
     QString measurementName = m_settings->value("measurementName", QString()).toString();
 
-    deviceInfo.deviceIdString.remove(QRegExp("\\D"));    // Remove all non-digits
+    const int id = snapshot->id;
+    const ParticleCounter::ArchiveDataset &archiveData = snapshot->archiveData;
+    QString serialnumber = snapshot->deviceInfo.deviceIdString;
+    serialnumber.remove(QRegExp("\\D"));    // Remove all non-digits
+
+    emit signal_liveUpdate(makeLiveUpdate(snapshot));
+
+    ParticleCounter* pc = qobject_cast<ParticleCounter*>(sender());
+    if (pc != nullptr)
+        m_samplingAligner->checkDataset(pc, archiveData);
+
+    // The map is only changed by this thread, so it is read without locking
+    ParticleCounterHistoryPtr history = m_histories.value(id);
+    if (!history.isNull())
+        history->append(archiveData);
+
+    ParticleCounterAggregates* aggregates = m_aggregates.value(id);
+    if (aggregates != nullptr)
+    {
+        if (m_writeAggregatePoints)
+        {
+            foreach (const ParticleCounterAggregates::CompletedPeriod& completedPeriod, aggregates->takeCompletedPeriods(archiveData.timestamp.toMSecsSinceEpoch()))
+            {
+                writeAggregatePoints(id, serialnumber, snapshot->zoneTag, completedPeriod.aggregate, completedPeriod.periodEndMs);
+            }
+        }
+        aggregates->add(archiveData);
+    }
+
+    if (m_downsampler != nullptr)
+    {
+        QList<ParticleCounterDownsampler::RollupPoint> rollupPoints;
+        m_downsampler->add(id, serialnumber, snapshot->zoneTag, archiveData, &rollupPoints);
+        writeRollupPoints(rollupPoints);
+    }
+
+    if ((m_zoneAggregates != nullptr) && !snapshot->zone.isEmpty())
+    {
+        if (!m_zoneAggregates->add(snapshot->zone, snapshot->zoneTag, archiveData))
+            m_sinkStatus.zoneDatasetsDropped = m_zoneAggregates->getDroppedDatasets();
+    }
+
+    if (m_classification != nullptr)
+    {
+        double isoClass = m_classification->add(id, snapshot->zone, archiveData);
+        writeClassificationPoint(snapshot, serialnumber, isoClass);
+    }
+
+    if (m_alarmEngine != nullptr)
+    {
+        QList<ParticleCounterAlarmEngine::Transition> transitions;
+        m_alarmEngine->evaluate(id, snapshot->limits, archiveData, &transitions);
+        foreach (const ParticleCounterAlarmEngine::Transition& transition, transitions)
+        {
+            emit signal_alarmUpdate(makeAlarmUpdate(snapshot->busID, transition));
+            writeAlarmPoint(snapshot, serialnumber, transition);
+        }
+    }
+
+    if (!m_writeRawData)
+        return;     // Only the rollups are written
+
+    // Counts of all channels in the format selected for this sink
+    quint32 counts[8];
+    for (int ch=0; ch<8; ch++)
+    {
+        counts[ch] = archiveData.channelData[ch].count;
+    }
+    ParticleCounterNormalization::Counts normalized;
+    ParticleCounterNormalization::normalize(counts, archiveData.outputDataFormat == ParticleCounter::CUMULATIVE, &normalized);
+    const quint32* writtenCounts = ParticleCounterNormalization::selectCounts(counts, normalized, m_rawCountFormat);
+    double concentrations[8];
+    if (m_rawCountFormat == ParticleCounterNormalization::CONCENTRATION)
+        ParticleCounterNormalization::concentrations(normalized.cumulative, m_flowRateInLitersPerMinute / 60000.0 * archiveData.samplingTimeInSeconds, concentrations);
 
     // Separate data points in influx for each channel of the particle counter
     for (int ch=0; ch<8; ch++)
     {
         // particles,tag_id=50,tag_channel=7, id=50i,channel=7i,counts=7i
 
+        // All written values of a channel are compared by change-only writes
+        quint64 value = writtenCounts[ch];
+        if (m_rawCountFormat == ParticleCounterNormalization::BOTH)
+            value = ((quint64)normalized.cumulative[ch] << 32) | normalized.distributive[ch];
+        else if (m_rawCountFormat == ParticleCounterNormalization::CONCENTRATION)
+            value = ((quint64)counts[ch] << 32) | normalized.cumulative[ch];
+
+        if (m_sinkStatus.changeOnlyWrites && isChannelPointUnchanged(id, ch, value, archiveData.channelData[ch].status, archiveData.timestamp.toMSecsSinceEpoch()))
+        {
+            m_sinkStatus.pointsSuppressed++;
+            continue;
+        }
+        m_sinkStatus.pointsWritten++;
+
         QByteArray payload;
         payload.append(measurementName.toUtf8() + ",");
         payload.append("tag_id=" + QByteArray().setNum(id) + ",");
-        payload.append("tag_serialnumber=\"" + deviceInfo.deviceIdString.toUtf8() + "\",");
+        payload.append("tag_serialnumber=\"" + serialnumber.toUtf8() + "\",");
         payload.append("tag_channel=" + QByteArray().setNum(archiveData.channelData[ch].channel));
-        // tbd!!
-        //    payload.append(",tag_room=" + responseData.value("room").toUtf8());
+        payload.append(snapshot->zoneTag);
         payload.append(" ");
         payload.append("id=" + QByteArray().setNum(id) + "i,");
-        payload.append("serialnumber=\"" + deviceInfo.deviceIdString.toUtf8() + "\",");
+        payload.append("serialnumber=\"" + serialnumber.toUtf8() + "\",");
         payload.append("channel=" + QByteArray().setNum(archiveData.channelData[ch].channel) + "i,");
-        payload.append("counts=" + QByteArray().setNum(archiveData.channelData[ch].count) + "i ");
+        payload.append("counts=" + QByteArray().setNum(writtenCounts[ch]) + "i");
+        if (m_rawCountFormat == ParticleCounterNormalization::BOTH)
+        {
+            payload.append(",cumulative=" + QByteArray().setNum(normalized.cumulative[ch]) + "i");
+            payload.append(",distributive=" + QByteArray().setNum(normalized.distributive[ch]) + "i");
+        }
+        else if (m_rawCountFormat == ParticleCounterNormalization::CONCENTRATION)
+        {
+            payload.append(",concentration=" + QByteArray().setNum(concentrations[ch]));
+        }
+        payload.append(" ");
         qulonglong timestamp = archiveData.timestamp.toMSecsSinceEpoch() * 1000000ull;    // Write timestamp to influx in nanoseconds since epoch
         payload.append(QString().setNum(timestamp));
-        m_influxDB->write(payload);
+        writePoint(payload);
     }
 }
 
+void ParticleCounterDatabase::writeAggregatePoints(int id, QString serialnumber, QByteArray zoneTag, const ParticleCounter::WindowAggregate &aggregate, qint64 periodEndMs)
+{
+    // Example of payload:
+    // 'particles_aggregates,tag_id=2,tag_serialnumber="123",tag_channel=1,tag_window=300 id=2i,channel=1i,window=300i,samples=5i,sum=62i,max=20i,mean=12.4 1678388100000000000'
+
+    QByteArray measurementName = m_settings->value("measurementName", QString()).toString().toUtf8() + "_aggregates";
+    qulonglong timestamp = periodEndMs * 1000000ull;    // End of the period in nanoseconds since epoch
+
+    for (int ch=0; ch<8; ch++)
+    {
+        QByteArray payload;
+        payload.append(measurementName + ",");
+        payload.append("tag_id=" + QByteArray().setNum(id) + ",");
+        payload.append("tag_serialnumber=\"" + serialnumber.toUtf8() + "\",");
+        payload.append("tag_channel=" + QByteArray().setNum(ch + 1) + ",");
+        payload.append("tag_window=" + QByteArray().setNum(aggregate.windowInSeconds));
+        payload.append(zoneTag);
+        payload.append(" ");
+        payload.append("id=" + QByteArray().setNum(id) + "i,");
+        payload.append("channel=" + QByteArray().setNum(ch + 1) + "i,");
+        payload.append("window=" + QByteArray().setNum(aggregate.windowInSeconds) + "i,");
+        payload.append("samples=" + QByteArray().setNum(aggregate.samples) + "i,");
+        payload.append("sum=" + QByteArray().setNum(aggregate.sum[ch]) + "i,");
+        payload.append("max=" + QByteArray().setNum(aggregate.max[ch]) + "i,");
+        payload.append("mean=" + QByteArray().setNum((double)aggregate.sum[ch] / aggregate.samples) + " ");
+        payload.append(QByteArray().setNum(timestamp));
+        writePoint(payload);
+    }
+}
+
+ParticleCounterNormalization::CountFormat ParticleCounterDatabase::readCountFormat(QString defaultFormat, bool accumulable)
+{
+    // Reads countFormat of the current settings group. Sinks that sum up counts can not write both formats or concentrations.
+    QString name = m_settings->value("countFormat", defaultFormat).toString();
+    ParticleCounterNormalization::CountFormat format;
+    if (!ParticleCounterNormalization::parseCountFormat(name, &format) ||
+            (accumulable && (format == ParticleCounterNormalization::BOTH || format == ParticleCounterNormalization::CONCENTRATION)))
+    {
+        m_loghandler->slot_newEntry(LogEntry::Error, "ParticleCounterDatabase", "Invalid countFormat " + name + " in section " + m_settings->group() + ", using asDelivered.");
+        return ParticleCounterNormalization::AS_DELIVERED;
+    }
+    return format;
+}
+
+bool ParticleCounterDatabase::isChannelPointUnchanged(int id, int ch, quint64 value, ParticleCounter::ChannelStatus status, qint64 timestampMs)
+{
+    QVector<WrittenChannel>& writtenChannels = m_lastWrittenChannels[id];
+    if (writtenChannels.isEmpty())
+    {
+        writtenChannels.resize(8);
+        for (int i = 0; i < 8; i++)
+        {
+            writtenChannels[i].timestampMs = -1;    // Nothing written yet
+        }
+    }
+
+    WrittenChannel& writtenChannel = writtenChannels[ch];
+    if ((writtenChannel.timestampMs >= 0) &&
+            (writtenChannel.value == value) &&
+            (writtenChannel.status == status) &&
+            (timestampMs - writtenChannel.timestampMs < (qint64)m_sinkStatus.heartbeatIntervalInSeconds * 1000))
+        return true;
+
+    writtenChannel.value = value;
+    writtenChannel.status = status;
+    writtenChannel.timestampMs = timestampMs;
+    return false;
+}
+
+void ParticleCounterDatabase::writeRollupPoints(const QList<ParticleCounterDownsampler::RollupPoint> &rollupPoints)
+{
+    // Example of payload:
+    // 'particles_15m,tag_id=2,tag_serialnumber="123",tag_channel=1 id=2i,channel=1i,count=15i,sum=62i,max=20i 1678388400000000000'
+
+    foreach (const ParticleCounterDownsampler::RollupPoint& rollupPoint, rollupPoints)
+    {
+        QByteArray measurementName = m_downsampler->getRollup(rollupPoint.rollupIndex).measurementName.toUtf8();
+        qulonglong timestamp = rollupPoint.periodEndMs * 1000000ull;    // End of the period in nanoseconds since epoch
+
+        for (int ch=0; ch<8; ch++)
+        {
+            QByteArray payload;
+            payload.append(measurementName + ",");
+            payload.append("tag_id=" + QByteArray().setNum(rollupPoint.id) + ",");
+            payload.append("tag_serialnumber=\"" + rollupPoint.serialnumber.toUtf8() + "\",");
+            payload.append("tag_channel=" + QByteArray().setNum(ch + 1));
+            payload.append(rollupPoint.zoneTag);
+            payload.append(" ");
+            payload.append("id=" + QByteArray().setNum(rollupPoint.id) + "i,");
+            payload.append("channel=" + QByteArray().setNum(ch + 1) + "i,");
+            payload.append("count=" + QByteArray().setNum(rollupPoint.samples) + "i,");
+            payload.append("sum=" + QByteArray().setNum(rollupPoint.sum[ch]) + "i,");
+            payload.append("max=" + QByteArray().setNum(rollupPoint.max[ch]) + "i ");
+            payload.append(QByteArray().setNum(timestamp));
+            writePoint(payload);
+        }
+    }
+}
+
+void ParticleCounterDatabase::writeZonePoints(const QList<ParticleCounterZoneAggregates::ZonePoint> &zonePoints)
+{
+    // Example of payload:
+    // 'particles_zones,tag_room=iso5-Raum,tag_channel=1 channel=1i,samples=3i,sum=62i,max=40i,mean=20.6667 1678388160000000000'
+
+    QByteArray measurementName = m_settings->value("measurementName", QString()).toString().toUtf8() + "_zones";
+
+    foreach (const ParticleCounterZoneAggregates::ZonePoint& zonePoint, zonePoints)
+    {
+        qulonglong timestamp = zonePoint.periodEndMs * 1000000ull;    // End of the period in nanoseconds since epoch
+
+        for (int ch=0; ch<8; ch++)
+        {
+            QByteArray payload;
+            payload.append(measurementName);
+            payload.append(zonePoint.zoneTag);
+            payload.append(",tag_channel=" + QByteArray().setNum(ch + 1));
+            payload.append(" ");
+            payload.append("channel=" + QByteArray().setNum(ch + 1) + "i,");
+            payload.append("samples=" + QByteArray().setNum(zonePoint.samples) + "i,");
+            payload.append("sum=" + QByteArray().setNum(zonePoint.sum[ch]) + "i,");
+            payload.append("max=" + QByteArray().setNum(zonePoint.max[ch]) + "i,");
+            payload.append("mean=" + QByteArray().setNum((double)zonePoint.sum[ch] / zonePoint.samples) + " ");
+            payload.append(QByteArray().setNum(timestamp));
+            writePoint(payload);
+        }
+    }
+}
+
+void ParticleCounterDatabase::writeClassificationPoint(ParticleCounter::ArchiveDatasetSnapshotPtr snapshot, QString serialnumber, double isoClass)
+{
+    // Example of payload:
+    // 'particles_classification,tag_id=2,tag_serialnumber="123",tag_room=iso5-Raum id=2i,isoClass=4.3,zoneIsoClass=4.7 1678388136000000000'
+
+    QByteArray measurementName = m_settings->value("measurementName", QString()).toString().toUtf8() + "_classification";
+
+    QByteArray payload;
+    payload.append(measurementName + ",");
+    payload.append("tag_id=" + QByteArray().setNum(snapshot->id) + ",");
+    payload.append("tag_serialnumber=\"" + serialnumber.toUtf8() + "\"");
+    payload.append(snapshot->zoneTag);
+    payload.append(" ");
+    payload.append("id=" + QByteArray().setNum(snapshot->id) + "i,");
+    payload.append("isoClass=" + QByteArray().setNum(isoClass, 'f', 1));
+    if (!snapshot->zone.isEmpty())
+        payload.append(",zoneIsoClass=" + QByteArray().setNum(m_classification->getZoneClass(snapshot->zone), 'f', 1));
+    payload.append(" ");
+    qulonglong timestamp = snapshot->archiveData.timestamp.toMSecsSinceEpoch() * 1000000ull;
+    payload.append(QByteArray().setNum(timestamp));
+    writePoint(payload);
+}
+
+void ParticleCounterDatabase::writeAlarmPoint(ParticleCounter::ArchiveDatasetSnapshotPtr snapshot, QString serialnumber, const ParticleCounterAlarmEngine::Transition &transition)
+{
+    // Example of payload:
+    // 'particles_alarms,tag_id=2,tag_serialnumber="123",tag_channel=3,tag_room=iso5-Raum id=2i,channel=3i,level="alarm",levelCode=3i,previousLevelCode=2i,count=1200i,limit=1000i 1678388136000000000'
+
+    QByteArray measurementName = m_settings->value("measurementName", QString()).toString().toUtf8() + "_alarms";
+
+    QByteArray payload;
+    payload.append(measurementName + ",");
+    payload.append("tag_id=" + QByteArray().setNum(transition.id) + ",");
+    payload.append("tag_serialnumber=\"" + serialnumber.toUtf8() + "\",");
+    payload.append("tag_channel=" + QByteArray().setNum(transition.channel));
+    payload.append(snapshot->zoneTag);
+    payload.append(" ");
+    payload.append("id=" + QByteArray().setNum(transition.id) + "i,");
+    payload.append("channel=" + QByteArray().setNum(transition.channel) + "i,");
+    payload.append("level=\"" + ParticleCounterAlarmEngine::levelName(transition.level).toUtf8() + "\",");
+    payload.append("levelCode=" + QByteArray().setNum(transition.level) + "i,");
+    payload.append("previousLevelCode=" + QByteArray().setNum(transition.previousLevel) + "i,");
+    payload.append("count=" + QByteArray().setNum(transition.count) + "i,");
+    payload.append("limit=" + QByteArray().setNum(transition.limit) + "i ");
+    qulonglong timestamp = transition.timestamp.toMSecsSinceEpoch() * 1000000ull;
+    payload.append(QByteArray().setNum(timestamp));
+    writePoint(payload);
+}
+
+ParticleCounterDatabase::AlarmUpdatePtr ParticleCounterDatabase::makeAlarmUpdate(int busID, const ParticleCounterAlarmEngine::Transition &transition)
+{
+    // Example:
+    // 'Alarm from id=2 busID=0 channel=3 level=alarm previousLevel=warning count=1200 limit=1000 timestamp=2024-05-01T10:00:00Z'
+    AlarmUpdate* alarmUpdate = new AlarmUpdate;
+    alarmUpdate->id = transition.id;
+    alarmUpdate->busID = busID;
+
+    QString timestamp = transition.timestamp.toUTC().toString(Qt::ISODate);
+
+    QByteArray &line = alarmUpdate->line;
+    line.append("Alarm from id=" + QByteArray::number(transition.id));
+    line.append(" busID=" + QByteArray::number(busID));
+    line.append(" channel=" + QByteArray::number(transition.channel));
+    line.append(" level=" + ParticleCounterAlarmEngine::levelName(transition.level).toUtf8());
+    line.append(" previousLevel=" + ParticleCounterAlarmEngine::levelName(transition.previousLevel).toUtf8());
+    line.append(" count=" + QByteArray::number(transition.count));
+    line.append(" limit=" + QByteArray::number(transition.limit));
+    line.append(" timestamp=" + timestamp.toUtf8());
+    line.append("\r\n");
+
+    // {"type":"alarm","id":2,"busID":0,"channel":3,"level":"alarm","previousLevel":"warning","count":1200,"limit":1000,"timestamp":"..."}
+    JsonLineWriter json(&alarmUpdate->jsonLine);
+    json.beginObject();
+    json.addString("type", "alarm");
+    json.addInt("id", transition.id);
+    json.addInt("busID", busID);
+    json.addInt("channel", transition.channel);
+    json.addString("level", ParticleCounterAlarmEngine::levelName(transition.level));
+    json.addString("previousLevel", ParticleCounterAlarmEngine::levelName(transition.previousLevel));
+    json.addInt("count", transition.count);
+    json.addInt("limit", transition.limit);
+    json.addString("timestamp", timestamp);
+    json.endObject();
+    json.endLine();
+
+    return AlarmUpdatePtr(alarmUpdate);
+}
+
+void ParticleCounterDatabase::slot_timer_flushZoneAggregates_fired()
+{
+    QList<ParticleCounterZoneAggregates::ZonePoint> zonePoints;
+    m_zoneAggregates->takeCompletedPeriods(QDateTime::currentMSecsSinceEpoch(), &zonePoints);
+    writeZonePoints(zonePoints);
+}
+
+void ParticleCounterDatabase::writePoint(const QByteArray &point)
+{
+    if (m_sinkStatus.batchWindowInSeconds <= 0)
+    {
+        m_influxDB->write(point);
+        return;
+    }
+
+    // With aligned sampling the datasets of all particle counters arrive within a short time,
+    // so the points of one sampling window end up in one write request.
+    if (!m_pointBatch.isEmpty())
+        m_pointBatch.append('\n');
+    m_pointBatch.append(point);
+    m_pointBatchLines++;
+
+    if (m_pointBatchLines >= 5000)
+        flushPoints();     // Batch size recommended by influx
+    else if (!m_timer_flushPoints.isActive())
+        m_timer_flushPoints.start();
+}
+
+void ParticleCounterDatabase::flushPoints()
+{
+    m_timer_flushPoints.stop();
+    if (m_pointBatch.isEmpty())
+        return;
+
+    m_influxDB->write(m_pointBatch);
+    m_sinkStatus.batchesWritten++;
+    m_pointBatch.clear();
+    m_pointBatchLines = 0;
+}
+
+void ParticleCounterDatabase::slot_timer_flushRollups_fired()
+{
+    QList<ParticleCounterDownsampler::RollupPoint> rollupPoints;
+    m_downsampler->flushStale(QDateTime::currentMSecsSinceEpoch(), &rollupPoints);
+    writeRollupPoints(rollupPoints);
+}
+
+void ParticleCounterDatabase::slot_publishSnapshot()
+{
+    Snapshot* snapshot = new Snapshot;
+    snapshot->timestamp = QDateTime::currentDateTime();
+    snapshot->particleCounters.reserve(m_particlecounters.size());
+
+    foreach (ParticleCounter* pc, m_particlecounters)
+    {
+        snapshot->indexByID.insert(pc->getId(), snapshot->particleCounters.size());
+        ParticleCounter::State state = pc->getState();
+        state.latestArchiveDataset = pc->getLatestArchiveDatasetSnapshot();
+        ParticleCounterAggregates* aggregates = m_aggregates.value(pc->getId());
+        if (aggregates != nullptr)
+        {
+            aggregates->expire(snapshot->timestamp.toMSecsSinceEpoch());
+            state.aggregates = aggregates->getAggregates();
+        }
+        if (m_classification != nullptr)
+        {
+            state.isoClass = m_classification->getClass(state.id);
+            if (!state.zone.isEmpty())
+                state.zoneIsoClass = m_classification->getZoneClass(state.zone);
+        }
+        snapshot->particleCounters.append(state);
+    }
+
+    for (int busID = 0; busID < m_pcModbusList->size(); busID++)
+    {
+        ModBus* modBus = m_pcModbusList->at(busID);
+        BusState busState;
+        busState.busID = busID;
+        busState.telegramQueueLevel_standardPriority = modBus->getSizeOfTelegramQueue(false);
+        busState.telegramQueueLevel_highPriority = modBus->getSizeOfTelegramQueue(true);
+        snapshot->buses.append(busState);
+    }
+
+    snapshot->initStatus = m_initScheduler->getStatus();
+    snapshot->alignmentStatus = m_samplingAligner->getStatus();
+    snapshot->sinkStatus = m_sinkStatus;
+
+    QMutexLocker locker(&m_snapshotMutex);
+    m_snapshot = SnapshotPtr(snapshot);
+}
+
+void ParticleCounterDatabase::slot_particleCounterNeedsSaving()
+{
+    // Several changes of one or many particle counters are coalesced into one write
+    ParticleCounter* pc = qobject_cast<ParticleCounter*>(sender());
+    if (pc == nullptr)
+        return;
+
+    m_particleCountersToSave.insert(pc);
+    if (!m_timer_saveChanges.isActive())
+        m_timer_saveChanges.start();
+}
+
 void ParticleCounterDatabase::slot_timer_pollStatus_fired()
 {
     foreach (ModBus* modBus, *m_pcModbusList)
@@ -343,13 +1140,37 @@ void ParticleCounterDatabase::slot_timer_pollStatus_fired()
         int sizeOfTelegramQueue = qMax(modBus->getSizeOfTelegramQueue(false), modBus->getSizeOfTelegramQueue(true));
         if (sizeOfTelegramQueue < 20)
         {
+            // Live counts and device info revalidations only use the bus time that is left over by status and archive requests:
+            // They are read only if the bus has nearly drained its queue since the last poll cycle, and only as many per cycle
+            // as fit into the remaining queue space. Counters that are left out stay due and are read in the next cycles.
+            // If the bus is too busy the live interval is stretched automatically.
+            int lowPriorityRequestsLeft = qMax(0, 5 - sizeOfTelegramQueue);
             foreach(ParticleCounter* pc, m_particlecounters)
             {
                 if (m_pcModbusList->indexOf(modBus) == pc->getBusID())
                 {
+                    // Counters are polled after their own init, acquisition starts per counter and not after all inits
+                    if (pc->isInitRunning() || m_initScheduler->isScheduled(pc))
+                        continue;
+
                     pc->requestStatus();
-                    pc->requestArchiveDataset();
-                    pc->requestNextArchive();
+                    if (!pc->isInitialized())
+                        continue;
+                    if (pc->isArchiveAcquisitionEnabled())
+                    {
+                        pc->requestArchiveDataset();
+                        pc->requestNextArchive();
+                    }
+                    if ((lowPriorityRequestsLeft > 0) && pc->isLiveCountsRequestDue())
+                    {
+                        pc->requestLiveCounts();
+                        lowPriorityRequestsLeft--;
+                    }
+                    if ((lowPriorityRequestsLeft > 0) && pc->isDeviceInfoRevalidationDue())
+                    {
+                        pc->requestDeviceInfo();
+                        lowPriorityRequestsLeft--;
+                    }
                 }
             }
         }
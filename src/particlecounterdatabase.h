@@ -28,9 +28,24 @@
 #include <QMap>
 #include <QSettings>
 #include <QRegExp>
+#include <QHash>
+#include <QSet>
+#include <QMutex>
 #include "particlecountermodbussystem.h"
 #include "loghandler.h"
 #include "particlecounter.h"
+#include "jsonlinewriter.h"
+#include "particlecounterimport.h"
+#include "particlecounterinitscheduler.h"
+#include "particlecountersamplingaligner.h"
+#include "particlecounterregistry.h"
+#include "particlecounterhistory.h"
+#include "particlecounteraggregates.h"
+#include "particlecounterdownsampler.h"
+#include "particlecounterzoneaggregates.h"
+#include "particlecounterclassification.h"
+#include "particlecounternormalization.h"
+#include "particlecounteralarmengine.h"
 #include "influxdb.h"
 
 
@@ -38,14 +53,83 @@ class ParticleCounterDatabase : public QObject
 {
     Q_OBJECT
 public:
+    // One line for the terminal live mode, serialized once per decoded dataset and shared by all live clients.
+    // The segment of channel n (0..7) is line[channelSegmentOffsets[n] .. channelSegmentOffsets[n+1]), everything
+    // before the first segment is the header and everything behind the last one is the line end.
+    // This allows clients with a channel filter to write only parts of the line without reformatting it.
+    // jsonLine is the same update for clients in json mode, its segments are laid out the same way.
+    typedef struct {
+        int id;
+        int busID;
+        QByteArray line;
+        int channelSegmentOffsets[9];
+        QByteArray jsonLine;
+        int jsonChannelSegmentOffsets[9];
+    } LiveUpdate;
+
+    typedef QSharedPointer<const LiveUpdate> LiveUpdatePtr;
+
+    // Alarm transition of a channel, serialized once for all terminal clients that subscribed to alarms
+    typedef struct {
+        int id;
+        int busID;
+        QByteArray line;
+        QByteArray jsonLine;
+    } AlarmUpdate;
+
+    typedef QSharedPointer<const AlarmUpdate> AlarmUpdatePtr;
+
+    typedef struct {
+        int busID;
+        int telegramQueueLevel_standardPriority;
+        int telegramQueueLevel_highPriority;
+    } BusState;
+
+    // Points of the raw archive datasets written to the influx sink and suppressed by change-only writes
+    typedef struct {
+        bool changeOnlyWrites;
+        int heartbeatIntervalInSeconds;
+        quint64 pointsWritten;
+        quint64 pointsSuppressed;
+        quint64 zoneDatasetsDropped;    // Datasets that arrived after their zone aggregate period was written
+        int batchWindowInSeconds;       // Points are collected and written in one request per window, 0 writes each point on its own
+        quint64 batchesWritten;
+    } SinkStatus;
+
+    // Read-only copy of the whole database for readers in other threads (e.g. the terminal server).
+    // It is published periodically and after each batch of terminal requests.
+    typedef struct {
+        QDateTime timestamp;
+        QList<ParticleCounter::State> particleCounters;
+        QHash<int, int> indexByID;      // id -> index in particleCounters
+        QList<BusState> buses;
+        ParticleCounterInitScheduler::Status initStatus;
+        ParticleCounterSamplingAligner::Status alignmentStatus;
+        SinkStatus sinkStatus;
+    } Snapshot;
+
+    typedef QSharedPointer<const Snapshot> SnapshotPtr;
+
     explicit ParticleCounterDatabase(QObject *parent, ParticleCounterModbusSystem *pcModbusSystem, InfluxDB *influxDB, Loghandler *loghandler);
 
     void loadFromHdd();
     void saveToHdd();
 
+    // Changes of particle counters are collected and written to the registry in one batch after saveDelayInMs.
+    // This writes the pending changes right away, e.g. at shutdown.
+    void flushChanges();
+
+    // Points of the influx sink are collected for batchWindowInSeconds (see writePoint).
+    // This writes the collected points right away, e.g. at shutdown.
+    void flushPoints();
+
     QList<ModBus *> *getBusList();
 
     QString addParticleCounter(int id, int busID, int modbusAddress);
+
+    // Import many particle counters from csv data (see ParticleCounterImport) in one transaction:
+    // Nothing is imported if a line is invalid, their initialization is spread over time by the init scheduler.
+    QString importParticleCounters(QString csv, bool dryRun);
     QString deleteParticleCounter(int id);
 
     QList<ParticleCounter*> getParticleCounters(int busNr = -1);    // If busNr is specified only OCUs of that bus are returned
@@ -56,6 +140,16 @@ public:
     QString setParticleCounterData(int id, QString key, QString value);
     QString setParticleCounterData(int id, QMap<QString,QString> dataMap);
 
+    // Write the limitN entries of profile to all particle counters at busID, see ParticleCounter::applyLimitSettings().
+    // Particle counters whose limits have not been read yet are skipped.
+    QString setLimits(int busID, QMap<QString,QString> profile);
+
+    // Get the last published snapshot, this is thread-safe
+    SnapshotPtr getSnapshot();
+
+    // Get the archive dataset history of a particle counter, this is thread-safe. Null if there is no history.
+    ParticleCounterHistoryPtr getHistory(int id);
+
     // Broadcast is not implemented yet
     //QString broadcast(int busID, QMap<QString,QString> dataMap);
 
@@ -68,28 +162,117 @@ private:
     InfluxDB* m_influxDB;
     Loghandler* m_loghandler;
     QList<ParticleCounter*> m_particlecounters;
+    int m_defaultLiveCountsIntervalInSeconds;
+    ParticleCounterInitScheduler* m_initScheduler;
+    ParticleCounterSamplingAligner* m_samplingAligner;
+    ParticleCounterRegistry* m_registry;
+    QSet<ParticleCounter*> m_particleCountersToSave;
+    QTimer m_timer_saveChanges;
     QTimer m_timer_pollStatus;
     QTimer m_timer_checkRealTimeClocks;
+    QTimer m_timer_publishSnapshot;
+    QTimer m_timer_flushRollups;
+    QTimer m_timer_flushZoneAggregates;
+    QTimer m_timer_flushPoints;
+    QMutex m_snapshotMutex;
+    SnapshotPtr m_snapshot;
+
+    // Histories are only added and removed by the main thread, other threads lock the mutex for getHistory()
+    QMap<int, ParticleCounterHistoryPtr> m_histories;
+    QMutex m_historyMutex;
+    quint32 m_historySize;
+    QString m_historyDirectory;
+
+    void openHistory(int id);
+    void removeHistory(int id);
+
+    // Rolling window aggregates per particle counter, only used by the main thread
+    QMap<int, ParticleCounterAggregates*> m_aggregates;
+    QList<int> m_aggregateWindows;
+    int m_aggregateBucketsPerWindow;
+    bool m_writeAggregatePoints;
+
+    void writeAggregatePoints(int id, QString serialnumber, QByteArray zoneTag, const ParticleCounter::WindowAggregate& aggregate, qint64 periodEndMs);
+
+    // Optional downsampling stage in front of the influx sink, null if switched off
+    ParticleCounterDownsampler* m_downsampler;
+    bool m_writeRawData;
+
+    void writeRollupPoints(const QList<ParticleCounterDownsampler::RollupPoint>& rollupPoints);
+
+    // Aggregates across the particle counters of each zone, null if switched off
+    ParticleCounterZoneAggregates* m_zoneAggregates;
+
+    void writeZonePoints(const QList<ParticleCounterZoneAggregates::ZonePoint>& zonePoints);
+
+    // ISO 14644-1 classification of particle counters and zones, null if switched off
+    ParticleCounterClassification* m_classification;
+
+    void writeClassificationPoint(ParticleCounter::ArchiveDatasetSnapshotPtr snapshot, QString serialnumber, double isoClass);
+
+    // Alarm engine for the warning and alarm limits of the channels, null if switched off
+    ParticleCounterAlarmEngine* m_alarmEngine;
+
+    void writeAlarmPoint(ParticleCounter::ArchiveDatasetSnapshotPtr snapshot, QString serialnumber, const ParticleCounterAlarmEngine::Transition& transition);
+    AlarmUpdatePtr makeAlarmUpdate(int busID, const ParticleCounterAlarmEngine::Transition& transition);
+
+    // Change-only writes: A channel point is suppressed if count and status equal the last written point of that channel,
+    // unless the last written point is older than the heartbeat interval. Only used by the main thread.
+    typedef struct {
+        quint64 value;      // Written counts of the channel, see isChannelPointUnchanged()
+        ParticleCounter::ChannelStatus status;
+        qint64 timestampMs;
+    } WrittenChannel;
+
+    QHash<int, QVector<WrittenChannel> > m_lastWrittenChannels;    // id -> 8 channels
+    SinkStatus m_sinkStatus;
+
+    // Points of the influx sink collected for one write request
+    QByteArray m_pointBatch;
+    int m_pointBatchLines;
+
+    void writePoint(const QByteArray& point);
+
+    bool isChannelPointUnchanged(int id, int ch, quint64 value, ParticleCounter::ChannelStatus status, qint64 timestampMs);
+
+    // Values written by the raw, rollup and zone sinks, the counts of the datasets are converted by ParticleCounterNormalization
+    ParticleCounterNormalization::CountFormat m_rawCountFormat;
+    double m_flowRateInLitersPerMinute;     // Used for concentrations, see [classification]
+    ParticleCounterNormalization::CountFormat readCountFormat(QString defaultFormat, bool accumulable);
 
     ParticleCounter* getParticleCounterByTelegramID(quint64 telegramID);
 
+    void connectParticleCounter(ParticleCounter* pc);
+    void disconnectParticleCounter(ParticleCounter* pc);
+
+    // Serialization of decoded datasets for the terminal live mode
+    LiveUpdatePtr makeLiveUpdate(ParticleCounter::ActualDataSnapshotPtr snapshot);
+    LiveUpdatePtr makeLiveUpdate(ParticleCounter::ArchiveDatasetSnapshotPtr snapshot);
+
 signals:
-    void signal_ParticleCounterActualDataHasChanged(int id);
+    void signal_liveUpdate(ParticleCounterDatabase::LiveUpdatePtr liveUpdate);
+    void signal_alarmUpdate(ParticleCounterDatabase::AlarmUpdatePtr alarmUpdate);
 
 public slots:
+    void slot_publishSnapshot();
 
 private slots:
     // High level bus response slots
     void slot_transactionFinished();
     void slot_transactionLost(quint64 telegramID);
-    void slot_receivedHoldingRegisterData(quint64 telegramID, quint16 adr, quint16 reg, QList<quint16> data);
-    void slot_receivedInputRegisterData(quint64 telegramID, quint16 adr, quint16 reg, QList<quint16> data);
+    void slot_receivedRegisterData(ModbusRegisterResponsePtr response);
 
-    void slot_ParticleCounterActualDataReceived(int id, ParticleCounter::ActualData actualData, ParticleCounter::DeviceInfo deviceInfo);
-    void slot_ParticleCounterArchiveDataReceived(int id, ParticleCounter::ArchiveDataset archiveData, ParticleCounter::DeviceInfo deviceInfo);
+    void slot_ParticleCounterActualDataReceived(ParticleCounter::ActualDataSnapshotPtr snapshot);
+    void slot_ParticleCounterArchiveDataReceived(ParticleCounter::ArchiveDatasetSnapshotPtr snapshot);
     // Timer slots
+    void slot_particleCounterNeedsSaving();
     void slot_timer_pollStatus_fired();
     void slot_timer_checkRealTimeClocks_fired();
+    void slot_timer_flushRollups_fired();
+    void slot_timer_flushZoneAggregates_fired();
 };
 
+Q_DECLARE_METATYPE(ParticleCounterDatabase::LiveUpdatePtr)
+Q_DECLARE_METATYPE(ParticleCounterDatabase::AlarmUpdatePtr)
+
 #endif // PARTICLECOUNTERDATABASE_H
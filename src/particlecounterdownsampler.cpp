@@ -0,0 +1,156 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#include <QStringList>
+#include "particlecounterdownsampler.h"
+
+ParticleCounterDownsampler::ParticleCounterDownsampler(const QList<Rollup> &rollups, ParticleCounterNormalization::CountFormat countFormat)
+{
+    m_rollups = rollups;
+    m_countFormat = countFormat;
+}
+
+QList<ParticleCounterDownsampler::Rollup> ParticleCounterDownsampler::parseRollups(QString rollups)
+{
+    QList<Rollup> parsedRollups;
+    foreach (QString rollupString, rollups.split(',', QString::SkipEmptyParts))
+    {
+        QStringList fields = rollupString.trimmed().split(':');
+        if (fields.size() != 2)
+            continue;
+
+        bool ok;
+        Rollup rollup;
+        rollup.intervalInSeconds = fields.at(0).trimmed().toInt(&ok);
+        rollup.measurementName = fields.at(1).trimmed();
+        if (ok && (rollup.intervalInSeconds > 0) && !rollup.measurementName.isEmpty())
+            parsedRollups.append(rollup);
+    }
+    return parsedRollups;
+}
+
+const ParticleCounterDownsampler::Rollup &ParticleCounterDownsampler::getRollup(int index) const
+{
+    return m_rollups.at(index);
+}
+
+void ParticleCounterDownsampler::add(int id, QString serialnumber, QByteArray zoneTag, const ParticleCounter::ArchiveDataset &archiveDataset, QList<RollupPoint> *completedPoints)
+{
+    qint64 timestampMs = archiveDataset.timestamp.toMSecsSinceEpoch();
+
+    if (!m_counters.contains(id))
+    {
+        CounterState counterState;
+        counterState.accumulators.resize(m_rollups.size());
+        for (int r = 0; r < m_rollups.size(); r++)
+        {
+            reset(&counterState.accumulators[r], -1);
+        }
+        m_counters.insert(id, counterState);
+    }
+
+    CounterState& counterState = m_counters[id];
+    counterState.serialnumber = serialnumber;
+    counterState.zoneTag = zoneTag;
+
+    quint32 deliveredCounts[8];
+    for (int ch=0; ch<8; ch++)
+    {
+        deliveredCounts[ch] = archiveDataset.channelData[ch].count;
+    }
+    ParticleCounterNormalization::Counts normalized;
+    ParticleCounterNormalization::normalize(deliveredCounts, archiveDataset.outputDataFormat == ParticleCounter::CUMULATIVE, &normalized);
+    const quint32* counts = ParticleCounterNormalization::selectCounts(deliveredCounts, normalized, m_countFormat);
+
+    for (int r = 0; r < m_rollups.size(); r++)
+    {
+        Accumulator& accumulator = counterState.accumulators[r];
+        qint64 period = timestampMs / ((qint64)m_rollups.at(r).intervalInSeconds * 1000);
+
+        if (period < accumulator.period)
+            continue;   // The period of this dataset has been written already
+
+        if (period > accumulator.period)
+        {
+            complete(id, counterState, r, completedPoints);
+            reset(&accumulator, period);
+        }
+
+        accumulator.samples++;
+        for (int ch=0; ch<8; ch++)
+        {
+            accumulator.sum[ch] += counts[ch];
+            accumulator.max[ch] = qMax(accumulator.max[ch], counts[ch]);
+        }
+    }
+}
+
+void ParticleCounterDownsampler::flushStale(qint64 nowMs, QList<RollupPoint> *completedPoints)
+{
+    QMutableHashIterator<int, CounterState> iterator(m_counters);
+    while (iterator.hasNext())
+    {
+        iterator.next();
+        CounterState& counterState = iterator.value();
+        for (int r = 0; r < m_rollups.size(); r++)
+        {
+            Accumulator& accumulator = counterState.accumulators[r];
+            qint64 intervalMs = (qint64)m_rollups.at(r).intervalInSeconds * 1000;
+            if ((accumulator.samples > 0) && (nowMs >= (accumulator.period + 2) * intervalMs))
+            {
+                complete(iterator.key(), counterState, r, completedPoints);
+                reset(&accumulator, accumulator.period + 1);    // Late datasets of the written period are dropped by add()
+            }
+        }
+    }
+}
+
+void ParticleCounterDownsampler::remove(int id)
+{
+    m_counters.remove(id);
+}
+
+void ParticleCounterDownsampler::complete(int id, const CounterState &counterState, int rollupIndex, QList<RollupPoint> *completedPoints)
+{
+    const Accumulator& accumulator = counterState.accumulators.at(rollupIndex);
+    if (accumulator.samples == 0)
+        return;
+
+    RollupPoint point;
+    point.id = id;
+    point.serialnumber = counterState.serialnumber;
+    point.zoneTag = counterState.zoneTag;
+    point.rollupIndex = rollupIndex;
+    point.periodEndMs = (accumulator.period + 1) * (qint64)m_rollups.at(rollupIndex).intervalInSeconds * 1000;
+    point.samples = accumulator.samples;
+    for (int ch=0; ch<8; ch++)
+    {
+        point.sum[ch] = accumulator.sum[ch];
+        point.max[ch] = accumulator.max[ch];
+    }
+    completedPoints->append(point);
+}
+
+void ParticleCounterDownsampler::reset(Accumulator *accumulator, qint64 period)
+{
+    accumulator->period = period;
+    accumulator->samples = 0;
+    for (int ch=0; ch<8; ch++)
+    {
+        accumulator->sum[ch] = 0;
+        accumulator->max[ch] = 0;
+    }
+}
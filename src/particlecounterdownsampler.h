@@ -0,0 +1,86 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#ifndef PARTICLECOUNTERDOWNSAMPLER_H
+#define PARTICLECOUNTERDOWNSAMPLER_H
+
+#include <QString>
+#include <QList>
+#include <QVector>
+#include <QHash>
+#include "particlecounter.h"
+#include "particlecounternormalization.h"
+
+// Optional stage between the archive datasets and the time series database: The datasets of each particle counter
+// are rolled up into fixed periods (e.g. 1, 15 and 60 minutes since epoch) with sum, max and sample count per channel.
+// Each rollup is written to its own measurement, the raw datasets may be switched off.
+class ParticleCounterDownsampler
+{
+public:
+    typedef struct {
+        int intervalInSeconds;
+        QString measurementName;
+    } Rollup;
+
+    typedef struct {
+        int id;
+        QString serialnumber;
+        QByteArray zoneTag;
+        int rollupIndex;
+        qint64 periodEndMs;
+        quint32 samples;
+        quint64 sum[8];
+        quint32 max[8];
+    } RollupPoint;
+
+    ParticleCounterDownsampler(const QList<Rollup>& rollups, ParticleCounterNormalization::CountFormat countFormat);
+
+    // Format: <intervalInSeconds>:<measurementName>[,<intervalInSeconds>:<measurementName>...]
+    static QList<Rollup> parseRollups(QString rollups);
+
+    const Rollup& getRollup(int index) const;
+
+    // Add a dataset, periods that are completed by it are appended to completedPoints
+    void add(int id, QString serialnumber, QByteArray zoneTag, const ParticleCounter::ArchiveDataset& archiveDataset, QList<RollupPoint>* completedPoints);
+
+    // Complete the periods of particle counters that did not deliver a dataset for one more interval after the period
+    void flushStale(qint64 nowMs, QList<RollupPoint>* completedPoints);
+
+    void remove(int id);
+
+private:
+    typedef struct {
+        qint64 period;      // Period number: timestamp / interval
+        quint32 samples;
+        quint64 sum[8];
+        quint32 max[8];
+    } Accumulator;
+
+    typedef struct {
+        QString serialnumber;
+        QByteArray zoneTag;
+        QVector<Accumulator> accumulators;  // One per rollup
+    } CounterState;
+
+    QList<Rollup> m_rollups;
+    ParticleCounterNormalization::CountFormat m_countFormat;
+    QHash<int, CounterState> m_counters;
+
+    void complete(int id, const CounterState& counterState, int rollupIndex, QList<RollupPoint>* completedPoints);
+    static void reset(Accumulator* accumulator, qint64 period);
+};
+
+#endif // PARTICLECOUNTERDOWNSAMPLER_H
@@ -0,0 +1,143 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "particlecounterhistory.h"
+
+static const char historyMagic[8] = {'P', 'C', 'H', 'I', 'S', 'T', '0', '1'};
+
+Q_STATIC_ASSERT(sizeof(ParticleCounterHistory::Record) == 64);
+Q_STATIC_ASSERT(sizeof(ParticleCounterHistory::Header) == 64);
+
+ParticleCounterHistory::ParticleCounterHistory(uchar *data, size_t size)
+{
+    m_data = data;
+    m_size = size;
+    m_header = reinterpret_cast<Header*>(data);
+    m_records = reinterpret_cast<Record*>(data + sizeof(Header));
+}
+
+ParticleCounterHistory::~ParticleCounterHistory()
+{
+    munmap(m_data, m_size);
+}
+
+QSharedPointer<ParticleCounterHistory> ParticleCounterHistory::open(QString filename, quint32 capacity, QString *error)
+{
+    size_t size = sizeof(Header) + (size_t)capacity * sizeof(Record);
+
+    int fd = ::open(filename.toLocal8Bit().constData(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        *error = "Unable to open " + filename + ": " + QString::fromLocal8Bit(strerror(errno));
+        return QSharedPointer<ParticleCounterHistory>();
+    }
+
+    struct stat fileStatus;
+    bool sizeOk = (fstat(fd, &fileStatus) == 0) && ((size_t)fileStatus.st_size == size);
+    if (!sizeOk && (ftruncate(fd, size) != 0))
+    {
+        *error = "Unable to resize " + filename + ": " + QString::fromLocal8Bit(strerror(errno));
+        ::close(fd);
+        return QSharedPointer<ParticleCounterHistory>();
+    }
+
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);    // The mapping stays valid, so no file descriptor is held per particle counter
+    if (data == MAP_FAILED)
+    {
+        *error = "Unable to map " + filename + ": " + QString::fromLocal8Bit(strerror(errno));
+        return QSharedPointer<ParticleCounterHistory>();
+    }
+
+    QSharedPointer<ParticleCounterHistory> history(new ParticleCounterHistory(static_cast<uchar*>(data), size));
+
+    Header* header = history->m_header;
+    if (!sizeOk || (memcmp(header->magic, historyMagic, sizeof(historyMagic)) != 0) ||
+        (header->recordSize != sizeof(Record)) || (header->capacity != capacity))
+    {
+        // New file or a different layout, start with an empty ring
+        memset(data, 0, size);
+        memcpy(header->magic, historyMagic, sizeof(historyMagic));
+        header->recordSize = sizeof(Record);
+        header->capacity = capacity;
+        header->writeCount = 0;
+    }
+
+    return history;
+}
+
+void ParticleCounterHistory::append(const ParticleCounter::ArchiveDataset &archiveDataset)
+{
+    if (m_header->capacity == 0)
+        return;
+
+    quint64 sequence = m_header->writeCount + 1;
+    Record* record = &m_records[(sequence - 1) % m_header->capacity];
+
+    __atomic_store_n(&record->sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    record->timestampMs = archiveDataset.timestamp.toMSecsSinceEpoch();
+    record->samplingTimeInSeconds = archiveDataset.samplingTimeInSeconds;
+    record->addupCount = archiveDataset.addupCount;
+    record->outputDataFormat = archiveDataset.outputDataFormat;
+    record->channelStatus = 0;
+    for (int ch=0; ch<8; ch++)
+    {
+        record->counts[ch] = archiveDataset.channelData[ch].count;
+        record->channelStatus |= (archiveDataset.channelData[ch].status & 0x03) << (2 * ch);
+    }
+
+    __atomic_store_n(&record->sequence, sequence, __ATOMIC_RELEASE);
+    __atomic_store_n(&m_header->writeCount, sequence, __ATOMIC_RELEASE);
+}
+
+quint32 ParticleCounterHistory::getCapacity() const
+{
+    return m_header->capacity;
+}
+
+quint64 ParticleCounterHistory::getWriteCount() const
+{
+    return __atomic_load_n(&m_header->writeCount, __ATOMIC_ACQUIRE);
+}
+
+bool ParticleCounterHistory::readRecord(quint64 sequence, Record *record) const
+{
+    if ((sequence == 0) || (m_header->capacity == 0))
+        return false;
+
+    const Record* source = &m_records[(sequence - 1) % m_header->capacity];
+    if (__atomic_load_n(&source->sequence, __ATOMIC_ACQUIRE) != sequence)
+        return false;
+
+    memcpy(record, source, sizeof(Record));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    // The writer may have started to overwrite the record while it was copied
+    return (__atomic_load_n(&source->sequence, __ATOMIC_RELAXED) == sequence);
+}
+
+ParticleCounter::ChannelStatus ParticleCounterHistory::channelStatus(const Record &record, int channel)
+{
+    return (ParticleCounter::ChannelStatus)((record.channelStatus >> (2 * channel)) & 0x03);
+}
@@ -0,0 +1,76 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#ifndef PARTICLECOUNTERHISTORY_H
+#define PARTICLECOUNTERHISTORY_H
+
+#include <QString>
+#include <QSharedPointer>
+#include "particlecounter.h"
+
+// Ring of the last archive datasets of a particle counter in a memory mapped file.
+// The records have a fixed binary layout, so the ring is used directly after a restart without any parse step.
+// There is one writer (the main thread), readers in other threads copy single records without locking:
+// A record is marked as incomplete while it is written and readers drop records that changed while they were copied.
+class ParticleCounterHistory
+{
+public:
+    typedef struct {
+        qint64 timestampMs;             // UTC milliseconds since epoch
+        quint32 counts[8];
+        quint16 samplingTimeInSeconds;
+        quint16 addupCount;
+        quint16 channelStatus;          // 2 bits per channel, channel 1 in the lowest bits
+        quint8 outputDataFormat;
+        quint8 reserved[9];
+        quint64 sequence;               // Number of the record counted from 1, 0 while the record is written
+    } Record;
+
+    typedef struct {
+        char magic[8];
+        quint32 recordSize;
+        quint32 capacity;
+        quint64 writeCount;             // Records written since the file was created, sequence of the newest record
+        quint8 reserved[40];
+    } Header;
+
+    ~ParticleCounterHistory();
+
+    // Maps the ring file, it is created or reset if it does not match the capacity. Returns a null pointer on errors.
+    static QSharedPointer<ParticleCounterHistory> open(QString filename, quint32 capacity, QString* error);
+
+    void append(const ParticleCounter::ArchiveDataset& archiveDataset);     // Only called by the main thread
+
+    quint32 getCapacity() const;
+    quint64 getWriteCount() const;
+
+    // Copy the record with the given sequence number. Returns false if it has been overwritten or is being written.
+    bool readRecord(quint64 sequence, Record* record) const;
+
+    static ParticleCounter::ChannelStatus channelStatus(const Record& record, int channel);     // channel 0..7
+
+private:
+    ParticleCounterHistory(uchar* data, size_t size);
+
+    uchar* m_data;
+    size_t m_size;
+    Header* m_header;
+    Record* m_records;
+};
+
+typedef QSharedPointer<ParticleCounterHistory> ParticleCounterHistoryPtr;
+
+#endif // PARTICLECOUNTERHISTORY_H
@@ -0,0 +1,273 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#include <QSettings>
+#include <QSet>
+#include <QPair>
+#include <QFile>
+#include <stdio.h>
+#include "particlecounterimport.h"
+
+bool ParticleCounterImport::parse(QString csv, int busCount, QList<Entry> *entries, QStringList *errors)
+{
+    QSet<int> ids;
+    QSet<QPair<int, int> > addresses;
+    QStringList keys = configKeys();
+    int lineNumber = 0;
+
+    entries->clear();
+
+    foreach (QString line, csv.split('\n'))
+    {
+        lineNumber++;
+        line = line.trimmed();
+        if (line.isEmpty() || line.startsWith('#') || line.startsWith("id", Qt::CaseInsensitive))
+            continue;
+
+        QString lineError = "Error[Import]: line " + QString().setNum(lineNumber) + ": ";
+        QStringList fields = line.split(',');
+        if ((fields.length() < 3) || (fields.length() > 4))
+        {
+            errors->append(lineError + "expected id,bus,unit[,config].");
+            continue;
+        }
+
+        bool idOk, busOk, unitOk;
+        Entry entry;
+        entry.lineNumber = lineNumber;
+        entry.id = fields.at(0).trimmed().toInt(&idOk);
+        entry.busID = fields.at(1).trimmed().toInt(&busOk);
+        entry.modbusAddress = fields.at(2).trimmed().toInt(&unitOk);
+
+        if (!idOk || (entry.id < 0))
+        {
+            errors->append(lineError + "id can not be parsed.");
+            continue;
+        }
+        if (!busOk || (entry.busID < 0) || ((busCount >= 0) && (entry.busID >= busCount)))
+        {
+            errors->append(lineError + "bus " + fields.at(1).trimmed() + " is not configured.");
+            continue;
+        }
+        if (!unitOk || (entry.modbusAddress < 1) || (entry.modbusAddress > 247))
+        {
+            errors->append(lineError + "unit must be a modbus address from 1 to 247.");
+            continue;
+        }
+
+        if (fields.length() == 4)
+        {
+            bool configOk = true;
+            foreach (QString pair, fields.at(3).split(';', QString::SkipEmptyParts))
+            {
+                QStringList keyValue = pair.trimmed().split('=');
+                bool valueOk = false;
+                if (keyValue.length() == 2)
+                {
+                    if (keyValue.at(0) == "zone")
+                        valueOk = !keyValue.at(1).trimmed().isEmpty();     // Any name
+                    else
+                        keyValue.at(1).toInt(&valueOk);
+                }
+                if (!valueOk || !keys.contains(keyValue.at(0)))
+                {
+                    errors->append(lineError + "config \"" + pair.trimmed() + "\" is invalid, allowed keys are " + keys.join(", ") + ".");
+                    configOk = false;
+                    break;
+                }
+                entry.config.insert(keyValue.at(0), keyValue.at(1));
+            }
+            if (!configOk)
+                continue;
+        }
+
+        if (ids.contains(entry.id))
+        {
+            errors->append(lineError + "id " + QString().setNum(entry.id) + " is used twice.");
+            continue;
+        }
+        QPair<int, int> address(entry.busID, entry.modbusAddress);
+        if (addresses.contains(address))
+        {
+            errors->append(lineError + "unit " + QString().setNum(entry.modbusAddress) + " on bus " + QString().setNum(entry.busID) + " is used twice.");
+            continue;
+        }
+
+        ids.insert(entry.id);
+        addresses.insert(address);
+        entries->append(entry);
+    }
+
+    if (entries->isEmpty() && errors->isEmpty())
+        errors->append("Error[Import]: no particle counters found.");
+
+    return errors->isEmpty();
+}
+
+bool ParticleCounterImport::validateAgainst(const QList<Entry> &entries, const QList<ParticleCounter *> &existing, QStringList *errors)
+{
+    QMap<int, int> existingIDs;     // id -> bus
+    QSet<QPair<int, int> > existingAddresses;
+
+    foreach (ParticleCounter* pc, existing)
+    {
+        existingIDs.insert(pc->getId(), pc->getBusID());
+        existingAddresses.insert(QPair<int, int>(pc->getBusID(), pc->getModbusAddress()));
+    }
+
+    foreach (const Entry& entry, entries)
+    {
+        QString lineError = "Error[Import]: ";
+        if (entry.lineNumber > 0)
+            lineError += "line " + QString().setNum(entry.lineNumber) + ": ";
+        if (existingIDs.contains(entry.id))
+            errors->append(lineError + "id " + QString().setNum(entry.id) + " already exists.");
+        else if (existingAddresses.contains(QPair<int, int>(entry.busID, entry.modbusAddress)))
+            errors->append(lineError + "unit " + QString().setNum(entry.modbusAddress) + " on bus " + QString().setNum(entry.busID) + " is already used.");
+    }
+
+    return errors->isEmpty();
+}
+
+bool ParticleCounterImport::createParticleCounters(const QList<Entry> &entries, QObject *parent, ParticleCounterModbusSystem *pcModbusSystem, Loghandler *loghandler,
+                                                   ParticleCounterRegistry *registry, int defaultLiveCountsIntervalInSeconds, QList<ParticleCounter *> *created, QString *error)
+{
+    QList<ParticleCounter*> particleCounters;
+    particleCounters.reserve(entries.size());
+
+    // Set up all particle counters first, autosave is off so nothing is written yet
+    foreach (const Entry& entry, entries)
+    {
+        ParticleCounter* newPc = new ParticleCounter(parent, pcModbusSystem, loghandler);
+        newPc->setRegistry(registry);
+        newPc->setId(entry.id);
+        newPc->setBusID(entry.busID);
+        newPc->setModbusAddress(entry.modbusAddress);
+        newPc->setLiveCountsInterval(defaultLiveCountsIntervalInSeconds);
+        foreach (QString key, entry.config.keys())
+        {
+            newPc->setData(key, entry.config.value(key));
+        }
+        particleCounters.append(newPc);
+    }
+
+    // Then write all of them in one batch
+    QList<QPair<int, QString> > records;
+    records.reserve(particleCounters.size());
+    foreach (ParticleCounter* pc, particleCounters)
+    {
+        records.append(QPair<int, QString>(pc->getId(), pc->toConfigLine()));
+    }
+
+    if (!registry->putBatch(records))
+    {
+        *error = "Error[Import]: Unable to write " + registry->getFilename() + ", nothing imported.";
+        qDeleteAll(particleCounters);
+        return false;
+    }
+
+    foreach (ParticleCounter* pc, particleCounters)
+    {
+        pc->markAsSaved();
+    }
+
+    *created = particleCounters;
+    return true;
+}
+
+QStringList ParticleCounterImport::configKeys()
+{
+    QStringList keys;
+    keys += "liveCountsIntervalInSeconds";
+    keys += "archiveAcquisitionEnabled";
+    keys += "zone";
+    return keys;
+}
+
+int ParticleCounterImport::importOffline(QString filename, bool dryRun)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        fprintf(stderr, "Error[Import]: file %s can not be read.\n", filename.toUtf8().data());
+        return 1;
+    }
+    QString csv = QString::fromUtf8(file.readAll());
+    file.close();
+
+    // Particle counters that already exist, they are only loaded from the registry and never touch a bus
+    ParticleCounterRegistry registry(nullptr, "/var/openffucontrol/particlecounters/");
+    QList<QString> configs;
+    QString error;
+    if (!registry.open(&configs, &error))
+    {
+        fprintf(stderr, "Error[Import]: %s\n", error.toUtf8().data());
+        return 1;
+    }
+
+    QList<ParticleCounter*> existing;
+    foreach (QString config, configs)
+    {
+        ParticleCounter* pc = new ParticleCounter(nullptr, nullptr, nullptr);
+        pc->fromConfigLine(config);
+        existing.append(pc);
+    }
+
+    QList<Entry> entries;
+    QStringList errors;
+    bool valid = parse(csv, configuredBusCount(), &entries, &errors) && validateAgainst(entries, existing, &errors);
+    qDeleteAll(existing);
+
+    if (!valid)
+    {
+        fprintf(stderr, "%s\nError[Import]: Import aborted, nothing imported.\n", errors.join("\n").toUtf8().data());
+        return 1;
+    }
+
+    if (dryRun)
+    {
+        fprintf(stdout, "OK[Import]: %i particle counters are valid, nothing imported (dry run).\n", entries.size());
+        return 0;
+    }
+
+    QSettings settings("/etc/openffucontrol/particleserver/config.ini", QSettings::IniFormat);
+    settings.beginGroup("interfacesParticleCounterModBus");
+
+    QList<ParticleCounter*> created;
+    if (!createParticleCounters(entries, nullptr, nullptr, nullptr, &registry, settings.value("liveCountsIntervalInSeconds", 0).toInt(), &created, &error))
+    {
+        fprintf(stderr, "%s\n", error.toUtf8().data());
+        return 1;
+    }
+    qDeleteAll(created);
+
+    fprintf(stdout, "OK[Import]: Imported %i particle counters, they are initialized at the next start of the daemon.\n", entries.size());
+    return 0;
+}
+
+int ParticleCounterImport::configuredBusCount()
+{
+    QSettings settings("/etc/openffucontrol/particleserver/config.ini", QSettings::IniFormat);
+    settings.beginGroup("interfacesParticleCounterModBus");
+
+    int busCount = 0;
+    foreach (QString key, settings.childKeys())
+    {
+        if (key.startsWith("pcmodbus"))
+            busCount++;
+    }
+    return busCount;
+}
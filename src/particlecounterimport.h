@@ -0,0 +1,67 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#ifndef PARTICLECOUNTERIMPORT_H
+#define PARTICLECOUNTERIMPORT_H
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QMap>
+#include "particlecounter.h"
+
+// Bulk provisioning of particle counters from a csv file.
+// This is used by the import command of the terminal and by the offline import of the commandline (--import).
+//
+// Format, one particle counter per line:
+// id,bus,unit[,config]
+// config is an optional list of key=value pairs separated by ';', e.g. liveCountsIntervalInSeconds=10;archiveAcquisitionEnabled=0
+// Empty lines, lines starting with '#' and a header line starting with "id" are ignored.
+class ParticleCounterImport
+{
+public:
+    typedef struct {
+        int lineNumber;
+        int id;
+        int busID;
+        int modbusAddress;
+        QMap<QString, QString> config;
+    } Entry;
+
+    // Parse and validate csv data. busCount is the number of configured buses, -1 skips the bus check.
+    // Returns false and error messages if any line is invalid, nothing should be imported in this case.
+    static bool parse(QString csv, int busCount, QList<Entry>* entries, QStringList* errors);
+
+    // Check the entries against the particle counters that already exist, entries with lineNumber 0 are reported without line
+    static bool validateAgainst(const QList<Entry>& entries, const QList<ParticleCounter*>& existing, QStringList* errors);
+
+    // Create all particle counters of the entries and write them to the registry in one batch.
+    // If the registry can not be written, no particle counter is created.
+    static bool createParticleCounters(const QList<Entry>& entries, QObject* parent, ParticleCounterModbusSystem* pcModbusSystem, Loghandler* loghandler,
+                                       ParticleCounterRegistry* registry, int defaultLiveCountsIntervalInSeconds, QList<ParticleCounter*>* created, QString* error);
+
+    // Keys that may be given in the config column, they are applied by ParticleCounter::setData()
+    static QStringList configKeys();
+
+    // Number of buses configured in config.ini, used by the offline import
+    static int configuredBusCount();
+
+    // Import a csv file directly into the particle counter registry while the daemon is stopped.
+    // The particle counters are initialized at the next start of the daemon. Returns the exit code of the program.
+    static int importOffline(QString filename, bool dryRun);
+};
+
+#endif // PARTICLECOUNTERIMPORT_H
@@ -0,0 +1,219 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#include <QSettings>
+#include "particlecounterinitscheduler.h"
+
+ParticleCounterInitScheduler::ParticleCounterInitScheduler(QObject *parent, ParticleCounterModbusSystem *pcModbusSystem, Loghandler *loghandler) : QObject(parent)
+{
+    m_pcModbusSystem = pcModbusSystem;
+    m_loghandler = loghandler;
+    m_nextBusIndex = 0;
+
+    m_batchSize = 0;
+    m_failedInits = 0;
+    m_timeToAllOnlineMs = -1;
+
+    QSettings settings("/etc/openffucontrol/particleserver/config.ini", QSettings::IniFormat);
+    settings.beginGroup("interfacesParticleCounterModBus");
+    m_maxQueuedTelegrams = settings.value("initMaxQueuedTelegrams", 40).toInt();
+    m_retryIntervalInSeconds = settings.value("initRetryIntervalInSeconds", 60).toInt();
+
+    connect(&m_timer, &QTimer::timeout, this, &ParticleCounterInitScheduler::slot_timer_fired);
+    m_timer.setInterval(settings.value("initIntervalMs", 500).toInt());
+}
+
+void ParticleCounterInitScheduler::enqueue(ParticleCounter *pc, bool highPriority)
+{
+    if (isScheduled(pc) || m_running.contains(pc))
+        return;
+
+    if (isIdle())
+    {
+        // A new batch starts
+        m_batchTimer.start();
+        m_batchSize = 0;
+        m_batchWaiting.clear();
+        m_failedInits = 0;
+        m_timeToAllOnlineMs = -1;
+    }
+
+    connect(pc, &ParticleCounter::signal_initFinished, this, &ParticleCounterInitScheduler::slot_initFinished, Qt::UniqueConnection);
+
+    QueueEntry entry;
+    entry.pc = pc;
+    if (highPriority)
+        m_queues[pc->getBusID()].prepend(entry);
+    else
+        m_queues[pc->getBusID()].append(entry);
+    m_queued.insert(pc);
+
+    if (!m_batchWaiting.contains(pc))
+    {
+        m_batchWaiting.insert(pc);
+        m_batchSize++;
+    }
+
+    if (!m_timer.isActive())
+        m_timer.start();
+}
+
+void ParticleCounterInitScheduler::remove(ParticleCounter *pc)
+{
+    disconnect(pc, &ParticleCounter::signal_initFinished, this, &ParticleCounterInitScheduler::slot_initFinished);
+
+    if (m_queued.remove(pc))
+    {
+        QMutableMapIterator<int, QList<QueueEntry> > iterator(m_queues);
+        while (iterator.hasNext())
+        {
+            iterator.next();
+            QMutableListIterator<QueueEntry> entryIterator(iterator.value());
+            while (entryIterator.hasNext())
+            {
+                if (entryIterator.next().pc == pc)
+                    entryIterator.remove();
+            }
+            if (iterator.value().isEmpty())
+                iterator.remove();
+        }
+    }
+
+    if (m_running.contains(pc))
+        m_runningTelegrams[pc->getBusID()] -= m_running.take(pc);
+
+    if (m_batchWaiting.remove(pc))
+        m_batchSize--;
+}
+
+bool ParticleCounterInitScheduler::isScheduled(ParticleCounter *pc) const
+{
+    return m_queued.contains(pc);
+}
+
+int ParticleCounterInitScheduler::getSizeOfQueue() const
+{
+    int size = 0;
+    foreach (const QList<QueueEntry>& queue, m_queues)
+    {
+        size += queue.size();
+    }
+    return size;
+}
+
+ParticleCounterInitScheduler::Status ParticleCounterInitScheduler::getStatus() const
+{
+    Status status;
+    status.pending = getSizeOfQueue();
+    status.running = m_running.size();
+    status.batchSize = m_batchSize;
+    status.batchInitialized = m_batchSize - m_batchWaiting.size();
+    status.failedInits = m_failedInits;
+    status.timeToAllOnlineMs = m_timeToAllOnlineMs;
+    return status;
+}
+
+bool ParticleCounterInitScheduler::isIdle() const
+{
+    return (m_queues.isEmpty() && m_running.isEmpty());
+}
+
+bool ParticleCounterInitScheduler::startNextInit(int busID)
+{
+    if (m_runningTelegrams.value(busID) >= m_maxQueuedTelegrams)
+        return false;
+
+    QList<QueueEntry>& queue = m_queues[busID];
+    QDateTime now = QDateTime::currentDateTime();
+
+    for (int i = 0; i < queue.size(); i++)
+    {
+        if (queue.at(i).notBefore.isValid() && (queue.at(i).notBefore > now))
+            continue;   // Retry is not due yet
+
+        ParticleCounter* pc = queue.takeAt(i).pc;
+        m_queued.remove(pc);
+        int telegramCount = pc->init();
+        if (telegramCount > 0)
+        {
+            m_running.insert(pc, telegramCount);
+            m_runningTelegrams[busID] += telegramCount;
+        }
+        else
+        {
+            // Nothing could be sent (e.g. bus not available), try again later
+            slot_initFinished(pc, false);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+void ParticleCounterInitScheduler::slot_timer_fired()
+{
+    // Round robin over the buses with at most one new init per bus and cycle, the start rotates each cycle
+    QList<int> busIDs = m_queues.keys();
+    if (!busIDs.isEmpty())
+    {
+        m_nextBusIndex = m_nextBusIndex % busIDs.size();
+        for (int i = 0; i < busIDs.size(); i++)
+        {
+            startNextInit(busIDs.at((m_nextBusIndex + i) % busIDs.size()));
+        }
+        m_nextBusIndex++;
+    }
+
+    QMutableMapIterator<int, QList<QueueEntry> > iterator(m_queues);
+    while (iterator.hasNext())
+    {
+        if (iterator.next().value().isEmpty())
+            iterator.remove();
+    }
+
+    if (isIdle())
+        m_timer.stop();
+}
+
+void ParticleCounterInitScheduler::slot_initFinished(ParticleCounter *pc, bool success)
+{
+    if (m_running.contains(pc))
+        m_runningTelegrams[pc->getBusID()] -= m_running.take(pc);
+
+    if (!success)
+    {
+        m_failedInits++;
+        QueueEntry entry;
+        entry.pc = pc;
+        entry.notBefore = QDateTime::currentDateTime().addSecs(m_retryIntervalInSeconds);
+        m_queues[pc->getBusID()].append(entry);
+        m_queued.insert(pc);
+        if (!m_timer.isActive())
+            m_timer.start();
+        return;
+    }
+
+    if (m_batchWaiting.remove(pc) && m_batchWaiting.isEmpty())
+    {
+        m_timeToAllOnlineMs = m_batchTimer.elapsed();
+        m_loghandler->slot_newEntry(LogEntry::Info, "ParticleCounterInitScheduler",
+                                    QString().sprintf("All %i particle counters online after %.1f s, %i inits were retried.",
+                                                      m_batchSize, m_timeToAllOnlineMs / 1000.0, m_failedInits));
+    }
+
+    // Use the free capacity of the bus right away
+    startNextInit(pc->getBusID());
+}
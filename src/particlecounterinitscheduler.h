@@ -0,0 +1,89 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#ifndef PARTICLECOUNTERINITSCHEDULER_H
+#define PARTICLECOUNTERINITSCHEDULER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QMap>
+#include <QSet>
+#include <QList>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include "particlecountermodbussystem.h"
+#include "particlecounter.h"
+#include "loghandler.h"
+
+// Initialization of many particle counters (at startup or after an import) is spread over time instead of sending
+// all init telegrams at once. Buses are served round robin and the number of queued init telegrams per bus is capped.
+// A particle counter whose init was not answered is retried later.
+class ParticleCounterInitScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    typedef struct {
+        int pending;                // Waiting for their init (including retries)
+        int running;                // Init telegrams are queued at the bus
+        int batchSize;              // Particle counters scheduled since the scheduler was idle the last time
+        int batchInitialized;       // Particle counters of the batch that answered their init
+        int failedInits;            // Inits of the batch that were not answered
+        qint64 timeToAllOnlineMs;   // Time from the start of the batch until all of its particle counters answered, -1 if still running
+    } Status;
+
+    explicit ParticleCounterInitScheduler(QObject *parent, ParticleCounterModbusSystem* pcModbusSystem, Loghandler* loghandler);
+
+    // High priority particle counters (e.g. added by an operator) are initialized before the others of their bus
+    void enqueue(ParticleCounter* pc, bool highPriority = false);
+    void remove(ParticleCounter* pc);   // Must be called before a scheduled particle counter is deleted
+
+    bool isScheduled(ParticleCounter* pc) const;    // Waiting for its init or its retry
+    int getSizeOfQueue() const;
+    Status getStatus() const;
+
+private:
+    typedef struct {
+        ParticleCounter* pc;
+        QDateTime notBefore;    // Retries are delayed
+    } QueueEntry;
+
+    ParticleCounterModbusSystem* m_pcModbusSystem;
+    Loghandler* m_loghandler;
+    QMap<int, QList<QueueEntry> > m_queues;     // busID -> particle counters waiting for init
+    QSet<ParticleCounter*> m_queued;            // Particle counters of all queues, isScheduled() is called for each counter by every poll cycle
+    QMap<ParticleCounter*, int> m_running;      // Particle counter -> number of its init telegrams
+    QMap<int, int> m_runningTelegrams;          // busID -> init telegrams queued at the bus
+    int m_nextBusIndex;                         // Round robin start of the next cycle
+    QTimer m_timer;
+    int m_maxQueuedTelegrams;
+    int m_retryIntervalInSeconds;
+
+    // Time to all online metric
+    QElapsedTimer m_batchTimer;
+    int m_batchSize;
+    QSet<ParticleCounter*> m_batchWaiting;      // Particle counters of the batch that did not answer their init yet
+    int m_failedInits;
+    qint64 m_timeToAllOnlineMs;
+
+    bool isIdle() const;
+    bool startNextInit(int busID);
+
+private slots:
+    void slot_timer_fired();
+    void slot_initFinished(ParticleCounter* pc, bool success);
+};
+
+#endif // PARTICLECOUNTERINITSCHEDULER_H
@@ -20,6 +20,8 @@ ParticleCounterModbusSystem::ParticleCounterModbusSystem(QObject *parent, Loghan
 {
     m_loghandler = loghandler;
 
+    qRegisterMetaType<ModbusRegisterResponsePtr>("ModbusRegisterResponsePtr");
+
     QSettings settings("/etc/openffucontrol/particleserver/config.ini", QSettings::IniFormat);
     settings.beginGroup("interfacesParticleCounterModBus");
 
@@ -132,14 +134,27 @@ void ParticleCounterModbusSystem::slot_transactionFinished()
 #endif
 }
 
-void ParticleCounterModbusSystem::slot_holdingRegistersRead(quint64 telegramID, quint8 slaveAddress, quint16 dataStartAddress, QList<quint16> data)
+void ParticleCounterModbusSystem::publishRegisterResponse(ModbusRegisterType registerType, quint64 telegramID, quint8 slaveAddress, quint16 dataStartAddress, const QList<quint16> &data)
 {
-    emit signal_receivedHoldingRegisterData(telegramID, slaveAddress, dataStartAddress, data);
+    // The register list is implicitly shared, so wrapping it here does not copy the payload.
+    // From now on only the reference counted response is handed to the host.
+    ModbusRegisterResponse* response = new ModbusRegisterResponse;
+    response->registerType = registerType;
+    response->busID = m_pcModbuslist.indexOf(qobject_cast<ModBus*>(sender()));
+    response->telegramID = telegramID;
+    response->slaveAddress = slaveAddress;
+    response->dataStartAddress = dataStartAddress;
+    response->data = data;
+
+    emit signal_receivedRegisterData(ModbusRegisterResponsePtr(response));
+}
 
+void ParticleCounterModbusSystem::slot_holdingRegistersRead(quint64 telegramID, quint8 slaveAddress, quint16 dataStartAddress, QList<quint16> data)
+{
+    publishRegisterResponse(ModbusHoldingRegister, telegramID, slaveAddress, dataStartAddress, data);
 }
 
 void ParticleCounterModbusSystem::slot_inputRegistersRead(quint64 telegramID, quint8 slaveAddress, quint16 dataStartAddress, QList<quint16> data)
 {
-    emit signal_receivedInputRegisterData(telegramID, slaveAddress, dataStartAddress, data);
-
+    publishRegisterResponse(ModbusInputRegister, telegramID, slaveAddress, dataStartAddress, data);
 }
@@ -20,10 +20,31 @@
 #include <QObject>
 #include <QThread>
 #include <QSettings>
+#include <QSharedPointer>
 #include "loghandler.h"
 //#include "ocumodbus.h"
 #include <libopenffucontrol-qtmodbus/modbus.h>
 
+typedef enum {
+    ModbusHoldingRegister,
+    ModbusInputRegister
+} ModbusRegisterType;
+
+// One register response of the bus. It is allocated once when the bus reports the response and
+// then only passed around by reference count until the owning particle counter has decoded it.
+typedef struct {
+    ModbusRegisterType registerType;
+    int busID;
+    quint64 telegramID;
+    quint8 slaveAddress;
+    quint16 dataStartAddress;
+    QList<quint16> data;
+} ModbusRegisterResponse;
+
+typedef QSharedPointer<const ModbusRegisterResponse> ModbusRegisterResponsePtr;
+
+Q_DECLARE_METATYPE(ModbusRegisterResponsePtr)
+
 class ParticleCounterModbusSystem : public QObject
 {
     Q_OBJECT
@@ -44,13 +65,14 @@ private:
     Loghandler* m_loghandler;
     QList<ModBus*> m_pcModbuslist;
 
+    void publishRegisterResponse(ModbusRegisterType registerType, quint64 telegramID, quint8 slaveAddress, quint16 dataStartAddress, const QList<quint16> &data);
+
 signals:
 
     // Incoming signals from bus, routed to host
     void signal_transactionLost(quint64 telegramID);
     void signal_transactionFinished();
-    void signal_receivedHoldingRegisterData(quint64 telegramID, quint16 adr, quint16 reg, QList<quint16> data);
-    void signal_receivedInputRegisterData(quint64 telegramID, quint16 adr, quint16 reg, QList<quint16> data);
+    void signal_receivedRegisterData(ModbusRegisterResponsePtr response);
 
     // Log output signals
     void signal_newEntry(LogEntry::LoggingCategory loggingCategory, QString module, QString text);
@@ -0,0 +1,81 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#include "particlecounternormalization.h"
+
+bool ParticleCounterNormalization::parseCountFormat(QString name, CountFormat *format)
+{
+    if (name == "asDelivered")
+        *format = AS_DELIVERED;
+    else if (name == "cumulative")
+        *format = CUMULATIVE;
+    else if (name == "distributive")
+        *format = DISTRIBUTIVE;
+    else if (name == "both")
+        *format = BOTH;
+    else if (name == "concentration")
+        *format = CONCENTRATION;
+    else
+        return false;
+
+    return true;
+}
+
+void ParticleCounterNormalization::normalize(const quint32 counts[8], bool cumulativeInput, Counts *normalized)
+{
+    // Both conversions are computed and the input is blended in with a mask, all ones if the input is cumulative
+    const quint32 mask = 0u - (quint32)cumulativeInput;
+
+    quint32 suffixSum[8];
+    quint32 running = 0;
+    for (int ch=7; ch>=0; ch--)
+    {
+        running += counts[ch];
+        suffixSum[ch] = running;
+    }
+
+    quint32 difference[8];
+    for (int ch=0; ch<7; ch++)
+    {
+        qint64 d = (qint64)counts[ch] - (qint64)counts[ch + 1];
+        difference[ch] = (quint32)(d & ~(d >> 63));     // Negative differences are clamped to 0
+    }
+    difference[7] = counts[7];
+
+    for (int ch=0; ch<8; ch++)
+    {
+        normalized->cumulative[ch] = (counts[ch] & mask) | (suffixSum[ch] & ~mask);
+        normalized->distributive[ch] = (difference[ch] & mask) | (counts[ch] & ~mask);
+    }
+}
+
+void ParticleCounterNormalization::concentrations(const quint32 cumulative[8], double sampledVolumeInCubicMeters, double concentrations[8])
+{
+    double scale = (sampledVolumeInCubicMeters > 0) ? (1.0 / sampledVolumeInCubicMeters) : 0;
+    for (int ch=0; ch<8; ch++)
+    {
+        concentrations[ch] = cumulative[ch] * scale;
+    }
+}
+
+const quint32 *ParticleCounterNormalization::selectCounts(const quint32 counts[8], const Counts &normalized, CountFormat format)
+{
+    if (format == CUMULATIVE)
+        return normalized.cumulative;
+    if (format == DISTRIBUTIVE)
+        return normalized.distributive;
+    return counts;
+}
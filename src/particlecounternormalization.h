@@ -0,0 +1,57 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#ifndef PARTICLECOUNTERNORMALIZATION_H
+#define PARTICLECOUNTERNORMALIZATION_H
+
+#include <QtGlobal>
+#include <QString>
+
+// Conversion of the eight channel counts of a dataset between the output data formats of the particle counters.
+// Cumulative channels count all particles >= their size, distributive channels the particles between their size and the size of the next channel.
+// The kernel does not depend on the particle counter classes, so it is also used by tools/normalization-benchmark.
+class ParticleCounterNormalization
+{
+public:
+    // Values written by a sink: the counts as delivered, converted to one format, both formats or the concentration per m³
+    typedef enum {
+        AS_DELIVERED = 0,
+        CUMULATIVE = 1,
+        DISTRIBUTIVE = 2,
+        BOTH = 3,
+        CONCENTRATION = 4
+    } CountFormat;
+
+    typedef struct {
+        quint32 cumulative[8];
+        quint32 distributive[8];
+    } Counts;
+
+    // Names as used in config.ini: asDelivered, cumulative, distributive, both, concentration
+    static bool parseCountFormat(QString name, CountFormat* format);
+
+    // Compute both formats with a suffix sum and the differences of neighbouring channels without data dependent branches.
+    // Decreasing cumulative counts (counting noise) give a distributive count of 0.
+    static void normalize(const quint32 counts[8], bool cumulativeInput, Counts* normalized);
+
+    // Cumulative particles per m³
+    static void concentrations(const quint32 cumulative[8], double sampledVolumeInCubicMeters, double concentrations[8]);
+
+    // Counts of a format that can be accumulated (AS_DELIVERED, CUMULATIVE or DISTRIBUTIVE), counts as delivered for the other formats
+    static const quint32* selectCounts(const quint32 counts[8], const Counts& normalized, CountFormat format);
+};
+
+#endif // PARTICLECOUNTERNORMALIZATION_H
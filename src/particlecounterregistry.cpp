@@ -0,0 +1,275 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#include <QDir>
+#include <QDirIterator>
+#include <QSaveFile>
+#include <QStringList>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include "particlecounterregistry.h"
+
+ParticleCounterRegistry::ParticleCounterRegistry(QObject *parent, QString directory) : QObject(parent)
+{
+    if (!directory.endsWith("/"))
+        directory.append("/");
+    m_directory = directory;
+    m_filename = directory + "particlecounters.journal";
+    m_journalRecordCount = 0;
+    m_lockFd = -1;
+}
+
+ParticleCounterRegistry::~ParticleCounterRegistry()
+{
+    m_journal.close();
+    if (m_lockFd >= 0)
+        ::close(m_lockFd);     // Releases the lock
+}
+
+bool ParticleCounterRegistry::open(QList<QString> *configs, QString *error, bool waitForLock)
+{
+    QDir dir;
+    dir.mkpath(m_directory);
+
+    if (m_lockFd < 0)
+    {
+        QString lockFilename = m_directory + "particlecounters.lock";
+        m_lockFd = ::open(lockFilename.toLocal8Bit().constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (m_lockFd < 0)
+        {
+            *error = "Unable to open " + lockFilename;
+            return false;
+        }
+        if (flock(m_lockFd, waitForLock ? LOCK_EX : (LOCK_EX | LOCK_NB)) != 0)
+        {
+            ::close(m_lockFd);
+            m_lockFd = -1;
+            *error = "Registry " + m_filename + " is in use by another process, stop the daemon first.";
+            return false;
+        }
+    }
+
+    m_configs.clear();
+    m_journalRecordCount = 0;
+    bool incompleteRecord = false;
+    bool csvFilesImported = false;
+
+    QFile file(m_filename);
+    if (!file.exists())
+    {
+        importCsvFiles();
+        csvFilesImported = true;
+    }
+    else if (!file.open(QIODevice::ReadOnly))
+    {
+        *error = "Unable to read " + m_filename + ": " + file.errorString();
+        return false;
+    }
+    else
+    {
+        QByteArray data = file.readAll();
+        file.close();
+
+        int start = 0;
+        while (start < data.size())
+        {
+            int end = data.indexOf('\n', start);
+            if (end < 0)
+            {
+                incompleteRecord = true;    // Interrupted append, the record is lost
+                break;
+            }
+
+            QString line = QString::fromUtf8(data.constData() + start, end - start);
+            start = end + 1;
+
+            if (line.isEmpty() || line.startsWith('#'))
+                continue;
+
+            QStringList fields = line.split(' ');
+            bool ok = false;
+            int id = fields.value(1).toInt(&ok);
+            if (!ok)
+                continue;
+
+            if ((fields.at(0) == "P") && (fields.size() >= 3))
+                m_configs.insert(id, line.section(' ', 2));
+            else if (fields.at(0) == "D")
+                m_configs.remove(id);
+            m_journalRecordCount++;
+        }
+    }
+
+    // Start with a clean journal if there are outdated or incomplete records
+    if (csvFilesImported || incompleteRecord || (m_journalRecordCount > m_configs.size()))
+    {
+        if (!compact())
+        {
+            *error = "Unable to write " + m_filename;
+            return false;
+        }
+    }
+    else if (!openJournalForAppend())
+    {
+        *error = "Unable to open " + m_filename + " for writing: " + m_journal.errorString();
+        return false;
+    }
+
+    // The csv files are renamed after the journal has been written, so they are imported again if that fails
+    if (csvFilesImported)
+    {
+        QDirIterator iterator(m_directory, QStringList() << "particlecounter-*.csv", QDir::Files, QDirIterator::NoIteratorFlags);
+        while (iterator.hasNext())
+        {
+            QString filename = iterator.next();
+            QFile::rename(filename, filename + ".imported");
+        }
+    }
+
+    *configs = m_configs.values();
+    return true;
+}
+
+bool ParticleCounterRegistry::put(int id, QString config)
+{
+    if (!append(putRecord(id, config), 1))
+        return false;
+
+    m_configs.insert(id, config);
+    compactIfNeeded();
+    return true;
+}
+
+bool ParticleCounterRegistry::putBatch(const QList<QPair<int, QString> > &records)
+{
+    QByteArray data;
+    for (int i = 0; i < records.size(); i++)
+    {
+        data.append(putRecord(records.at(i).first, records.at(i).second));
+    }
+
+    if (!append(data, records.size()))
+        return false;
+
+    for (int i = 0; i < records.size(); i++)
+    {
+        m_configs.insert(records.at(i).first, records.at(i).second);
+    }
+    compactIfNeeded();
+    return true;
+}
+
+bool ParticleCounterRegistry::remove(int id)
+{
+    if (!m_configs.contains(id))
+        return true;
+
+    if (!append(QString().sprintf("D %i\n", id).toUtf8(), 1))
+        return false;
+
+    m_configs.remove(id);
+    compactIfNeeded();
+    return true;
+}
+
+bool ParticleCounterRegistry::compact()
+{
+    QSaveFile file(m_filename);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    file.write("# openffucontrol-particleserver particle counter registry\n");
+    QMapIterator<int, QString> iterator(m_configs);
+    while (iterator.hasNext())
+    {
+        iterator.next();
+        file.write(putRecord(iterator.key(), iterator.value()));
+    }
+
+    // The new file is synced and renamed over the journal, so the old journal stays valid if this fails
+    m_journal.close();
+    bool ok = file.commit();
+    if (ok)
+        m_journalRecordCount = m_configs.size();
+
+    return (openJournalForAppend() && ok);
+}
+
+QString ParticleCounterRegistry::getFilename() const
+{
+    return m_filename;
+}
+
+bool ParticleCounterRegistry::append(const QByteArray &data, int recordCount)
+{
+    if (!m_journal.isOpen() && !openJournalForAppend())
+        return false;
+
+    qint64 size = m_journal.size();
+    if ((m_journal.write(data) != data.size()) || !m_journal.flush() || (fsync(m_journal.handle()) != 0))
+    {
+        m_journal.resize(size);     // Do not leave a partial record behind
+        return false;
+    }
+
+    m_journalRecordCount += recordCount;
+    return true;
+}
+
+void ParticleCounterRegistry::compactIfNeeded()
+{
+    if (m_journalRecordCount > (2 * m_configs.size() + 100))
+        compact();
+}
+
+bool ParticleCounterRegistry::openJournalForAppend()
+{
+    m_journal.close();
+    m_journal.setFileName(m_filename);
+    return m_journal.open(QIODevice::WriteOnly | QIODevice::Append);
+}
+
+void ParticleCounterRegistry::importCsvFiles()
+{
+    // Particle counter files of older versions: particlecounter-NNNNNN.csv with the config in the first line
+    QDirIterator iterator(m_directory, QStringList() << "particlecounter-*.csv", QDir::Files, QDirIterator::NoIteratorFlags);
+    while (iterator.hasNext())
+    {
+        QFile file(iterator.next());
+        if (!file.open(QIODevice::ReadOnly))
+            continue;
+        QString config = QString::fromUtf8(file.readLine()).trimmed();
+        file.close();
+
+        foreach (QString pair, config.split(' '))
+        {
+            if (pair.startsWith("id="))
+            {
+                bool ok;
+                int id = pair.mid(3).toInt(&ok);
+                if (ok)
+                    m_configs.insert(id, config);
+                break;
+            }
+        }
+    }
+}
+
+QByteArray ParticleCounterRegistry::putRecord(int id, const QString &config)
+{
+    return ("P " + QString().setNum(id) + " " + config + "\n").toUtf8();
+}
@@ -0,0 +1,72 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#ifndef PARTICLECOUNTERREGISTRY_H
+#define PARTICLECOUNTERREGISTRY_H
+
+#include <QObject>
+#include <QString>
+#include <QList>
+#include <QPair>
+#include <QMap>
+#include <QFile>
+
+// Persistent configuration of all particle counters in a single journal file.
+// Each change of a particle counter is appended as one record and synced to disk, so a crash can only lose the
+// record that was being written. The journal is compacted from time to time: All valid records are written to a
+// new file that atomically replaces the journal.
+//
+// Format, one record per line:
+// P <id> <config>      Put the config of a particle counter (key=value pairs as written by ParticleCounter::toConfigLine())
+// D <id>               Delete a particle counter
+// Lines starting with '#' are comments. A last line without newline is an incomplete record and is ignored.
+class ParticleCounterRegistry : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ParticleCounterRegistry(QObject *parent, QString directory);
+    ~ParticleCounterRegistry();
+
+    // Read the journal. The particle counter csv files of older versions are imported if there is no journal yet.
+    // Returns the configs of all particle counters sorted by id.
+    // The registry is locked exclusively until it is destroyed, so only one process (the daemon or an offline import)
+    // writes the journal. With waitForLock open() blocks until the lock is free, otherwise it fails if the registry is in use.
+    bool open(QList<QString>* configs, QString* error, bool waitForLock = false);
+
+    bool put(int id, QString config);
+    bool putBatch(const QList<QPair<int, QString> >& records);  // All or nothing, with a single sync
+    bool remove(int id);
+
+    bool compact();
+
+    QString getFilename() const;
+
+private:
+    QString m_directory;
+    QString m_filename;
+    QFile m_journal;
+    int m_lockFd;                       // Lock file, the journal itself is replaced by compaction
+    QMap<int, QString> m_configs;       // Valid records, needed for compaction
+    int m_journalRecordCount;           // Records in the journal including outdated ones
+
+    bool append(const QByteArray& data, int recordCount);
+    void compactIfNeeded();
+    bool openJournalForAppend();
+    void importCsvFiles();
+    static QByteArray putRecord(int id, const QString& config);
+};
+
+#endif // PARTICLECOUNTERREGISTRY_H
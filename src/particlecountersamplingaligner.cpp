@@ -0,0 +1,271 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+
+#include <QSettings>
+#include <QDateTime>
+#include "particlecountersamplingaligner.h"
+
+ParticleCounterSamplingAligner::ParticleCounterSamplingAligner(QObject *parent, ParticleCounterModbusSystem *pcModbusSystem, Loghandler *loghandler) : QObject(parent)
+{
+    m_pcModbusSystem = pcModbusSystem;
+    m_loghandler = loghandler;
+
+    m_broadcastStarts = 0;
+    m_unicastStarts = 0;
+    m_realignments = 0;
+
+    QSettings settings("/etc/openffucontrol/particleserver/config.ini", QSettings::IniFormat);
+    settings.beginGroup("samplingAlignment");
+    m_enabled = settings.value("enabled", false).toBool();
+    m_useBroadcast = settings.value("useBroadcast", true).toBool();
+    m_toleranceMs = settings.value("toleranceInSeconds", 2).toInt() * 1000ll;
+    m_maxInitWaitMs = settings.value("maxInitWaitInSeconds", 300).toInt() * 1000ll;
+
+    m_timer.setSingleShot(true);
+    connect(&m_timer, &QTimer::timeout, this, &ParticleCounterSamplingAligner::slot_timer_fired);
+}
+
+bool ParticleCounterSamplingAligner::isEnabled() const
+{
+    return m_enabled;
+}
+
+void ParticleCounterSamplingAligner::add(ParticleCounter *pc)
+{
+    if (!m_enabled || m_particleCounters.contains(pc))
+        return;
+
+    m_particleCounters.append(pc);
+    pc->setAlignedSampling(true);
+    connect(pc, &ParticleCounter::signal_initFinished, this, &ParticleCounterSamplingAligner::slot_initFinished, Qt::UniqueConnection);
+    connect(pc, &ParticleCounter::signal_realignmentNeeded, this, &ParticleCounterSamplingAligner::slot_realignmentNeeded, Qt::UniqueConnection);
+}
+
+void ParticleCounterSamplingAligner::remove(ParticleCounter *pc)
+{
+    disconnect(pc, &ParticleCounter::signal_initFinished, this, &ParticleCounterSamplingAligner::slot_initFinished);
+    disconnect(pc, &ParticleCounter::signal_realignmentNeeded, this, &ParticleCounterSamplingAligner::slot_realignmentNeeded);
+
+    m_particleCounters.removeAll(pc);
+    m_pending.remove(pc);
+    m_aligned.remove(pc);
+    m_referencePhases.remove(pc);
+}
+
+void ParticleCounterSamplingAligner::checkDataset(ParticleCounter *pc, const ParticleCounter::ArchiveDataset &archiveDataset)
+{
+    if (!m_aligned.contains(pc))
+        return;
+
+    qint64 cycleMs = pc->getSamplingCycleInSeconds() * 1000ll;
+    qint64 timestampMs = archiveDataset.timestamp.toMSecsSinceEpoch();
+    if ((cycleMs <= 0) || (timestampMs < m_aligned.value(pc)))
+        return;     // Sampled before the aligned start, e.g. read from the archive of the particle counter
+
+    qint64 phaseMs = timestampMs % cycleMs;
+    if (!m_referencePhases.contains(pc))
+    {
+        m_referencePhases.insert(pc, phaseMs);
+        return;
+    }
+
+    qint64 deviationMs = qAbs(phaseMs - m_referencePhases.value(pc));
+    deviationMs = qMin(deviationMs, cycleMs - deviationMs);
+    if (deviationMs > m_toleranceMs)
+    {
+        // The particle counter has restarted its acquisition on its own, e.g. after a power failure
+        m_loghandler->slot_newEntry(LogEntry::Warning, "Particle Counter id=" + QString().setNum(pc->getId()),
+                                    "Sampling window shifted by " + QString().setNum(deviationMs / 1000.0, 'f', 1) + " s. Restart at the next sampling boundary.");
+        m_realignments++;
+        requestAlignment(pc);
+    }
+}
+
+bool ParticleCounterSamplingAligner::isBroadcastTelegram(quint64 telegramID)
+{
+    return m_broadcastTelegramIDs.removeOne(telegramID);
+}
+
+ParticleCounterSamplingAligner::Status ParticleCounterSamplingAligner::getStatus() const
+{
+    Status status;
+    status.enabled = m_enabled;
+    status.pending = m_pending.size();
+    status.aligned = m_aligned.size();
+    status.broadcastStarts = m_broadcastStarts;
+    status.unicastStarts = m_unicastStarts;
+    status.realignments = m_realignments;
+    return status;
+}
+
+void ParticleCounterSamplingAligner::requestAlignment(ParticleCounter *pc)
+{
+    qint64 nowMs = QDateTime::currentMSecsSinceEpoch();
+
+    m_aligned.remove(pc);
+    m_referencePhases.remove(pc);
+    m_pending.insert(pc, nextBoundary(pc, nowMs));
+    if (!m_busWaitingSince.contains(pc->getBusID()))
+        m_busWaitingSince.insert(pc->getBusID(), nowMs);
+
+    startTimer();
+}
+
+qint64 ParticleCounterSamplingAligner::nextBoundary(ParticleCounter *pc, qint64 nowMs) const
+{
+    qint64 cycleMs = qMax(1, pc->getSamplingCycleInSeconds()) * 1000ll;
+    return (nowMs / cycleMs + 1) * cycleMs;
+}
+
+void ParticleCounterSamplingAligner::startTimer()
+{
+    if (m_pending.isEmpty())
+    {
+        m_timer.stop();
+        return;
+    }
+
+    qint64 firstBoundaryMs = m_pending.first();
+    foreach (qint64 boundaryMs, m_pending)
+    {
+        firstBoundaryMs = qMin(firstBoundaryMs, boundaryMs);
+    }
+    m_timer.start(qMax(0ll, firstBoundaryMs - QDateTime::currentMSecsSinceEpoch()));
+}
+
+bool ParticleCounterSamplingAligner::broadcastStart(int busID)
+{
+    ModBus* bus = m_pcModbusSystem->getBusByID(busID);
+    if (bus == nullptr)
+        return false;
+
+    // Modbus address 0 reaches all particle counters of the bus. They are stopped first, so the ones that are
+    // still sampling start a new window as well.
+    m_broadcastTelegramIDs.append(bus->writeSingleRegister(0, ParticleCounter::HOLDING_REG_0100_Command, ParticleCounter::COMMAND_0016_StopAcquisition));
+    m_broadcastTelegramIDs.append(bus->writeSingleRegister(0, ParticleCounter::HOLDING_REG_0100_Command, ParticleCounter::COMMAND_0017_StartAcquisition));
+    while (m_broadcastTelegramIDs.size() > 64)
+        m_broadcastTelegramIDs.removeFirst();     // The bus does not report every unanswered broadcast
+    return true;
+}
+
+void ParticleCounterSamplingAligner::markAsAligned(ParticleCounter *pc, qint64 nowMs)
+{
+    m_pending.remove(pc);
+    m_aligned.insert(pc, nowMs);
+    m_referencePhases.remove(pc);
+}
+
+void ParticleCounterSamplingAligner::slot_timer_fired()
+{
+    qint64 nowMs = QDateTime::currentMSecsSinceEpoch();
+    qint64 dueMs = nowMs + 50;      // The timer may fire a few milliseconds early
+
+    QList<int> dueBusIDs;
+    QMapIterator<ParticleCounter*, qint64> iterator(m_pending);
+    while (iterator.hasNext())
+    {
+        iterator.next();
+        if ((iterator.value() <= dueMs) && !dueBusIDs.contains(iterator.key()->getBusID()))
+            dueBusIDs.append(iterator.key()->getBusID());
+    }
+
+    foreach (int busID, dueBusIDs)
+    {
+        QList<ParticleCounter*> pending;
+        bool sameCycle = true;
+        foreach (ParticleCounter* pc, m_pending.keys())
+        {
+            if (pc->getBusID() != busID)
+                continue;
+            if (!pending.isEmpty() && (pc->getSamplingCycleInSeconds() != pending.first()->getSamplingCycleInSeconds()))
+                sameCycle = false;
+            pending.append(pc);
+        }
+
+        int busSize = 0;
+        bool initializing = false;
+        bool sampling = false;
+        foreach (ParticleCounter* pc, m_particleCounters)
+        {
+            if (pc->getBusID() != busID)
+                continue;
+            busSize++;
+            if (m_aligned.contains(pc))
+                sampling = true;
+            else if (!m_pending.contains(pc))
+                initializing = true;    // Init still running, scheduled or retried
+        }
+        bool wholeBus = sameCycle && (pending.size() == busSize);
+
+        if (m_useBroadcast && !wholeBus && initializing && !sampling && (nowMs - m_busWaitingSince.value(busID) < m_maxInitWaitMs))
+        {
+            // Wait for the other inits of the bus, so all of its particle counters are started by one broadcast
+            foreach (ParticleCounter* pc, pending)
+            {
+                m_pending.insert(pc, nextBoundary(pc, dueMs));
+            }
+            continue;
+        }
+
+        if (m_useBroadcast && wholeBus && broadcastStart(busID))
+        {
+            foreach (ParticleCounter* pc, pending)
+            {
+                pc->markAsSampling();
+                markAsAligned(pc, nowMs);
+            }
+            m_broadcastStarts++;
+        }
+        else
+        {
+            foreach (ParticleCounter* pc, pending)
+            {
+                if (m_pending.value(pc) > dueMs)
+                    continue;   // Different sampling cycle, its boundary is still ahead
+
+                pc->setSamplingEnabled(false);
+                pc->setSamplingEnabled(true);
+                markAsAligned(pc, nowMs);
+                m_unicastStarts++;
+            }
+        }
+
+        bool busPending = false;
+        foreach (ParticleCounter* pc, m_pending.keys())
+        {
+            if (pc->getBusID() == busID)
+                busPending = true;
+        }
+        if (!busPending)
+            m_busWaitingSince.remove(busID);
+    }
+
+    startTimer();
+}
+
+void ParticleCounterSamplingAligner::slot_initFinished(ParticleCounter *pc, bool success)
+{
+    // The init has left the acquisition stopped
+    if (success)
+        requestAlignment(pc);
+}
+
+void ParticleCounterSamplingAligner::slot_realignmentNeeded(ParticleCounter *pc)
+{
+    m_realignments++;
+    requestAlignment(pc);
+}
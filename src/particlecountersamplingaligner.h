@@ -0,0 +1,95 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+
+#ifndef PARTICLECOUNTERSAMPLINGALIGNER_H
+#define PARTICLECOUNTERSAMPLINGALIGNER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QMap>
+#include <QList>
+#include "particlecountermodbussystem.h"
+#include "particlecounter.h"
+#include "loghandler.h"
+
+// Without alignment every particle counter starts its acquisition whenever its init happens to run, so the sampling
+// windows of the counters are offset against each other. With alignment the acquisition is started at wall clock
+// boundaries, which are multiples of the sampling cycle (subsequent rinsing time plus sampling time) since the epoch.
+// Counters with the same sampling cycle then sample in the same windows and their datasets arrive together.
+// If all particle counters of a bus wait for their start, they are started by one broadcast, otherwise one by one.
+// A particle counter is aligned again after it stopped working or if the phase of its datasets has shifted.
+class ParticleCounterSamplingAligner : public QObject
+{
+    Q_OBJECT
+public:
+    typedef struct {
+        bool enabled;
+        int pending;                // Waiting for the next boundary
+        int aligned;                // Started at a boundary
+        quint64 broadcastStarts;
+        quint64 unicastStarts;
+        quint64 realignments;       // Particle counters that had to be aligned again
+    } Status;
+
+    explicit ParticleCounterSamplingAligner(QObject *parent, ParticleCounterModbusSystem* pcModbusSystem, Loghandler* loghandler);
+
+    bool isEnabled() const;
+
+    void add(ParticleCounter* pc);
+    void remove(ParticleCounter* pc);   // Must be called before a particle counter is deleted
+
+    // Compare the phase of an archive dataset with the phase of the first dataset after the aligned start
+    void checkDataset(ParticleCounter* pc, const ParticleCounter::ArchiveDataset& archiveDataset);
+
+    // Broadcasts are not answered, their loss must not be reported as an error
+    bool isBroadcastTelegram(quint64 telegramID);
+
+    Status getStatus() const;
+
+private:
+    ParticleCounterModbusSystem* m_pcModbusSystem;
+    Loghandler* m_loghandler;
+    bool m_enabled;
+    bool m_useBroadcast;
+    qint64 m_toleranceMs;
+    qint64 m_maxInitWaitMs;
+
+    QList<ParticleCounter*> m_particleCounters;
+    QMap<ParticleCounter*, qint64> m_pending;           // Particle counter -> boundary to start at in ms since epoch
+    QMap<int, qint64> m_busWaitingSince;                // busID -> first request of the pending particle counters
+    QMap<ParticleCounter*, qint64> m_aligned;           // Particle counter -> time of its aligned start in ms since epoch
+    QMap<ParticleCounter*, qint64> m_referencePhases;   // Particle counter -> phase of its first dataset in ms
+    QList<quint64> m_broadcastTelegramIDs;
+    QTimer m_timer;
+
+    quint64 m_broadcastStarts;
+    quint64 m_unicastStarts;
+    quint64 m_realignments;
+
+    void requestAlignment(ParticleCounter* pc);
+    qint64 nextBoundary(ParticleCounter* pc, qint64 nowMs) const;
+    void startTimer();
+    bool broadcastStart(int busID);
+    void markAsAligned(ParticleCounter* pc, qint64 nowMs);
+
+private slots:
+    void slot_timer_fired();
+    void slot_initFinished(ParticleCounter* pc, bool success);
+    void slot_realignmentNeeded(ParticleCounter* pc);
+};
+
+#endif // PARTICLECOUNTERSAMPLINGALIGNER_H
@@ -0,0 +1,116 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#include "particlecounterzoneaggregates.h"
+
+ParticleCounterZoneAggregates::ParticleCounterZoneAggregates(int intervalInSeconds, int gracePeriodInSeconds, ParticleCounterNormalization::CountFormat countFormat)
+{
+    m_countFormat = countFormat;
+    m_intervalMs = (qint64)qMax(1, intervalInSeconds) * 1000;
+    m_gracePeriodMs = (qint64)qMax(0, gracePeriodInSeconds) * 1000;
+    m_droppedDatasets = 0;
+}
+
+bool ParticleCounterZoneAggregates::add(QString zone, QByteArray zoneTag, const ParticleCounter::ArchiveDataset &archiveDataset)
+{
+    qint64 period = archiveDataset.timestamp.toMSecsSinceEpoch() / m_intervalMs;
+
+    if (!m_zones.contains(zone))
+    {
+        ZoneState zoneState;
+        zoneState.lastCompletedPeriod = -1;
+        m_zones.insert(zone, zoneState);
+    }
+
+    ZoneState& zoneState = m_zones[zone];
+    zoneState.zoneTag = zoneTag;
+
+    if (period <= zoneState.lastCompletedPeriod)
+    {
+        m_droppedDatasets++;
+        return false;
+    }
+
+    if (!zoneState.periods.contains(period))
+    {
+        Accumulator accumulator;
+        accumulator.samples = 0;
+        for (int ch=0; ch<8; ch++)
+        {
+            accumulator.sum[ch] = 0;
+            accumulator.max[ch] = 0;
+        }
+        zoneState.periods.insert(period, accumulator);
+    }
+
+    quint32 deliveredCounts[8];
+    for (int ch=0; ch<8; ch++)
+    {
+        deliveredCounts[ch] = archiveDataset.channelData[ch].count;
+    }
+    ParticleCounterNormalization::Counts normalized;
+    ParticleCounterNormalization::normalize(deliveredCounts, archiveDataset.outputDataFormat == ParticleCounter::CUMULATIVE, &normalized);
+    const quint32* counts = ParticleCounterNormalization::selectCounts(deliveredCounts, normalized, m_countFormat);
+
+    Accumulator& accumulator = zoneState.periods[period];
+    accumulator.samples++;
+    for (int ch=0; ch<8; ch++)
+    {
+        accumulator.sum[ch] += counts[ch];
+        accumulator.max[ch] = qMax(accumulator.max[ch], counts[ch]);
+    }
+    return true;
+}
+
+void ParticleCounterZoneAggregates::takeCompletedPeriods(qint64 nowMs, QList<ZonePoint> *completedPoints)
+{
+    QMutableHashIterator<QString, ZoneState> iterator(m_zones);
+    while (iterator.hasNext())
+    {
+        iterator.next();
+        ZoneState& zoneState = iterator.value();
+
+        // Periods are sorted, so only the oldest ones can be complete
+        while (!zoneState.periods.isEmpty())
+        {
+            qint64 period = zoneState.periods.firstKey();
+            qint64 periodEndMs = (period + 1) * m_intervalMs;
+            if (nowMs < periodEndMs + m_gracePeriodMs)
+                break;
+
+            const Accumulator& accumulator = zoneState.periods.first();
+            ZonePoint point;
+            point.zone = iterator.key();
+            point.zoneTag = zoneState.zoneTag;
+            point.periodEndMs = periodEndMs;
+            point.samples = accumulator.samples;
+            for (int ch=0; ch<8; ch++)
+            {
+                point.sum[ch] = accumulator.sum[ch];
+                point.max[ch] = accumulator.max[ch];
+            }
+            completedPoints->append(point);
+
+            zoneState.lastCompletedPeriod = period;
+            zoneState.periods.erase(zoneState.periods.begin());
+        }
+    }
+}
+
+quint64 ParticleCounterZoneAggregates::getDroppedDatasets() const
+{
+    return m_droppedDatasets;
+}
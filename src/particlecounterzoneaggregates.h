@@ -0,0 +1,73 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#ifndef PARTICLECOUNTERZONEAGGREGATES_H
+#define PARTICLECOUNTERZONEAGGREGATES_H
+
+#include <QString>
+#include <QByteArray>
+#include <QList>
+#include <QMap>
+#include <QHash>
+#include "particlecounter.h"
+#include "particlecounternormalization.h"
+
+// Aggregates of the archive datasets of all particle counters in a zone (room) over fixed periods since epoch.
+// The datasets are added as they arrive, so dashboards can query one series per zone instead of all counters of the zone.
+// Particle counters deliver their datasets at different times, so a period is kept open for a grace period after its end.
+class ParticleCounterZoneAggregates
+{
+public:
+    typedef struct {
+        QString zone;
+        QByteArray zoneTag;     // See ParticleCounter::getZoneTag()
+        qint64 periodEndMs;
+        quint32 samples;        // Number of datasets of all counters in the zone
+        quint64 sum[8];
+        quint32 max[8];         // Max per channel across the zone's counters
+    } ZonePoint;
+
+    ParticleCounterZoneAggregates(int intervalInSeconds, int gracePeriodInSeconds, ParticleCounterNormalization::CountFormat countFormat);
+
+    // Returns false if the period of the dataset has been completed already, the dataset is dropped in this case
+    bool add(QString zone, QByteArray zoneTag, const ParticleCounter::ArchiveDataset& archiveDataset);
+
+    // Complete all periods whose grace period is over
+    void takeCompletedPeriods(qint64 nowMs, QList<ZonePoint>* completedPoints);
+
+    quint64 getDroppedDatasets() const;
+
+private:
+    typedef struct {
+        quint32 samples;
+        quint64 sum[8];
+        quint32 max[8];
+    } Accumulator;
+
+    typedef struct {
+        QByteArray zoneTag;
+        qint64 lastCompletedPeriod;
+        QMap<qint64, Accumulator> periods;      // Period number (timestamp / interval) -> open period
+    } ZoneState;
+
+    qint64 m_intervalMs;
+    qint64 m_gracePeriodMs;
+    ParticleCounterNormalization::CountFormat m_countFormat;
+    QHash<QString, ZoneState> m_zones;
+    quint64 m_droppedDatasets;
+};
+
+#endif // PARTICLECOUNTERZONEAGGREGATES_H
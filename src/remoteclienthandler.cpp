@@ -14,29 +14,44 @@
 ** along with this program. If not, see <http://www.gnu.org/licenses/>.
 **********************************************************************/
 
+#include <time.h>
 #include "remoteclienthandler.h"
+#include "remotecontroller.h"
 
-RemoteClientHandler::RemoteClientHandler(QObject *parent, QTcpSocket* socket, ParticleCounterDatabase* pcDB, Loghandler *loghandler) : QObject(parent)
+RemoteClientHandler::RemoteClientHandler(RemoteController *parent, quint64 clientID, QIODevice* socket, QString peerName, ParticleCounterDatabase* pcDB, TerminalRequestQueue *requestQueue, Loghandler *loghandler) : QObject(parent)
 {
     this->socket = socket;
+    m_peerName = peerName;
+    m_remoteController = parent;
+    m_clientID = clientID;
     m_pcDB = pcDB;
+    m_requestQueue = requestQueue;
     m_loghandler = loghandler;
+    m_requestPending = false;
 
     m_livemode = false;
+    m_liveFilter_channels = 0xff;
+    m_alarmmode = false;
+    m_jsonMode = false;
+    m_importMode = false;
+    m_importDryRun = false;
+    m_jsonBuffer.reserve(4096);     // Reserved capacity is kept by resize(0), so the buffer is reused for each response
+
+    QSettings settings("/etc/openffucontrol/particleserver/config.ini", QSettings::IniFormat);
+    settings.beginGroup("tcpTerminal");
+    m_outputHighWaterMark = settings.value("outputHighWaterMark", 1048576).toLongLong();
+    m_conflatedLiveUpdateCount = 0;
+
+    connect(&m_timer_slowClient, &QTimer::timeout, this, &RemoteClientHandler::slot_timer_slowClient_fired);
+    m_timer_slowClient.setSingleShot(true);
+    m_timer_slowClient.setInterval(settings.value("slowClientTimeout", 60).toInt() * 1000);
 
 #ifdef QT_DEBUG
     QString debugStr;
 
     debugStr += "New connection ";
 
-    if (socket->socketType() == QAbstractSocket::TcpSocket)
-        debugStr += "tcp from ";
-    else if (socket->socketType() == QAbstractSocket::UdpSocket)
-        debugStr += "udp from ";
-    else if (socket->socketType() == QAbstractSocket::UnknownSocketType)
-        debugStr += " - unknown socket type - ";
-
-    debugStr += socket->peerAddress().toString() + ":" + QString().setNum(socket->peerPort()) + " \r\n";
+    debugStr += "from " + m_peerName + " \r\n";
 
     printf("%s", debugStr.toLatin1().data());
 #endif
@@ -44,313 +59,1147 @@ RemoteClientHandler::RemoteClientHandler(QObject *parent, QTcpSocket* socket, Pa
 
     connect(socket, SIGNAL(readyRead()), this, SLOT(slot_read_ready()));
     connect(socket, SIGNAL(disconnected()), this, SLOT(slot_disconnected()));
-    connect(m_pcDB, &ParticleCounterDatabase::signal_ParticleCounterActualDataHasChanged, this, &RemoteClientHandler::slot_ParticleCounterActualDataHasChanged);
+    connect(socket, SIGNAL(bytesWritten(qint64)), this, SLOT(slot_bytesWritten()));
+
+    // Responses are emitted in the database thread and queued to the thread of this client
+    connect(m_requestQueue, &TerminalRequestQueue::signal_requestFinished, this, &RemoteClientHandler::slot_requestFinished, Qt::QueuedConnection);
 }
 
 void RemoteClientHandler::slot_read_ready()
 {
-    while (socket->canReadLine())
+    // Do not process further commands while the client does not read its responses
+    // or while a request of this client is still pending in the database thread.
+    // The remaining lines are processed from slot_bytesWritten() or slot_requestFinished().
+    while (socket->canReadLine() && !isAboveHighWaterMark() && !m_requestPending)
     {
-        // Data format:
-        // COMMAND [--key][=value] [--key][=value]...
-        QString line = QString::fromUtf8(this->socket->readLine());
-        line.remove(QRegExp("[\\r\\n]"));      // Strip newlines at the beginning and at the end
-        int commandLength = line.indexOf(' ');
-        if (commandLength == -1) commandLength = line.length();
-        QString command = line.left(commandLength);
-        line.remove(0, commandLength + 1);  // Remove command and optional space
+        processLine(QString::fromUtf8(this->socket->readLine()));
+    }
+
+    startSlowClientTimerIfAboveHighWaterMark();
+}
+
+void RemoteClientHandler::processLine(QString line)
+{
+    // Lines of an inline import are collected until "end"
+    if (m_importMode)
+    {
+        line.remove(QRegExp("[\\r\\n]"));
+        if (line.trimmed() == "end")
+        {
+            m_importMode = false;
+            enqueueImport(m_importData, m_importDryRun);
+            m_importData.clear();
+        }
+        else if (m_importData.size() + line.size() > 16777216)
+        {
+            m_importMode = false;
+            m_importData.clear();
+            writeError("Error[Commandparser]: import data too large. Abort.");
+        }
+        else
+            m_importData.append(line + "\n");
+        return;
+    }
+
+    // Data format:
+    // COMMAND [--key][=value] [--key][=value]...
+    line.remove(QRegExp("[\\r\\n]"));      // Strip newlines at the beginning and at the end
+    int commandLength = line.indexOf(' ');
+    if (commandLength == -1) commandLength = line.length();
+    QString command = line.left(commandLength);
+    line.remove(0, commandLength + 1);  // Remove command and optional space
 
 #ifdef QT_DEBUG
-        printf("Received data: \r\n");
+    printf("Received data: \r\n");
 #endif
 
-        // Parse key/value pairs now
-        QStringList commandChunks = line.split(' ', QString::SkipEmptyParts);
-        QMap<QString, QString> data;
+    // Parse key/value pairs now
+    QStringList commandChunks = line.split(' ', QString::SkipEmptyParts);
+    QMap<QString, QString> data;
 
-        foreach(QString commandChunk, commandChunks)
-        {
+    foreach(QString commandChunk, commandChunks)
+    {
 #ifdef QT_DEBUG
-            printf("Decoding chunk: %s\r\n", commandChunk.toUtf8().data());
+        printf("Decoding chunk: %s\r\n", commandChunk.toUtf8().data());
 #endif
-            QStringList key_value_pair = commandChunk.split('=');
-            if ((key_value_pair.length() > 2) || (key_value_pair.length() < 1))
-            {
-                socket->write("ERROR: key_value_pair length invalid\r\n");
-                continue;
-            }
+        QStringList key_value_pair = commandChunk.split('=');
+        if ((key_value_pair.length() > 2) || (key_value_pair.length() < 1))
+        {
+            writeError("ERROR: key_value_pair length invalid");
+            continue;
+        }
 //            // key and value are base64 encoded.
 //            QString key = QString::fromUtf8(QByteArray::fromBase64(key_value_pair.at(0).toUtf8()));
 //            QString value = QString::fromUtf8(QByteArray::fromBase64(key_value_pair.at(1).toUtf8()));
-            QString key = key_value_pair.at(0);
-            if (key.startsWith("--"))
+        QString key = key_value_pair.at(0);
+        if (key.startsWith("--"))
+        {
+            key.remove(0, 2);   // Remove leading "--"
+            if (key_value_pair.length() == 2)
             {
-                key.remove(0, 2);   // Remove leading "--"
-                if (key_value_pair.length() == 2)
-                {
-                    QString value = key_value_pair.at(1);
-                    data.insert(key, value);
-                }
-                else
-                {
-                    data.insert(key, "query");
-                }
+                QString value = key_value_pair.at(1);
+                data.insert(key, value);
+            }
+            else
+            {
+                data.insert(key, "query");
             }
         }
+    }
+
+    // The request id is only echoed in json mode, it is not passed to the database
+    m_command = command;
+    m_requestID = data.take("requestID");
+
+    // message is distributed to other clients in this way
+    //emit signal_broadcast(QByteArray);
+
+    if (command == "help")
+    {
+        QByteArray help("This is the commandset of the openFFUcontrol remote unit:\r\n"
+                      "\r\n"
+                      "<COMMAND> [--key[=value]]\r\n"
+                      "\r\n"
+                      "COMMANDS:\r\n"
+                      "    hostname\r\n"
+                      "        Show the hostname of the controller.\r\n"
+                      "    mode json|text\r\n"
+                      "        Switch the output of this connection to newline delimited json objects or back to text.\r\n"
+                      "        In json mode each command may carry --requestID=ID which is echoed in its response.\r\n"
+                      "    startlive [--id=ID[,ID...]] [--bus=BUSNR[,BUSNR...]] [--channel=CH[,CH...]]\r\n"
+                      "        Show data of particle counters in realtime. Can be stopped with stoplive\r\n"
+                      "        Optionally only the given particle counters, buses and channels (1..8) are shown.\r\n"
+                      "    stoplive\r\n"
+                      "        Stop live showing of particle counter data.\r\n"
+                      "    startalarms [--id=ID[,ID...]] [--bus=BUSNR[,BUSNR...]]\r\n"
+                      "        Show warning and alarm transitions of the channels as soon as they are detected. Can be stopped with stopalarms\r\n"
+                      "    stopalarms\r\n"
+                      "        Stop showing alarm transitions.\r\n"
+                      "    list-particlecounters\r\n"
+                      "        Show the list of currently configured particlecounters from the controller database.\r\n"
+                      "    dump [--bus=BUSNR]\r\n"
+                      "        Show the state and latest counts of all particle counters (or of those at BUSNR) in one response.\r\n"
+                      "    history --id=ID [--count=N]\r\n"
+                      "        Show the last N (default all stored) archive datasets of particle counter ID, oldest first.\r\n"
+                      "    log\r\n"
+                      "        Show the log consisting of infos, warnings and errors.\r\n"
+                      "\r\n"
+                      "    buffers\r\n"
+                      "        Show buffer levels.\r\n"
+                      "\r\n"
+                      "    add-particlecounter --bus=BUSNR --unit=ADR --id=ID\r\n"
+                      "        Add a new particle counter with ID to the controller database at BUSNR with OCU at modbus address ADR.\r\n"
+                      "\r\n"
+                      "    delete-particlecounter --id=ID --bus=BUSNR\r\n"
+                      "        Delete particle counter with ID from the controller database.\r\n"
+                      "        Note that you can delete all particle counters of a certain bus by using BUSNR only.\r\n"
+                      "\r\n"
+                      "    import [--dryrun]\r\n"
+                      "        Add many particle counters from csv lines id,bus,unit[,config] (config: key=value;key=value).\r\n"
+                      "        The csv lines follow the command and are terminated by a line \"end\".\r\n"
+                      "        Nothing is imported if any line is invalid. --dryrun only validates the data.\r\n"
+                      "\r\n"
+                      "    set --parameter=VALUE\r\n"
+                      "        parameter 'limitN' (N = 1..8) sets WARNING,ALARM,WARNINGDELAY,ALARMDELAY of channel N, empty fields are kept.\r\n"
+                      "        All limits of a particle counter are written in one block and read back.\r\n"
+                      "\r\n"
+                      "    set-limits --bus=BUSNR --limitN=WARNING,ALARM,WARNINGDELAY,ALARMDELAY [--limitN=...]\r\n"
+                      "        Write the same limits to all particle counters at BUSNR.\r\n"
+                      "\r\n"
+                      "    get --parameter\r\n"
+                      "        parameter 'actual' lists all actual values of the selected unit id.\r\n"
+                      "        parameter 'aggregates' shows sum, max and mean per channel over the rolling windows.\r\n"
+                      "        parameter 'limits' shows the warning and alarm limits with their delays per channel.\r\n"
+                      "\r\n");
 
-        // message is distributed to other clients in this way
-        //emit signal_broadcast(QByteArray);
-
-        if (command == "help")
-        {
-            socket->write("This is the commandset of the openFFUcontrol remote unit:\r\n"
-                          "\r\n"
-                          "<COMMAND> [--key[=value]]\r\n"
-                          "\r\n"
-                          "COMMANDS:\r\n"
-                          "    hostname\r\n"
-                          "        Show the hostname of the controller.\r\n"
-                          "    startlive\r\n"
-                          "        Show data of particle counters in realtime. Can be stopped with stoplive\r\n"
-                          "    stoplive\r\n"
-                          "        Stop live showing of particle counter data.\r\n"
-                          "    list-particlecounters\r\n"
-                          "        Show the list of currently configured particlecounters from the controller database.\r\n"
-                          "    log\r\n"
-                          "        Show the log consisting of infos, warnings and errors.\r\n"
-                          "\r\n"
-                          "    buffers\r\n"
-                          "        Show buffer levels.\r\n"
-                          "\r\n"
-                          "    add-particlecounter --bus=BUSNR --unit=ADR --id=ID\r\n"
-                          "        Add a new particle counter with ID to the controller database at BUSNR with OCU at modbus address ADR.\r\n"
-                          "\r\n"
-                          "    delete-particlecounter --id=ID --bus=BUSNR\r\n"
-                          "        Delete particle counter with ID from the controller database.\r\n"
-                          "        Note that you can delete all particle counters of a certain bus by using BUSNR only.\r\n"
-                          "\r\n"
-                          "    set --parameter=VALUE\r\n"
-                          "\r\n"
-                          "    get --parameter\r\n"
-                          "        parameter 'actual' lists all actual values of the selected unit id.\r\n"
-                          "\r\n");
-        }
-        // ************************************************** hostname **************************************************
-        else if (command == "hostname")
+        if (m_jsonMode)
         {
-            QString line;
-            line = "Hostname=" + QHostInfo::localHostName() + "\n";
-            socket->write(line.toUtf8());
+            JsonLineWriter json = beginJsonResponse("ok");
+            json.addString("help", QString::fromUtf8(help));
+            finishJsonResponse(&json);
         }
-        // ************************************************** startlive **************************************************
-        else if (command == "startlive")
+        else
+            socket->write(help);
+    }
+    // ************************************************** hostname **************************************************
+    else if (command == "hostname")
+    {
+        if (m_jsonMode)
         {
-            QString line;
-            line = "Liveshow=on\n";
-            socket->write(line.toUtf8());
-            m_livemode = true;
+            JsonLineWriter json = beginJsonResponse("ok");
+            json.addString("hostname", QHostInfo::localHostName());
+            finishJsonResponse(&json);
+            return;
         }
-        // ************************************************** stoplive **************************************************
-        else if (command == "stoplive")
+
+        QString line;
+        line = "Hostname=" + QHostInfo::localHostName() + "\n";
+        socket->write(line.toUtf8());
+    }
+    // ************************************************** mode **************************************************
+    else if (command == "mode")
+    {
+        QString mode = commandChunks.value(0);
+        if (mode == "json")
+            m_jsonMode = true;
+        else if (mode == "text")
+            m_jsonMode = false;
+        else
         {
-            QString line;
-            line = "Liveshow=off\n";
-            socket->write(line.toUtf8());
-            m_livemode = false;
+            writeError("Error[Commandparser]: mode must be \"json\" or \"text\". Abort.");
+            return;
         }
-        // ************************************************** list-ocufans **************************************************
-        else if (command == "list-particlecounters")
+
+        if (m_jsonMode)
         {
-            QList<ParticleCounter*> pcs = m_pcDB->getParticleCounters();
-            foreach(ParticleCounter* pc, pcs)
-            {
-                QString line;
-
-                line.sprintf("Particle Counter id=%i busID=%i modbusAddress=%i serial=%s online=%i lastSeen=%s status=%s\r\n", 
-                    pc->getId(), 
-                    pc->getBusID(), 
-                    pc->getModbusAddress(), 
-                    pc->getData("deviceID").toUtf8().data(),
-                    pc->getActualData().online, 
-                    pc->getData("lastSeen").toUtf8().data(),
-                    pc->getActualData().statusString.toUtf8().data());
-
-                socket->write(line.toUtf8());
-            }
+            JsonLineWriter json = beginJsonResponse("ok");
+            json.addString("mode", mode);
+            finishJsonResponse(&json);
         }
-        // ************************************************** log **************************************************
-        else if (command == "log")
+        else
+            socket->write("Mode=text\r\n");
+    }
+    // ************************************************** startlive **************************************************
+    else if (command == "startlive")
+    {
+        QBitArray ids;
+        QBitArray buses;
+        QBitArray channels;
+
+        if (!parseLiveFilter(data.value("id"), &ids) || !parseLiveFilter(data.value("bus"), &buses) || !parseLiveFilter(data.value("channel"), &channels, 1, 8))
         {
-            socket->write(m_loghandler->toString(LogEntry::Info).toUtf8() + "\n");
-            socket->write(m_loghandler->toString(LogEntry::Warning).toUtf8() + "\n");
-            socket->write(m_loghandler->toString(LogEntry::Error).toUtf8() + "\n");
+            writeError("Error[Commandparser]: parameter \"id\", \"bus\" (0..65535) or \"channel\" (1..8) can not be parsed. Abort.");
+            return;
         }
-        // ************************************************** buffers **************************************************
-        else if (command == "buffers")
+
+        m_liveFilter_ids = ids;
+        m_liveFilter_buses = buses;
+        m_liveFilter_channels = 0xff;
+        if (!channels.isEmpty())
         {
-            int i = 0;
-            foreach(ModBus* bus, *m_pcDB->getBusList())
+            m_liveFilter_channels = 0;
+            for (int ch=1; (ch<=8) && (ch<channels.size()); ch++)
             {
-                int telegramQueueLevel_standardPriority = bus->getSizeOfTelegramQueue(false);
-                int telegramQueueLevel_highPriority = bus->getSizeOfTelegramQueue(true);
-                QString line;
-                line.sprintf("Particle Counter ModBus line %i: TelegramQueueLevel_standardPriority=%i TelegramQueueLevel_highPriority=%i\r\n",
-                             i, telegramQueueLevel_standardPriority, telegramQueueLevel_highPriority);
-                socket->write(line.toUtf8());
-                i++;
+                if (channels.testBit(ch))
+                    m_liveFilter_channels |= (1 << (ch - 1));
             }
+        }
+
+        m_livemode = true;
+
+        if (m_jsonMode)
+        {
+            JsonLineWriter json = beginJsonResponse("ok");
+            json.addBool("live", true);
+            finishJsonResponse(&json);
+            return;
+        }
+
+        QString line;
+        line = "Liveshow=on\n";
+        socket->write(line.toUtf8());
+    }
+    // ************************************************** stoplive **************************************************
+    else if (command == "stoplive")
+    {
+        m_livemode = false;
+
+        if (m_jsonMode)
+        {
+            JsonLineWriter json = beginJsonResponse("ok");
+            json.addBool("live", false);
+            finishJsonResponse(&json);
+            return;
+        }
+
+        QString line;
+        line = "Liveshow=off\n";
+        socket->write(line.toUtf8());
+    }
+    // ************************************************** startalarms **************************************************
+    else if (command == "startalarms")
+    {
+        QBitArray ids;
+        QBitArray buses;
 
+        if (!parseLiveFilter(data.value("id"), &ids) || !parseLiveFilter(data.value("bus"), &buses))
+        {
+            writeError("Error[Commandparser]: parameter \"id\" or \"bus\" (0..65535) can not be parsed. Abort.");
+            return;
+        }
+
+        m_alarmFilter_ids = ids;
+        m_alarmFilter_buses = buses;
+        m_alarmmode = true;
+
+        if (m_jsonMode)
+        {
+            JsonLineWriter json = beginJsonResponse("ok");
+            json.addBool("alarms", true);
+            finishJsonResponse(&json);
+            return;
         }
-        // ************************************************** add-particlecounter **************************************************
-        else if (command == "add-particlecounter")
+
+        socket->write("Alarms=on\r\n");
+    }
+    // ************************************************** stopalarms **************************************************
+    else if (command == "stopalarms")
+    {
+        m_alarmmode = false;
+
+        if (m_jsonMode)
         {
-            bool ok;
+            JsonLineWriter json = beginJsonResponse("ok");
+            json.addBool("alarms", false);
+            finishJsonResponse(&json);
+            return;
+        }
+
+        socket->write("Alarms=off\r\n");
+    }
+    // ************************************************** list-ocufans **************************************************
+    else if (command == "list-particlecounters")
+    {
+        ParticleCounterDatabase::SnapshotPtr snapshot = m_pcDB->getSnapshot();
 
-            QString busString = data.value("bus");
-            int bus = busString.toInt(&ok);
-            if (busString.isEmpty() || !ok)
+        if (m_jsonMode)
+        {
+            JsonLineWriter json = beginJsonResponse("ok");
+            json.beginArray("particleCounters");
+            foreach(const ParticleCounter::State& state, snapshot->particleCounters)
             {
-                socket->write("Error[Commandparser]: parameter \"bus\" not specified or bus cannot be parsed. Abort.\r\n");
-                continue;
+                json.beginObject();
+                writeParticleCounterJson(&json, state);
+                json.endObject();
             }
+            json.endArray();
+            finishJsonResponse(&json);
+            return;
+        }
+
+        foreach(const ParticleCounter::State& state, snapshot->particleCounters)
+        {
+            QString line;
+
+            line.sprintf("Particle Counter id=%i busID=%i modbusAddress=%i serial=%s online=%i lastSeen=%s status=%s\r\n", 
+                state.id, 
+                state.busID, 
+                state.modbusAddress, 
+                ParticleCounter::formatData(state, "deviceID").toUtf8().data(),
+                state.actualData.online, 
+                ParticleCounter::formatData(state, "lastSeen").toUtf8().data(),
+                state.actualData.statusString.toUtf8().data());
 
-            QString idString = data.value("id");
-            int id = idString.toInt(&ok);
-            if (idString.isEmpty() || !ok)
+            socket->write(line.toUtf8());
+        }
+    }
+    // ************************************************** dump **************************************************
+    else if (command == "dump")
+    {
+        bool ok;
+        int bus = -1;   // All buses
+        QString busString = data.value("bus");
+        if (!busString.isEmpty())
+        {
+            bus = busString.toInt(&ok);
+            if (!ok)
             {
-                socket->write("Error[Commandparser]: parameter \"id\" not specified or id can not be parsed. Abort.\r\n");
-                continue;
+                writeError("Error[Commandparser]: parameter \"bus\" can not be parsed. Abort.");
+                return;
             }
+        }
 
-            QString unitString = data.value("unit");
-            int unit = unitString.toInt(&ok);
-            if ((unitString.isEmpty() || !ok) && (command == "add-particlecounter"))
+        ParticleCounterDatabase::SnapshotPtr snapshot = m_pcDB->getSnapshot();
+        int count = 0;
+
+        if (m_jsonMode)
+        {
+            m_jsonBuffer.resize(0);
+            m_jsonBuffer.reserve(snapshot->particleCounters.size() * 440 + 128);
+            JsonLineWriter json = beginJsonResponse("ok");
+            json.beginArray("particleCounters");
+            foreach(const ParticleCounter::State& state, snapshot->particleCounters)
             {
-                socket->write("Error[Commandparser]: parameter \"unit\" not specified or id can not be parsed. Abort.\r\n");
-                continue;
+                if ((bus >= 0) && (state.busID != bus))
+                    continue;
+                json.beginObject();
+                writeParticleCounterJson(&json, state, true);
+                json.endObject();
+                count++;
             }
+            json.endArray();
+            json.addInt("count", count);
+            finishJsonResponse(&json);
+            return;
+        }
 
-#ifdef DEBUG
-            socket->write("add-particlecounter bus=" + QString().setNum(bus).toUtf8() + " id=" + QString().setNum(id).toUtf8() + " unit=" + QString().setNum(unit).toUtf8() + "\r\n");
-#endif
-            QString response;
-            if (command == "add-particlecounter")
-                response = m_pcDB->addParticleCounter(id, bus, unit);
+        // All lines go into one buffer that is preallocated for the whole plant and written at once
+        m_dumpBuffer.resize(0);
+        m_dumpBuffer.reserve(snapshot->particleCounters.size() * 384 + 64);
+        foreach(const ParticleCounter::State& state, snapshot->particleCounters)
+        {
+            if ((bus >= 0) && (state.busID != bus))
+                continue;
+            appendDumpLine(&m_dumpBuffer, state);
+            count++;
+        }
 
-            socket->write(response.toUtf8() + "\r\n");
+        char footer[32];
+        int length = qsnprintf(footer, sizeof(footer), "Dump count=%i\r\n", count);
+        m_dumpBuffer.append(footer, length);
+        socket->write(m_dumpBuffer);
+    }
+    // ************************************************** history **************************************************
+    else if (command == "history")
+    {
+        bool ok;
+        QString idString = data.value("id");
+        int id = idString.toInt(&ok);
+        if (idString.isEmpty() || !ok)
+        {
+            writeError("Error[Commandparser]: parameter \"id\" not specified or id cannot be parsed. Abort.");
+            return;
         }
-        // ************************************************** delete-particlecounter **************************************************
-        else if (command == "delete-particlecounter")
+
+        // The ring is read directly from its mapping in this thread, records are copied to the stack one by one
+        ParticleCounterHistoryPtr history = m_pcDB->getHistory(id);
+        if (history.isNull())
         {
-            bool ok;
-            QString response;
-            bool noID = false;
-            bool noBus = false;
+            writeError("Warning[Commandparser]: no history for id " + idString + ".", "warning");
+            return;
+        }
 
-            QString idString = data.value("id");
-            int id = idString.toInt(&ok);
-            if (idString.isEmpty() || !ok)
+        quint64 writeCount = history->getWriteCount();
+        quint64 available = qMin(writeCount, (quint64)history->getCapacity());
+        quint64 requested = available;
+        QString countString = data.value("count");
+        if (!countString.isEmpty())
+        {
+            requested = countString.toULongLong(&ok);
+            if (!ok)
             {
-                noID = true;
+                writeError("Error[Commandparser]: parameter \"count\" can not be parsed. Abort.");
+                return;
             }
-            else
+            requested = qMin(requested, available);
+        }
+
+        ParticleCounterHistory::Record record;
+        int count = 0;
+
+        if (m_jsonMode)
+        {
+            m_jsonBuffer.resize(0);
+            m_jsonBuffer.reserve((int)requested * 160 + 128);
+            JsonLineWriter json = beginJsonResponse("ok");
+            json.addInt("id", id);
+            json.beginArray("history");
+            for (quint64 sequence = writeCount - requested + 1; sequence <= writeCount; sequence++)
             {
-                response += m_pcDB->deleteParticleCounter(id) + "\n";
+                if (!history->readRecord(sequence, &record))
+                    continue;   // Overwritten meanwhile
+                json.beginObject();
+                json.addInt("timestampMs", record.timestampMs);
+                json.addInt("samplingTimeInSeconds", record.samplingTimeInSeconds);
+                json.addInt("outputDataFormat", record.outputDataFormat);
+                json.beginArray("counts");
+                for (int ch=0; ch<8; ch++)
+                {
+                    json.addInt(record.counts[ch]);
+                }
+                json.endArray();
+                json.endObject();
+                count++;
             }
+            json.endArray();
+            json.addInt("count", count);
+            finishJsonResponse(&json);
+            return;
+        }
+
+        m_dumpBuffer.resize(0);
+        m_dumpBuffer.reserve((int)requested * 200 + 64);
+        for (quint64 sequence = writeCount - requested + 1; sequence <= writeCount; sequence++)
+        {
+            if (!history->readRecord(sequence, &record))
+                continue;
+            appendHistoryLine(&m_dumpBuffer, id, record);
+            count++;
+        }
 
-            QString busString = data.value("bus");
-            int bus = busString.toInt(&ok);
-            if (busString.isEmpty() || !ok)
+        char footer[32];
+        int length = qsnprintf(footer, sizeof(footer), "History count=%i\r\n", count);
+        m_dumpBuffer.append(footer, length);
+        socket->write(m_dumpBuffer);
+    }
+    // ************************************************** log **************************************************
+    else if (command == "log")
+    {
+        // The log is owned by the main thread, so it is read there
+        Loghandler* loghandler = m_loghandler;
+        bool jsonMode = m_jsonMode;
+        QString requestID = m_requestID;
+        enqueueRequest([loghandler, jsonMode, requestID]() -> QByteArray {
+            QByteArray response;
+            if (jsonMode)
             {
-                noBus = true;
+                JsonLineWriter json(&response);
+                json.beginObject();
+                writeJsonHeader(&json, requestID, "log", "ok");
+                json.addString("info", loghandler->toString(LogEntry::Info));
+                json.addString("warning", loghandler->toString(LogEntry::Warning));
+                json.addString("error", loghandler->toString(LogEntry::Error));
+                json.endObject();
+                json.endLine();
+                return response;
             }
-            else
+            response += loghandler->toString(LogEntry::Info).toUtf8() + "\n";
+            response += loghandler->toString(LogEntry::Warning).toUtf8() + "\n";
+            response += loghandler->toString(LogEntry::Error).toUtf8() + "\n";
+            return response;
+        });
+    }
+    // ************************************************** buffers **************************************************
+    else if (command == "buffers")
+    {
+        ParticleCounterDatabase::SnapshotPtr snapshot = m_pcDB->getSnapshot();
+
+        if (m_jsonMode)
+        {
+            JsonLineWriter json = beginJsonResponse("ok");
+            json.beginArray("buses");
+            foreach(const ParticleCounterDatabase::BusState& busState, snapshot->buses)
             {
-                foreach (ParticleCounter* pc, m_pcDB->getParticleCounters(bus))
-                {
-                    response += m_pcDB->deleteParticleCounter(pc->getId()) + "\n";
-                }
+                json.beginObject();
+                json.addInt("busID", busState.busID);
+                json.addInt("telegramQueueLevel_standardPriority", busState.telegramQueueLevel_standardPriority);
+                json.addInt("telegramQueueLevel_highPriority", busState.telegramQueueLevel_highPriority);
+                json.endObject();
             }
+            json.endArray();
+            json.addInt("terminalRequestsPending", m_requestQueue->getSizeOfQueue());
+            const ParticleCounterInitScheduler::Status& initStatus = snapshot->initStatus;
+            json.beginObject("initialization");
+            json.addInt("pending", initStatus.pending);
+            json.addInt("running", initStatus.running);
+            json.addInt("batchSize", initStatus.batchSize);
+            json.addInt("batchInitialized", initStatus.batchInitialized);
+            json.addInt("failedInits", initStatus.failedInits);
+            json.addInt("timeToAllOnlineMs", initStatus.timeToAllOnlineMs);
+            json.endObject();
+            const ParticleCounterSamplingAligner::Status& alignmentStatus = snapshot->alignmentStatus;
+            json.beginObject("samplingAlignment");
+            json.addBool("enabled", alignmentStatus.enabled);
+            json.addInt("pending", alignmentStatus.pending);
+            json.addInt("aligned", alignmentStatus.aligned);
+            json.addInt("broadcastStarts", alignmentStatus.broadcastStarts);
+            json.addInt("unicastStarts", alignmentStatus.unicastStarts);
+            json.addInt("realignments", alignmentStatus.realignments);
+            json.endObject();
+            const ParticleCounterDatabase::SinkStatus& sinkStatus = snapshot->sinkStatus;
+            json.beginObject("sink");
+            json.addBool("changeOnlyWrites", sinkStatus.changeOnlyWrites);
+            json.addInt("heartbeatIntervalInSeconds", sinkStatus.heartbeatIntervalInSeconds);
+            json.addInt("pointsWritten", sinkStatus.pointsWritten);
+            json.addInt("pointsSuppressed", sinkStatus.pointsSuppressed);
+            json.addDouble("suppressedRatio", suppressedRatio(sinkStatus));
+            json.addInt("zoneDatasetsDropped", sinkStatus.zoneDatasetsDropped);
+            json.addInt("batchWindowInSeconds", sinkStatus.batchWindowInSeconds);
+            json.addInt("batchesWritten", sinkStatus.batchesWritten);
+            json.endObject();
+            json.beginArray("clients");
+            m_remoteController->clientBufferStatusJson(&json);
+            json.endArray();
+            finishJsonResponse(&json);
+            return;
+        }
+
+        foreach(const ParticleCounterDatabase::BusState& busState, snapshot->buses)
+        {
+            QString line;
+            line.sprintf("Particle Counter ModBus line %i: TelegramQueueLevel_standardPriority=%i TelegramQueueLevel_highPriority=%i\r\n",
+                         busState.busID, busState.telegramQueueLevel_standardPriority, busState.telegramQueueLevel_highPriority);
+            socket->write(line.toUtf8());
+        }
+        QString line;
+        line.sprintf("Terminal request queue: RequestsPending=%i\r\n", m_requestQueue->getSizeOfQueue());
+        socket->write(line.toUtf8());
+        const ParticleCounterInitScheduler::Status& initStatus = snapshot->initStatus;
+        line.sprintf("Initialization: Pending=%i Running=%i BatchSize=%i BatchInitialized=%i FailedInits=%i TimeToAllOnlineMs=%lli\r\n",
+                     initStatus.pending, initStatus.running, initStatus.batchSize, initStatus.batchInitialized,
+                     initStatus.failedInits, initStatus.timeToAllOnlineMs);
+        socket->write(line.toUtf8());
+        const ParticleCounterSamplingAligner::Status& alignmentStatus = snapshot->alignmentStatus;
+        line.sprintf("Sampling alignment: Enabled=%s Pending=%i Aligned=%i BroadcastStarts=%llu UnicastStarts=%llu Realignments=%llu\r\n",
+                     alignmentStatus.enabled ? "true" : "false", alignmentStatus.pending, alignmentStatus.aligned,
+                     alignmentStatus.broadcastStarts, alignmentStatus.unicastStarts, alignmentStatus.realignments);
+        socket->write(line.toUtf8());
+        const ParticleCounterDatabase::SinkStatus& sinkStatus = snapshot->sinkStatus;
+        line.sprintf("Influx sink: ChangeOnlyWrites=%s HeartbeatIntervalInSeconds=%i PointsWritten=%llu PointsSuppressed=%llu SuppressedRatio=%.4f ZoneDatasetsDropped=%llu BatchWindowInSeconds=%i BatchesWritten=%llu\r\n",
+                     sinkStatus.changeOnlyWrites ? "true" : "false", sinkStatus.heartbeatIntervalInSeconds,
+                     sinkStatus.pointsWritten, sinkStatus.pointsSuppressed, suppressedRatio(sinkStatus), sinkStatus.zoneDatasetsDropped,
+                     sinkStatus.batchWindowInSeconds, sinkStatus.batchesWritten);
+        socket->write(line.toUtf8());
+        socket->write(m_remoteController->clientBufferStatus().toUtf8());
+    }
+    // ************************************************** add-particlecounter **************************************************
+    else if (command == "add-particlecounter")
+    {
+        bool ok;
+
+        QString busString = data.value("bus");
+        int bus = busString.toInt(&ok);
+        if (busString.isEmpty() || !ok)
+        {
+            writeError("Error[Commandparser]: parameter \"bus\" not specified or bus cannot be parsed. Abort.");
+            return;
+        }
 
-            if (noID && noBus)
-                response = "Error[Commandparser]: Neither parameter \"id\" nor parameter \"bus\" specified. Abort.\r\n";
+        QString idString = data.value("id");
+        int id = idString.toInt(&ok);
+        if (idString.isEmpty() || !ok)
+        {
+            writeError("Error[Commandparser]: parameter \"id\" not specified or id can not be parsed. Abort.");
+            return;
+        }
 
+        QString unitString = data.value("unit");
+        int unit = unitString.toInt(&ok);
+        if ((unitString.isEmpty() || !ok) && (command == "add-particlecounter"))
+        {
+            writeError("Error[Commandparser]: parameter \"unit\" not specified or id can not be parsed. Abort.");
+            return;
+        }
 
 #ifdef DEBUG
-            socket->write("delete-auxfan id=" + QString().setNum(id).toUtf8() + "\r\n");
+        socket->write("add-particlecounter bus=" + QString().setNum(bus).toUtf8() + " id=" + QString().setNum(id).toUtf8() + " unit=" + QString().setNum(unit).toUtf8() + "\r\n");
 #endif
+        ParticleCounterDatabase* pcDB = m_pcDB;
+        bool jsonMode = m_jsonMode;
+        QString requestID = m_requestID;
+        enqueueRequest([pcDB, id, bus, unit, jsonMode, requestID]() -> QByteArray {
+            return formatResponse(jsonMode, requestID, "add-particlecounter", pcDB->addParticleCounter(id, bus, unit));
+        });
+    }
+    // ************************************************** delete-particlecounter **************************************************
+    else if (command == "delete-particlecounter")
+    {
+        bool idOk;
+        bool busOk;
 
+        QString idString = data.value("id");
+        int id = idString.toInt(&idOk);
+        bool noID = (idString.isEmpty() || !idOk);
 
-            socket->write(response.toUtf8() + "\r\n");
-        }
-        // ************************************************** set **************************************************
-        else if (command == "set")
+        QString busString = data.value("bus");
+        int bus = busString.toInt(&busOk);
+        bool noBus = (busString.isEmpty() || !busOk);
+
+        if (noID && noBus)
         {
-            bool ok;
-            QString idString = data.value("id");
-            int id = idString.toInt(&ok);
-            if (idString.isEmpty() || !ok)
+            writeError("Error[Commandparser]: Neither parameter \"id\" nor parameter \"bus\" specified. Abort.");
+            return;
+        }
+
+#ifdef DEBUG
+        socket->write("delete-auxfan id=" + QString().setNum(id).toUtf8() + "\r\n");
+#endif
+
+        ParticleCounterDatabase* pcDB = m_pcDB;
+        bool jsonMode = m_jsonMode;
+        QString requestID = m_requestID;
+        enqueueRequest([pcDB, id, noID, bus, noBus, jsonMode, requestID]() -> QByteArray {
+            QString response;
+
+            if (!noID)
+                response += pcDB->deleteParticleCounter(id) + "\n";
+
+            if (!noBus)
             {
-                socket->write("Error[Commandparser]: parameter \"id\" not specified or id can not be parsed. Abort.\r\n");
-                continue;
+                foreach (ParticleCounter* pc, pcDB->getParticleCounters(bus))
+                {
+                    response += pcDB->deleteParticleCounter(pc->getId()) + "\n";
+                }
             }
 
+            return formatResponse(jsonMode, requestID, "delete-particlecounter", response);
+        });
+    }
+    // ************************************************** import **************************************************
+    else if (command == "import")
+    {
+        // The csv lines are sent by the client, the daemon does not read files on behalf of terminal clients
+        m_importMode = true;
+        m_importDryRun = data.contains("dryrun");
+        m_importData.clear();
+        if (!m_jsonMode)
+            socket->write("Import=waiting for csv lines id,bus,unit[,config], finish with a line \"end\"\r\n");
+    }
+    // ************************************************** set **************************************************
+    else if (command == "set")
+    {
+        bool ok;
+        QString idString = data.value("id");
+        int id = idString.toInt(&ok);
+        if (idString.isEmpty() || !ok)
+        {
+            writeError("Error[Commandparser]: parameter \"id\" not specified or id can not be parsed. Abort.");
+            return;
+        }
+
 #ifdef DEBUG
-            socket->write("set id=" + QString().setNum(id).toUtf8() + "\r\n");
+        socket->write("set id=" + QString().setNum(id).toUtf8() + "\r\n");
 #endif
+        ParticleCounterDatabase* pcDB = m_pcDB;
+        bool jsonMode = m_jsonMode;
+        QString requestID = m_requestID;
+        enqueueRequest([pcDB, id, data, jsonMode, requestID]() -> QByteArray {
             QString response;
-            if (m_pcDB->getParticleCounterByID(id) != nullptr)
-                response = m_pcDB->setParticleCounterData(id, data);
-            socket->write(response.toUtf8() + "\r\n");
+            if (pcDB->getParticleCounterByID(id) != nullptr)
+                response = pcDB->setParticleCounterData(id, data);
+            else if (jsonMode)
+                response = "Warning[ParticleCounterDatabase]: ID " + QString().setNum(id) + " not found.";
+            return formatResponse(jsonMode, requestID, "set", response);
+        });
+    }
+    // ************************************************** set-limits **************************************************
+    else if (command == "set-limits")
+    {
+        bool ok;
+        QString busString = data.value("bus");
+        int bus = busString.toInt(&ok);
+        if (busString.isEmpty() || !ok)
+        {
+            writeError("Error[Commandparser]: parameter \"bus\" not specified or bus can not be parsed. Abort.");
+            return;
         }
-        // ************************************************** get **************************************************
-        else if (command == "get")
+
+        ParticleCounterDatabase* pcDB = m_pcDB;
+        bool jsonMode = m_jsonMode;
+        QString requestID = m_requestID;
+        enqueueRequest([pcDB, bus, data, jsonMode, requestID]() -> QByteArray {
+            return formatResponse(jsonMode, requestID, "set-limits", pcDB->setLimits(bus, data));
+        });
+    }
+    // ************************************************** get **************************************************
+    else if (command == "get")
+    {
+        bool ok;
+        QString idString = data.value("id");
+        int id = idString.toInt(&ok);
+        if (idString.isEmpty() || !ok)
         {
-            bool ok;
-            QString idString = data.value("id");
-            int id = idString.toInt(&ok);
-            if (idString.isEmpty() || !ok)
-            {
-                socket->write("Error[Commandparser]: parameter \"id\" not specified or id can not be parsed. Abort.\r\n");
-                continue;
-            }
+            writeError("Error[Commandparser]: parameter \"id\" not specified or id can not be parsed. Abort.");
+            return;
+        }
 
 #ifdef DEBUG
-            socket->write("get id=" + id.toUtf8() + "\r\n");
+        socket->write("get id=" + id.toUtf8() + "\r\n");
 #endif
-            QMap<QString,QString> responseData;
+        QMap<QString,QString> responseData;
+        QStringList keys = data.keys("query");
+        bool actualData = keys.contains("actual");
+        if (actualData)
+            keys = ParticleCounter::getActualKeys();    // Only show actual values, drop all other requests
+
+        ParticleCounterDatabase::SnapshotPtr snapshot = m_pcDB->getSnapshot();
+        if (snapshot->indexByID.contains(id))
+        {
+            const ParticleCounter::State& state = snapshot->particleCounters.at(snapshot->indexByID.value(id));
 
-            if (m_pcDB->getParticleCounterByID(id) != nullptr)
-                responseData = m_pcDB->getParticleCounterData(id, data.keys("query"));
-            if (responseData.value("actualData").toInt() == 1)
+            if (m_jsonMode && actualData)
             {
-                socket->write("ActualData from id=" + QString().setNum(id).toUtf8());
-                responseData.remove("actualData");  // Remove special treatment marker
+                // Actual data is written with native types straight from the state
+                JsonLineWriter json = beginJsonResponse("ok");
+                json.beginObject("actualData");
+                writeParticleCounterJson(&json, state);
+                json.endObject();
+                finishJsonResponse(&json);
+                return;
             }
-            else
-                socket->write("Data from id=" + QString().setNum(id).toUtf8());
-            QString errors;
+
+            if (keys.contains("aggregates"))
+            {
+                writeAggregates(state);
+                return;
+            }
+
+            if (keys.contains("limits"))
+            {
+                writeLimits(state);
+                return;
+            }
+
+            foreach (QString key, keys)
+            {
+                responseData.insert(key, ParticleCounter::formatData(state, key));
+            }
+        }
+        else if (m_jsonMode)
+        {
+            writeError("Warning[RemoteClientHandler]: ID " + QString().setNum(id) + " not found.", "warning");
+            return;
+        }
+
+        if (m_jsonMode)
+        {
+            JsonLineWriter json = beginJsonResponse("ok");
+            json.addInt("id", id);
+            json.beginObject("data");
+            QStringList errors;
             foreach(QString key, responseData.keys())
             {
                 QString response = responseData.value(key);
                 if (!response.startsWith("Error[ParticleCounter]:"))
-                    socket->write(" " + key.toUtf8() + "=" + response.toUtf8());
+                    json.addString(key, response);
                 else
-                    errors.append(response + "\r\n");
+                    errors.append(response);
             }
-            socket->write("\r\n");
-            if (!errors.isEmpty())
+            json.endObject();
+            json.beginArray("errors");
+            foreach (QString error, errors)
             {
-                socket->write(errors.toUtf8());
+                json.addString(error);
             }
+            json.endArray();
+            finishJsonResponse(&json);
+            return;
         }
-        // ************************************************** UNSUPPORTED COMMAND **************************************************
+
+        if (actualData)
+            socket->write("ActualData from id=" + QString().setNum(id).toUtf8());
         else
+            socket->write("Data from id=" + QString().setNum(id).toUtf8());
+        QString errors;
+        foreach(QString key, responseData.keys())
+        {
+            QString response = responseData.value(key);
+            if (!response.startsWith("Error[ParticleCounter]:"))
+                socket->write(" " + key.toUtf8() + "=" + response.toUtf8());
+            else
+                errors.append(response + "\r\n");
+        }
+        socket->write("\r\n");
+        if (!errors.isEmpty())
+        {
+            socket->write(errors.toUtf8());
+        }
+    }
+    // ************************************************** UNSUPPORTED COMMAND **************************************************
+    else
+    {
+        // If control reaches this point, we have an unsupported command
+        writeError("ERROR: Command not supported: " + command);
+    }
+}
+
+void RemoteClientHandler::writeAggregates(const ParticleCounter::State &state)
+{
+    if (m_jsonMode)
+    {
+        JsonLineWriter json = beginJsonResponse("ok");
+        json.addInt("id", state.id);
+        json.beginArray("aggregates");
+        foreach (const ParticleCounter::WindowAggregate& aggregate, state.aggregates)
+        {
+            json.beginObject();
+            json.addInt("windowInSeconds", aggregate.windowInSeconds);
+            json.addInt("samples", aggregate.samples);
+            json.beginArray("channels");
+            for (int ch=0; ch<8; ch++)
+            {
+                json.beginObject();
+                json.addInt("channel", ch + 1);
+                json.addInt("sum", aggregate.sum[ch]);
+                json.addInt("max", aggregate.max[ch]);
+                json.addDouble("mean", (aggregate.samples > 0) ? ((double)aggregate.sum[ch] / aggregate.samples) : 0.0);
+                json.endObject();
+            }
+            json.endArray();
+            json.endObject();
+        }
+        json.endArray();
+        finishJsonResponse(&json);
+        return;
+    }
+
+    // Example:
+    // 'Aggregates from id=2 window=300 samples=5 channel_1_sum=62 channel_1_max=20 channel_1_mean=12.4 ... channel_8_mean=0'
+    QByteArray response;
+    char text[96];
+    int length;
+    foreach (const ParticleCounter::WindowAggregate& aggregate, state.aggregates)
+    {
+        length = qsnprintf(text, sizeof(text), "Aggregates from id=%i window=%i samples=%u", state.id, aggregate.windowInSeconds, (unsigned int)aggregate.samples);
+        response.append(text, length);
+        for (int ch=0; ch<8; ch++)
+        {
+            length = qsnprintf(text, sizeof(text), " channel_%i_sum=%llu channel_%i_max=%u channel_%i_mean=%.1f",
+                               ch + 1, (unsigned long long)aggregate.sum[ch], ch + 1, (unsigned int)aggregate.max[ch],
+                               ch + 1, (aggregate.samples > 0) ? ((double)aggregate.sum[ch] / aggregate.samples) : 0.0);
+            response.append(text, length);
+        }
+        response.append("\r\n");
+    }
+    if (state.aggregates.isEmpty())
+        response.append("Warning[RemoteClientHandler]: no aggregate windows configured.\r\n");
+    socket->write(response);
+}
+
+void RemoteClientHandler::writeLimits(const ParticleCounter::State &state)
+{
+    if (m_jsonMode)
+    {
+        JsonLineWriter json = beginJsonResponse("ok");
+        json.addInt("id", state.id);
+        json.addBool("valid", state.limits.valid);
+        json.addString("writeStatus", ParticleCounter::limitsWriteStatusName(state.limitsWriteStatus));
+        json.beginArray("channels");
+        for (int ch=0; ch<8; ch++)
         {
-            // If control reaches this point, we have an unsupported command
-            socket->write("ERROR: Command not supported: " + command.toUtf8() + "\r\n");
+            const ParticleCounter::ChannelLimits& channelLimits = state.limits.channel[ch];
+            json.beginObject();
+            json.addInt("channel", ch + 1);
+            json.addInt("upperWarningLimit", channelLimits.upperWarningLimit);
+            json.addInt("upperAlarmLimit", channelLimits.upperAlarmLimit);
+            json.addInt("warningDelay", channelLimits.warningDelay);
+            json.addInt("alarmDelay", channelLimits.alarmDelay);
+            json.endObject();
         }
+        json.endArray();
+        finishJsonResponse(&json);
+        return;
+    }
+
+    if (!state.limits.valid)
+    {
+        socket->write("Warning[RemoteClientHandler]: limits of id=" + QString().setNum(state.id).toUtf8() + " have not been read yet.\r\n");
+        return;
+    }
+
+    // Example:
+    // 'Limits from id=2 writeStatus=verified limit1=1000,2000,0,0 ... limit8=0,0,0,0'
+    QByteArray response;
+    char text[96];
+    int length = qsnprintf(text, sizeof(text), "Limits from id=%i writeStatus=", state.id);
+    response.append(text, length);
+    response.append(ParticleCounter::limitsWriteStatusName(state.limitsWriteStatus).toUtf8());
+    for (int ch=0; ch<8; ch++)
+    {
+        const ParticleCounter::ChannelLimits& channelLimits = state.limits.channel[ch];
+        length = qsnprintf(text, sizeof(text), " limit%i=%u,%u,%u,%u", ch + 1,
+                           (unsigned int)channelLimits.upperWarningLimit, (unsigned int)channelLimits.upperAlarmLimit,
+                           (unsigned int)channelLimits.warningDelay, (unsigned int)channelLimits.alarmDelay);
+        response.append(text, length);
+    }
+    response.append("\r\n");
+    socket->write(response);
+}
+
+JsonLineWriter RemoteClientHandler::beginJsonResponse(QString status)
+{
+    m_jsonBuffer.resize(0);
+    JsonLineWriter json(&m_jsonBuffer);
+    json.beginObject();
+    writeJsonHeader(&json, m_requestID, m_command, status);
+    return json;
+}
+
+void RemoteClientHandler::finishJsonResponse(JsonLineWriter *json)
+{
+    json->endObject();
+    json->endLine();
+    socket->write(m_jsonBuffer);
+}
+
+void RemoteClientHandler::writeError(QString message, QString status)
+{
+    if (!m_jsonMode)
+    {
+        socket->write(message.toUtf8() + "\r\n");
+        return;
+    }
+
+    JsonLineWriter json = beginJsonResponse(status);
+    json.addString("message", message);
+    finishJsonResponse(&json);
+}
+
+void RemoteClientHandler::writeJsonHeader(JsonLineWriter *json, QString requestID, QString command, QString status)
+{
+    // {"requestID":"17","command":"get","status":"ok",...
+    if (!requestID.isEmpty())
+        json->addString("requestID", requestID);
+    json->addString("command", command);
+    json->addString("status", status);
+}
+
+void RemoteClientHandler::writeParticleCounterJson(JsonLineWriter *json, const ParticleCounter::State &state, bool latestCounts)
+{
+    const ParticleCounter::ActualData& actualData = state.actualData;
+    const ParticleCounter::ChannelData* channelData = actualData.channelData;
+    QDateTime timestamp = actualData.timestamp;
+    const char* source = "live";
+
+    if (latestCounts)
+        channelData = RemoteClientHandler::latestCounts(state, &timestamp, &source);
+
+    json->addInt("id", state.id);
+    json->addInt("busID", state.busID);
+    json->addInt("modbusAddress", state.modbusAddress);
+    json->addString("serial", ParticleCounter::formatData(state, "deviceID"));
+    json->addBool("online", actualData.online);
+    json->addInt("lostTelegrams", actualData.lostTelegrams);
+    json->addString("lastSeen", actualData.lastSeen.toString(Qt::ISODateWithMs));
+    json->addString("statusString", actualData.statusString);
+    json->addString("timestamp", timestamp.toString(Qt::ISODate));
+    if (latestCounts)
+        json->addString("countsSource", source);
+    for (int ch=0; ch<8; ch++)
+    {
+        json->addInt(QByteArray("countChannel_" + QByteArray::number(channelData[ch].channel)).constData(), channelData[ch].count);
+    }
+}
+
+const ParticleCounter::ChannelData* RemoteClientHandler::latestCounts(const ParticleCounter::State &state, QDateTime *timestamp, const char **source)
+{
+    // Live counts are only read if enabled, so the archive datasets are the regular source of counts
+    const ParticleCounter::ArchiveDatasetSnapshotPtr& archive = state.latestArchiveDataset;
+    if (!archive.isNull() && (!state.actualData.timestamp.isValid() || (archive->archiveData.timestamp >= state.actualData.timestamp)))
+    {
+        *timestamp = archive->archiveData.timestamp;
+        *source = "archive";
+        return archive->archiveData.channelData;
+    }
+
+    *timestamp = state.actualData.timestamp;
+    *source = "live";
+    return state.actualData.channelData;
+}
+
+double RemoteClientHandler::suppressedRatio(const ParticleCounterDatabase::SinkStatus &sinkStatus)
+{
+    quint64 points = sinkStatus.pointsWritten + sinkStatus.pointsSuppressed;
+    if (points == 0)
+        return 0;
+    return (double)sinkStatus.pointsSuppressed / points;
+}
+
+void RemoteClientHandler::appendHistoryLine(QByteArray *buffer, int id, const ParticleCounterHistory::Record &record)
+{
+    // Example:
+    // 'History id=2 timestamp=2024-05-01T10:00:00Z samplingTimeInSeconds=59 countChannel_1=15 ... countChannel_8=0'
+    char text[96];
+    int length;
+
+    time_t seconds = record.timestampMs / 1000;
+    struct tm utc;
+    gmtime_r(&seconds, &utc);
+    length = qsnprintf(text, sizeof(text), "History id=%i timestamp=%04i-%02i-%02iT%02i:%02i:%02iZ samplingTimeInSeconds=%u",
+                       id, utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday, utc.tm_hour, utc.tm_min, utc.tm_sec,
+                       (unsigned int)record.samplingTimeInSeconds);
+    buffer->append(text, length);
+    for (int ch=0; ch<8; ch++)
+    {
+        length = qsnprintf(text, sizeof(text), " countChannel_%i=%u", ch + 1, (unsigned int)record.counts[ch]);
+        buffer->append(text, length);
+    }
+    buffer->append("\r\n");
+}
+
+void RemoteClientHandler::appendDumpLine(QByteArray *buffer, const ParticleCounter::State &state)
+{
+    // Example:
+    // 'Particle Counter id=2 busID=0 modbusAddress=2 online=1 lastSeen=... lostTelegrams=0 statusString=healthy countsSource=archive countsTimestamp=... countChannel_1=15 ... countChannel_8=0'
+    const ParticleCounter::ActualData& actualData = state.actualData;
+    QDateTime timestamp;
+    const char* source;
+    const ParticleCounter::ChannelData* channelData = latestCounts(state, &timestamp, &source);
+    char text[64];
+    int length;
+
+    length = qsnprintf(text, sizeof(text), "Particle Counter id=%i busID=%i modbusAddress=%i online=%i lastSeen=",
+                       state.id, state.busID, state.modbusAddress, actualData.online ? 1 : 0);
+    buffer->append(text, length);
+    buffer->append(actualData.lastSeen.toString("yyyy.MM.dd-hh:mm:ss.zzz").toUtf8());
+    length = qsnprintf(text, sizeof(text), " lostTelegrams=%llu statusString=", (unsigned long long)actualData.lostTelegrams);
+    buffer->append(text, length);
+    buffer->append(actualData.statusString.toUtf8());
+    length = qsnprintf(text, sizeof(text), " countsSource=%s countsTimestamp=", source);
+    buffer->append(text, length);
+    buffer->append(timestamp.toString("yyyy.MM.dd-hh:mm:ss.zzz").toUtf8());
+    for (int ch=0; ch<8; ch++)
+    {
+        length = qsnprintf(text, sizeof(text), " countChannel_%u=%u", (unsigned int)channelData[ch].channel, (unsigned int)channelData[ch].count);
+        buffer->append(text, length);
+    }
+    buffer->append("\r\n");
+}
+
+QByteArray RemoteClientHandler::formatResponse(bool jsonMode, QString requestID, QString command, QString response)
+{
+    if (!jsonMode)
+        return response.toUtf8() + "\r\n";
+
+    // Responses of the database are lines like "OK[...]: ...", "Warning[...]: ..." or "Error[...]: ..."
+    QStringList messages;
+    QString status = "ok";
+    foreach (QString message, response.split('\n', QString::SkipEmptyParts))
+    {
+        message = message.trimmed();
+        if (message.isEmpty())
+            continue;
+        if (message.startsWith("Error"))
+            status = "error";
+        else if (message.startsWith("Warning") && (status != "error"))
+            status = "warning";
+        messages.append(message);
+    }
+
+    QByteArray buffer;
+    JsonLineWriter json(&buffer);
+    json.beginObject();
+    writeJsonHeader(&json, requestID, command, status);
+    json.beginArray("messages");
+    foreach (QString message, messages)
+    {
+        json.addString(message);
     }
+    json.endArray();
+    json.endObject();
+    json.endLine();
+    return buffer;
+}
+
+void RemoteClientHandler::enqueueImport(QString csv, bool dryRun)
+{
+    ParticleCounterDatabase* pcDB = m_pcDB;
+    bool jsonMode = m_jsonMode;
+    QString requestID = m_requestID;
+    enqueueRequest([pcDB, csv, dryRun, jsonMode, requestID]() -> QByteArray {
+        return formatResponse(jsonMode, requestID, "import", pcDB->importParticleCounters(csv, dryRun));
+    });
+}
+
+void RemoteClientHandler::enqueueRequest(TerminalRequestQueue::Request request)
+{
+    // Further commands of this client wait until the response arrived, so the order of responses is kept
+    m_requestPending = true;
+    m_requestQueue->enqueue(m_clientID, request);
+}
+
+void RemoteClientHandler::slot_requestFinished(quint64 clientID, QByteArray response)
+{
+    if (clientID != m_clientID)
+        return;
+
+    socket->write(response);
+    m_requestPending = false;
+    startSlowClientTimerIfAboveHighWaterMark();
+
+    // Continue with commands that were held back
+    if (socket->canReadLine())
+        slot_read_ready();
 }
 
 void RemoteClientHandler::slot_disconnected()
@@ -360,14 +1209,7 @@ void RemoteClientHandler::slot_disconnected()
 
     debugStr += "Closed connection ";
 
-    if (socket->socketType() == QAbstractSocket::TcpSocket)
-        debugStr += "tcp from ";
-    else if (socket->socketType() == QAbstractSocket::UdpSocket)
-        debugStr += "udp from ";
-    else if (socket->socketType() == QAbstractSocket::UnknownSocketType)
-        debugStr += " - unknown socket type - ";
-
-    debugStr += socket->peerAddress().toString() + ":" + QString().setNum(socket->peerPort()) + " \r\n";
+    debugStr += "from " + m_peerName + " \r\n";
 
     printf("%s", debugStr.toLatin1().data());
 #endif
@@ -375,19 +1217,215 @@ void RemoteClientHandler::slot_disconnected()
 
 }
 
-void RemoteClientHandler::slot_ParticleCounterActualDataHasChanged(int id)
+bool RemoteClientHandler::parseLiveFilter(QString filterString, QBitArray *bitmap, int minNumber, int maxNumber)
 {
-    if (m_livemode)
+    // Format: comma separated list of numbers, e.g. --id=1,2,17
+    bitmap->clear();
+
+    if (filterString.isEmpty())
+        return true;    // No filter
+
+    QList<int> numbers;
+    int largestNumber = 0;
+    foreach (QString numberString, filterString.split(',', QString::SkipEmptyParts))
     {
-        socket->write("ActualData from id=" + QString().setNum(id).toUtf8());
-        QMap<QString,QString> responseData = m_pcDB->getParticleCounterData(id, QStringList() << "actual");
-        responseData.remove("actualData");  // Remove special treatment marker
-        foreach(QString key, responseData.keys())
+        bool ok;
+        int number = numberString.toInt(&ok);
+        if (!ok || (number < minNumber) || (number > maxNumber))
+            return false;
+        numbers.append(number);
+        largestNumber = qMax(largestNumber, number);
+    }
+
+    if (numbers.isEmpty())
+        return false;
+
+    bitmap->resize(largestNumber + 1);
+    foreach (int number, numbers)
+    {
+        bitmap->setBit(number);
+    }
+
+    return true;
+}
+
+bool RemoteClientHandler::isSubscribed(const ParticleCounterDatabase::LiveUpdate &liveUpdate) const
+{
+    if (!m_liveFilter_ids.isEmpty())
+    {
+        if ((liveUpdate.id < 0) || (liveUpdate.id >= m_liveFilter_ids.size()) || !m_liveFilter_ids.testBit(liveUpdate.id))
+            return false;
+    }
+
+    if (!m_liveFilter_buses.isEmpty())
+    {
+        if ((liveUpdate.busID < 0) || (liveUpdate.busID >= m_liveFilter_buses.size()) || !m_liveFilter_buses.testBit(liveUpdate.busID))
+            return false;
+    }
+
+    return (m_liveFilter_channels != 0);
+}
+
+bool RemoteClientHandler::isAboveHighWaterMark() const
+{
+    return (socket->bytesToWrite() > m_outputHighWaterMark);
+}
+
+void RemoteClientHandler::startSlowClientTimerIfAboveHighWaterMark()
+{
+    if (isAboveHighWaterMark() && !m_timer_slowClient.isActive())
+        m_timer_slowClient.start();
+}
+
+void RemoteClientHandler::writeLiveUpdate(ParticleCounterDatabase::LiveUpdatePtr liveUpdate)
+{
+    if (!m_livemode || !isSubscribed(*liveUpdate))
+        return;
+
+    if (isAboveHighWaterMark())
+    {
+        // Slow client: Keep only the latest update of each particle counter until the buffer drains
+        m_conflatedLiveUpdates.insert(liveUpdate->id, liveUpdate);
+        m_conflatedLiveUpdateCount++;
+        startSlowClientTimerIfAboveHighWaterMark();
+        return;
+    }
+
+    writeLiveUpdateNow(*liveUpdate);
+    startSlowClientTimerIfAboveHighWaterMark();
+}
+
+void RemoteClientHandler::writeAlarmUpdate(ParticleCounterDatabase::AlarmUpdatePtr alarmUpdate)
+{
+    if (!m_alarmmode)
+        return;
+
+    if (!m_alarmFilter_ids.isEmpty())
+    {
+        if ((alarmUpdate->id < 0) || (alarmUpdate->id >= m_alarmFilter_ids.size()) || !m_alarmFilter_ids.testBit(alarmUpdate->id))
+            return;
+    }
+
+    if (!m_alarmFilter_buses.isEmpty())
+    {
+        if ((alarmUpdate->busID < 0) || (alarmUpdate->busID >= m_alarmFilter_buses.size()) || !m_alarmFilter_buses.testBit(alarmUpdate->busID))
+            return;
+    }
+
+    // Transitions are rare and must not get lost, so they are written even above the high water mark
+    socket->write(m_jsonMode ? alarmUpdate->jsonLine : alarmUpdate->line);
+    startSlowClientTimerIfAboveHighWaterMark();
+}
+
+void RemoteClientHandler::writeBroadcast(QByteArray data)
+{
+    // Broadcasts can not be conflated, so they are dropped for a client that does not read anymore
+    if (isAboveHighWaterMark())
+    {
+        startSlowClientTimerIfAboveHighWaterMark();
+        return;
+    }
+
+    if (m_jsonMode)
+    {
+        QByteArray line;
+        JsonLineWriter json(&line);
+        json.beginObject();
+        json.addString("type", "broadcast");
+        json.addString("message", QString::fromUtf8(data));
+        json.endObject();
+        json.endLine();
+        socket->write(line);
+    }
+    else
+    {
+        socket->write(data + "\r\n");
+    }
+    startSlowClientTimerIfAboveHighWaterMark();
+}
+
+QString RemoteClientHandler::bufferStatus() const
+{
+    QString line;
+    line.sprintf("Terminal client %s: BytesToWrite=%lli HighWaterMark=%lli ConflatedLiveUpdatesPending=%i ConflatedLiveUpdatesTotal=%llu\r\n",
+                 m_peerName.toUtf8().data(),
+                 socket->bytesToWrite(),
+                 m_outputHighWaterMark,
+                 m_conflatedLiveUpdates.size(),
+                 m_conflatedLiveUpdateCount);
+    return line;
+}
+
+void RemoteClientHandler::writeLiveUpdateNow(const ParticleCounterDatabase::LiveUpdate &liveUpdate)
+{
+    const QByteArray& sharedLine = m_jsonMode ? liveUpdate.jsonLine : liveUpdate.line;
+
+    if (m_liveFilter_channels == 0xff)
+    {
+        socket->write(sharedLine);
+        return;
+    }
+
+    // Write the header, the subscribed channel segments and the line end as slices of the shared line
+    const char* line = sharedLine.constData();
+    const int* offsets = m_jsonMode ? liveUpdate.jsonChannelSegmentOffsets : liveUpdate.channelSegmentOffsets;
+
+    socket->write(line, offsets[0]);
+    for (int ch=0; ch<8; ch++)
+    {
+        if (m_liveFilter_channels & (1 << ch))
+            socket->write(line + offsets[ch], offsets[ch + 1] - offsets[ch]);
+    }
+    socket->write(line + offsets[8], sharedLine.size() - offsets[8]);
+}
+
+void RemoteClientHandler::writeBufferStatusJson(JsonLineWriter *json) const
+{
+    json->beginObject();
+    json->addString("client", m_peerName);
+    json->addInt("bytesToWrite", socket->bytesToWrite());
+    json->addInt("highWaterMark", m_outputHighWaterMark);
+    json->addInt("conflatedLiveUpdatesPending", m_conflatedLiveUpdates.size());
+    json->addInt("conflatedLiveUpdatesTotal", m_conflatedLiveUpdateCount);
+    json->endObject();
+}
+
+void RemoteClientHandler::slot_bytesWritten()
+{
+    if (isAboveHighWaterMark())
+        return;
+
+    m_timer_slowClient.stop();
+
+    // Send the latest conflated update of each particle counter
+    if (!m_conflatedLiveUpdates.isEmpty())
+    {
+        QMap<int, ParticleCounterDatabase::LiveUpdatePtr> conflatedLiveUpdates = m_conflatedLiveUpdates;
+        m_conflatedLiveUpdates.clear();
+        foreach (ParticleCounterDatabase::LiveUpdatePtr liveUpdate, conflatedLiveUpdates)
         {
-            QString response = responseData.value(key);
-            if (!response.startsWith("Error[Particle Counter]:"))
-                socket->write(" " + key.toUtf8() + "=" + response.toUtf8());
+            if (m_livemode && isSubscribed(*liveUpdate))
+                writeLiveUpdateNow(*liveUpdate);
         }
-        socket->write("\r\n");
+        startSlowClientTimerIfAboveHighWaterMark();
     }
+
+    // Continue with commands that were held back
+    if (socket->canReadLine())
+        slot_read_ready();
+}
+
+void RemoteClientHandler::slot_timer_slowClient_fired()
+{
+    if (!isAboveHighWaterMark())
+        return;
+
+    emit signal_newEntry(LogEntry::Warning, "RemoteClientHandler", "Disconnected slow client " + m_peerName + ".");
+
+    QAbstractSocket* tcpSocket = qobject_cast<QAbstractSocket*>(socket);
+    QLocalSocket* localSocket = qobject_cast<QLocalSocket*>(socket);
+    if (tcpSocket != nullptr)
+        tcpSocket->abort();
+    else if (localSocket != nullptr)
+        localSocket->abort();
 }
@@ -21,37 +21,128 @@
 #include <QtNetwork>
 #include <QTcpServer>
 #include <QTcpSocket>
+#include <QLocalSocket>
 #include <QList>
 #include <QMap>
 #include <QByteArray>
 #include <QRegExp>
 #include <QHostInfo>
+#include <QBitArray>
 
 #include "particlecounterdatabase.h"
 #include "loghandler.h"
+#include "terminalrequestqueue.h"
+#include "jsonlinewriter.h"
+
+class RemoteController;
 
 class RemoteClientHandler : public QObject
 {
     Q_OBJECT
 public:
-    explicit RemoteClientHandler(QObject *parent, QTcpSocket* socket, ParticleCounterDatabase* pcDB, Loghandler *loghandler);
+    // The socket is either a QTcpSocket or a QLocalSocket, peerName describes the client for logs and status output
+    explicit RemoteClientHandler(RemoteController *parent, quint64 clientID, QIODevice* socket, QString peerName, ParticleCounterDatabase* pcDB, TerminalRequestQueue* requestQueue, Loghandler *loghandler);
+
+    // Write a pre-serialized live update to the client if it is in live mode
+    void writeLiveUpdate(ParticleCounterDatabase::LiveUpdatePtr liveUpdate);
+
+    // Write a pre-serialized alarm transition to the client if it subscribed to alarms
+    void writeAlarmUpdate(ParticleCounterDatabase::AlarmUpdatePtr alarmUpdate);
+
+    // Write data that is sent to all clients
+    void writeBroadcast(QByteArray data);
+
+    // Status of the output buffer of this client for the buffers command
+    QString bufferStatus() const;
+    void writeBufferStatusJson(JsonLineWriter* json) const;
 
 private:
-    QTcpSocket* socket;
-    ParticleCounterDatabase* m_pcDB;
-    Loghandler* m_loghandler;
+    QIODevice* socket;
+    QString m_peerName;
+    RemoteController* m_remoteController;
+    quint64 m_clientID;
+    ParticleCounterDatabase* m_pcDB;        // Only getSnapshot() may be called from this thread
+    TerminalRequestQueue* m_requestQueue;
+    Loghandler* m_loghandler;               // Only accessed by requests in the main thread
     bool m_livemode;
+    bool m_requestPending;                  // A request of this client is processed in the main thread
+
+    void processLine(QString line);
+    void enqueueRequest(TerminalRequestQueue::Request request);
+
+    // Json mode: all responses and live updates are written as one json object per line.
+    // The command and request id of the command in process are echoed in each response.
+    bool m_jsonMode;
+    QString m_command;
+    QString m_requestID;
+    QByteArray m_jsonBuffer;
+
+    JsonLineWriter beginJsonResponse(QString status);
+    void finishJsonResponse(JsonLineWriter* json);
+    void writeError(QString message, QString status = "error");     // Writes a text line or a json response
+
+    // These are also used by requests that are executed in the main thread
+    static void writeJsonHeader(JsonLineWriter* json, QString requestID, QString command, QString status);
+    static void writeParticleCounterJson(JsonLineWriter* json, const ParticleCounter::State& state, bool latestCounts = false);
+    static QByteArray formatResponse(bool jsonMode, QString requestID, QString command, QString response);
+
+    // Import of inline csv data only, collected until a line "end". Files are imported offline with --import FILE (see main.cpp).
+    bool m_importMode;
+    bool m_importDryRun;
+    QString m_importData;
+    void enqueueImport(QString csv, bool dryRun);
+
+    // Output buffer of the dump and history commands, it keeps its capacity between responses
+    QByteArray m_dumpBuffer;
+    static void appendDumpLine(QByteArray* buffer, const ParticleCounter::State& state);
+    // Counts of the latest archive dataset, or the live counts if they are newer
+    static const ParticleCounter::ChannelData* latestCounts(const ParticleCounter::State& state, QDateTime* timestamp, const char** source);
+    static void appendHistoryLine(QByteArray* buffer, int id, const ParticleCounterHistory::Record& record);
+
+    void writeAggregates(const ParticleCounter::State& state);     // get --id=ID --aggregates
+    void writeLimits(const ParticleCounter::State& state);         // get --id=ID --limits
+
+    static double suppressedRatio(const ParticleCounterDatabase::SinkStatus& sinkStatus);    // Suppressed of all raw points, 0 if none
+
+    // Live mode subscription, an empty bitmap means no filter.
+    // Channel bit n corresponds to channel n+1.
+    QBitArray m_liveFilter_ids;
+    QBitArray m_liveFilter_buses;
+    quint8 m_liveFilter_channels;
+
+    // The bitmap is sized by the largest number, so the numbers are limited to minNumber..maxNumber
+    bool parseLiveFilter(QString filterString, QBitArray* bitmap, int minNumber = 0, int maxNumber = 65535);
+    bool isSubscribed(const ParticleCounterDatabase::LiveUpdate &liveUpdate) const;
+    void writeLiveUpdateNow(const ParticleCounterDatabase::LiveUpdate &liveUpdate);
+
+    // Alarm subscription (startalarms), empty bitmaps mean no filter
+    bool m_alarmmode;
+    QBitArray m_alarmFilter_ids;
+    QBitArray m_alarmFilter_buses;
+
+    // Slow consumer protection: Above the high water mark of the output buffer live updates are conflated
+    // to the latest one per particle counter. A client that stays above the mark for too long is disconnected.
+    qint64 m_outputHighWaterMark;
+    QMap<int, ParticleCounterDatabase::LiveUpdatePtr> m_conflatedLiveUpdates;
+    quint64 m_conflatedLiveUpdateCount;
+    QTimer m_timer_slowClient;
+
+    bool isAboveHighWaterMark() const;
+    void startSlowClientTimerIfAboveHighWaterMark();    // After every write, also of large responses like dump and history
 
 signals:
     void signal_broadcast(QByteArray data);
-    void signal_connectionClosed(QTcpSocket* socket, RemoteClientHandler* remoteClientHandler);
+    void signal_connectionClosed(QIODevice* socket, RemoteClientHandler* remoteClientHandler);
+    void signal_newEntry(LogEntry::LoggingCategory loggingCategory, QString module, QString text);
 
 public slots:
 
 private slots:
     void slot_read_ready();
     void slot_disconnected();
-    void slot_ParticleCounterActualDataHasChanged(int id);
+    void slot_bytesWritten();
+    void slot_timer_slowClient_fired();
+    void slot_requestFinished(quint64 clientID, QByteArray response);
 };
 
 #endif // REMOTECLIENTHANDLER_H
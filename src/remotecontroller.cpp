@@ -16,7 +16,28 @@
 
 #include "remotecontroller.h"
 
-RemoteController::RemoteController(QObject *parent, ParticleCounterDatabase* pcDB, Loghandler* loghandler) : QObject(parent)
+RemoteController::RemoteController(QObject *parent, ParticleCounterDatabase* pcDB, TerminalRequestQueue *requestQueue, Loghandler* loghandler) : QObject(parent)
+{
+    m_pcDB = pcDB;
+    m_requestQueue = requestQueue;
+    m_loghandler = loghandler;
+    m_noConnection = true;
+    m_nextClientID = 1;
+    m_server = nullptr;
+    m_localServer = nullptr;
+    m_timer_connectionTimeout = nullptr;
+
+    // The loghandler lives in the main thread, so log entries are queued to it
+    connect(this, &RemoteController::signal_newEntry, m_loghandler, &Loghandler::slot_newEntry, Qt::QueuedConnection);
+    connect(this, &RemoteController::signal_entryGone, m_loghandler, &Loghandler::slot_entryGone, Qt::QueuedConnection);
+}
+
+RemoteController::~RemoteController()
+{
+
+}
+
+void RemoteController::slot_start()
 {
 #ifdef QT_DEBUG
     fprintf(stdout, "Server started\n");
@@ -25,16 +46,19 @@ RemoteController::RemoteController(QObject *parent, ParticleCounterDatabase* pcD
     QSettings settings("/etc/openffucontrol/particleserver/config.ini", QSettings::IniFormat);
     settings.beginGroup("tcpTerminal");
 
-    m_pcDB = pcDB;
-    m_loghandler = loghandler;
-    m_noConnection = true;
+    // Server and timer are created here, so they belong to the thread of the remote controller
+    m_timer_connectionTimeout = new QTimer(this);
+    connect(m_timer_connectionTimeout, &QTimer::timeout, this, &RemoteController::slot_connectionTimeout);
+    connect(this, &RemoteController::signal_connected, m_timer_connectionTimeout, &QTimer::stop);
+    m_timer_connectionTimeout->setSingleShot(true);
+    m_timer_connectionTimeout->start(30000); // 30 Sec.
 
-    connect(&m_timer_connectionTimeout, &QTimer::timeout, this, &RemoteController::slot_connectionTimeout);
-    connect(this, &RemoteController::signal_connected, &m_timer_connectionTimeout, &QTimer::stop);
-    m_timer_connectionTimeout.setSingleShot(true);
-    m_timer_connectionTimeout.start(30000); // 30 Sec.
+    m_server = new QTcpServer(this);
+    connect(m_server, &QTcpServer::newConnection,  this, &RemoteController::slot_new_connection);
 
-    connect(&m_server, &QTcpServer::newConnection,  this, &RemoteController::slot_new_connection);
+    // Live updates are serialized once by the database and fanned out to all clients from here
+    connect(m_pcDB, &ParticleCounterDatabase::signal_liveUpdate, this, &RemoteController::slot_liveUpdate, Qt::QueuedConnection);
+    connect(m_pcDB, &ParticleCounterDatabase::signal_alarmUpdate, this, &RemoteController::slot_alarmUpdate, Qt::QueuedConnection);
 
     QHostAddress hostAddress;
     if (settings.value("restrictToLocalhost").toBool())
@@ -42,25 +66,68 @@ RemoteController::RemoteController(QObject *parent, ParticleCounterDatabase* pcD
     else
         hostAddress = QHostAddress::Any;
 
-    m_server.listen(hostAddress, settings.value("port", 16002).toUInt());
+    m_server->listen(hostAddress, settings.value("port", 16002).toUInt());
+
+    // Optional unix domain socket for local clients, same protocol as the tcp terminal
+    QString localSocketPath = settings.value("localSocketPath").toString();
+    if (!localSocketPath.isEmpty())
+    {
+        m_localServer = new QLocalServer(this);
+        connect(m_localServer, &QLocalServer::newConnection, this, &RemoteController::slot_new_localConnection);
+        if (settings.value("localSocketGroupAccess").toBool())
+            m_localServer->setSocketOptions(QLocalServer::UserAccessOption | QLocalServer::GroupAccessOption);
+        else
+            m_localServer->setSocketOptions(QLocalServer::UserAccessOption);
+
+        QLocalServer::removeServer(localSocketPath);    // Remove a stale socket file of a previous run
+        if (!m_localServer->listen(localSocketPath))
+            emit signal_newEntry(LogEntry::Error, "Remotecontroller", "Unable to listen on local socket " + localSocketPath + ": " + m_localServer->errorString());
+    }
 }
 
-RemoteController::~RemoteController()
+bool RemoteController::isConnected()
 {
+    return (!m_noConnection);
+}
 
+QString RemoteController::clientBufferStatus()
+{
+    QString status;
+    foreach(RemoteClientHandler* remoteClientHandler, this->m_clientHandler_list)
+    {
+        status += remoteClientHandler->bufferStatus();
+    }
+    return status;
 }
 
-bool RemoteController::isConnected()
+void RemoteController::clientBufferStatusJson(JsonLineWriter *json)
 {
-    return (!m_noConnection);
+    foreach(RemoteClientHandler* remoteClientHandler, this->m_clientHandler_list)
+    {
+        remoteClientHandler->writeBufferStatusJson(json);
+    }
 }
 
 void RemoteController::slot_new_connection()
 {
-    QTcpSocket* newSocket = m_server.nextPendingConnection();
+    QTcpSocket* newSocket = m_server->nextPendingConnection();
+    addClient(newSocket, "tcp " + newSocket->peerAddress().toString() + ":" + QString().setNum(newSocket->peerPort()));
+}
+
+void RemoteController::slot_new_localConnection()
+{
+    QLocalSocket* newSocket = m_localServer->nextPendingConnection();
+    addClient(newSocket, "local " + m_localServer->fullServerName() + "#" + QString().setNum(m_nextClientID));
+}
+
+void RemoteController::addClient(QIODevice *newSocket, QString peerName)
+{
     this->m_socket_list.append(newSocket);
 
-    RemoteClientHandler* remoteClientHandler = new RemoteClientHandler(this, newSocket, m_pcDB, m_loghandler);
+    RemoteClientHandler* remoteClientHandler = new RemoteClientHandler(this, m_nextClientID++, newSocket, peerName, m_pcDB, m_requestQueue, m_loghandler);
+    this->m_clientHandler_list.append(remoteClientHandler);
+    connect(remoteClientHandler, &RemoteClientHandler::signal_newEntry,
+            this, &RemoteController::signal_newEntry);
     connect(remoteClientHandler, &RemoteClientHandler::signal_broadcast,
             this, &RemoteController::slot_broadcast);
     connect(remoteClientHandler, &RemoteClientHandler::signal_connectionClosed,
@@ -69,23 +136,42 @@ void RemoteController::slot_new_connection()
     if (m_noConnection)
     {
         m_noConnection = false;
-        m_loghandler->slot_entryGone(LogEntry::Error, "Remotecontroller", "No connection to server.");
+        emit signal_entryGone(LogEntry::Error, "Remotecontroller", "No connection to server.");
         emit signal_connected();
     }
 }
 
 void RemoteController::slot_broadcast(QByteArray data)
 {
-    foreach(QTcpSocket* socket, this->m_socket_list)
+    foreach(RemoteClientHandler* remoteClientHandler, this->m_clientHandler_list)
+    {
+        remoteClientHandler->writeBroadcast(data);
+    }
+}
+
+void RemoteController::slot_liveUpdate(ParticleCounterDatabase::LiveUpdatePtr liveUpdate)
+{
+    foreach(RemoteClientHandler* remoteClientHandler, this->m_clientHandler_list)
+    {
+        remoteClientHandler->writeLiveUpdate(liveUpdate);
+    }
+}
+
+void RemoteController::slot_alarmUpdate(ParticleCounterDatabase::AlarmUpdatePtr alarmUpdate)
+{
+    foreach(RemoteClientHandler* remoteClientHandler, this->m_clientHandler_list)
     {
-        socket->write(data + "\r\n");
+        remoteClientHandler->writeAlarmUpdate(alarmUpdate);
     }
 }
 
-void RemoteController::slot_connectionClosed(QTcpSocket *socket, RemoteClientHandler *remoteClientHandler)
+void RemoteController::slot_connectionClosed(QIODevice *socket, RemoteClientHandler *remoteClientHandler)
 {
     this->m_socket_list.removeOne(socket);
-    delete remoteClientHandler;
+    this->m_clientHandler_list.removeOne(remoteClientHandler);
+    // The handler may still be on the stack (e.g. it aborted a slow client), so delete it later
+    remoteClientHandler->deleteLater();
+    socket->deleteLater();
 #ifdef QT_DEBUG
     fprintf (stdout, "ClientHandler deleted\r\n");
 #endif
@@ -93,12 +179,12 @@ void RemoteController::slot_connectionClosed(QTcpSocket *socket, RemoteClientHan
     if (m_socket_list.isEmpty())
     {
         m_noConnection = true;
-        m_loghandler->slot_newEntry(LogEntry::Error, "Remotecontroller", "No connection to server.");
+        emit signal_newEntry(LogEntry::Error, "Remotecontroller", "No connection to server.");
         emit signal_disconnected();
     }
 }
 
 void RemoteController::slot_connectionTimeout()
 {
-    m_loghandler->slot_newEntry(LogEntry::Error, "Remotecontroller", "No connection to server.");
+    emit signal_newEntry(LogEntry::Error, "Remotecontroller", "No connection to server.");
 }
@@ -21,39 +21,61 @@
 #include <QtNetwork>
 #include <QTcpServer>
 #include <QTcpSocket>
+#include <QLocalServer>
+#include <QLocalSocket>
 #include <QList>
 #include <iostream>
 #include "remoteclienthandler.h"
 #include "particlecounterdatabase.h"
 #include "loghandler.h"
+#include "terminalrequestqueue.h"
 
 class RemoteController : public QObject
 {
     Q_OBJECT
 public:
-    explicit RemoteController(QObject *parent, ParticleCounterDatabase* pcDB, Loghandler* loghandler);
+    // The remote controller lives in its own thread, the server is started by slot_start() in this thread.
+    // Commands that access the database are passed to the requestQueue, reads are served from database snapshots.
+    explicit RemoteController(QObject *parent, ParticleCounterDatabase* pcDB, TerminalRequestQueue* requestQueue, Loghandler* loghandler);
     ~RemoteController();
 
     bool isConnected(); // Returns true if at least one server is connected
 
+    QString clientBufferStatus();   // Output buffer levels of all clients
+    void clientBufferStatusJson(JsonLineWriter* json);
+
 private:
-    QTcpServer m_server;
-    QList<QTcpSocket*> m_socket_list;
+    QTcpServer* m_server;
+    QLocalServer* m_localServer;        // Unix domain socket, only created if configured
+    QList<QIODevice*> m_socket_list;
+    QList<RemoteClientHandler*> m_clientHandler_list;
     ParticleCounterDatabase* m_pcDB;
+    TerminalRequestQueue* m_requestQueue;
     Loghandler* m_loghandler;
     bool m_noConnection;  // True if no server is connected
-    QTimer m_timer_connectionTimeout;   // Server should connect within this time, otherwise signal error
+    QTimer* m_timer_connectionTimeout;   // Server should connect within this time, otherwise signal error
+    quint64 m_nextClientID;
+
+    void addClient(QIODevice* newSocket, QString peerName);
 
 signals:
     void signal_connected();
     void signal_disconnected();
 
+    // Log entries are passed to the loghandler in the main thread
+    void signal_newEntry(LogEntry::LoggingCategory loggingCategory, QString module, QString text);
+    void signal_entryGone(LogEntry::LoggingCategory loggingCategory, QString module, QString text);
+
 public slots:
+    void slot_start();
 
 private slots:
     void slot_new_connection();
+    void slot_new_localConnection();
     void slot_broadcast(QByteArray data);
-    void slot_connectionClosed(QTcpSocket* socket, RemoteClientHandler* remoteClientHandler);
+    void slot_liveUpdate(ParticleCounterDatabase::LiveUpdatePtr liveUpdate);
+    void slot_alarmUpdate(ParticleCounterDatabase::AlarmUpdatePtr alarmUpdate);
+    void slot_connectionClosed(QIODevice* socket, RemoteClientHandler* remoteClientHandler);
     void slot_connectionTimeout();
 };
 
@@ -0,0 +1,81 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#include "terminalrequestqueue.h"
+
+TerminalRequestQueue::TerminalRequestQueue(QObject *parent, ParticleCounterDatabase *pcDB) : QObject(parent)
+{
+    m_pcDB = pcDB;
+    m_processingScheduled = false;
+    m_maxRequestsPerCycle = 20;
+}
+
+void TerminalRequestQueue::enqueue(quint64 clientID, Request request)
+{
+    TerminalRequest terminalRequest;
+    terminalRequest.clientID = clientID;
+    terminalRequest.request = request;
+
+    QMutexLocker locker(&m_mutex);
+    m_requests.enqueue(terminalRequest);
+
+    if (!m_processingScheduled)
+    {
+        m_processingScheduled = true;
+        QMetaObject::invokeMethod(this, "slot_processRequests", Qt::QueuedConnection);
+    }
+}
+
+int TerminalRequestQueue::getSizeOfQueue()
+{
+    QMutexLocker locker(&m_mutex);
+    return m_requests.size();
+}
+
+void TerminalRequestQueue::slot_processRequests()
+{
+    QList<TerminalRequest> batch;
+
+    m_mutex.lock();
+    while (!m_requests.isEmpty() && (batch.size() < m_maxRequestsPerCycle))
+    {
+        batch.append(m_requests.dequeue());
+    }
+    m_mutex.unlock();
+
+    QList<QByteArray> responses;
+    foreach (TerminalRequest terminalRequest, batch)
+    {
+        responses.append(terminalRequest.request());
+    }
+
+    // Publish the changes of this batch before the clients get their responses,
+    // so their next read from the snapshot already contains them.
+    if (!batch.isEmpty())
+        m_pcDB->slot_publishSnapshot();
+
+    for (int i = 0; i < batch.size(); i++)
+    {
+        emit signal_requestFinished(batch.at(i).clientID, responses.at(i));
+    }
+
+    // Give the event loop (bus responses, timers) a chance to run before the next batch
+    QMutexLocker locker(&m_mutex);
+    if (m_requests.isEmpty())
+        m_processingScheduled = false;
+    else
+        QMetaObject::invokeMethod(this, "slot_processRequests", Qt::QueuedConnection);
+}
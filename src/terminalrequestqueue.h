@@ -0,0 +1,64 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+#ifndef TERMINALREQUESTQUEUE_H
+#define TERMINALREQUESTQUEUE_H
+
+#include <QObject>
+#include <QQueue>
+#include <QMutex>
+#include <QByteArray>
+#include <functional>
+#include "particlecounterdatabase.h"
+
+// Requests of the terminal server that need to access the particle counter database.
+// Requests are enqueued by the terminal thread and executed in the thread of the database
+// in small batches, so a large batch of commands does not stall the bus response handling.
+class TerminalRequestQueue : public QObject
+{
+    Q_OBJECT
+public:
+    // A request is executed in the thread of the database and returns the response for the client
+    typedef std::function<QByteArray()> Request;
+
+    explicit TerminalRequestQueue(QObject *parent, ParticleCounterDatabase* pcDB);
+
+    // Enqueue a request of a client, this is thread-safe
+    void enqueue(quint64 clientID, Request request);
+
+    int getSizeOfQueue();
+
+private:
+    typedef struct {
+        quint64 clientID;
+        Request request;
+    } TerminalRequest;
+
+    ParticleCounterDatabase* m_pcDB;
+    QMutex m_mutex;
+    QQueue<TerminalRequest> m_requests;
+    bool m_processingScheduled;
+    int m_maxRequestsPerCycle;
+
+signals:
+    // Emitted in the thread of the database for each finished request
+    void signal_requestFinished(quint64 clientID, QByteArray response);
+
+private slots:
+    void slot_processRequests();
+};
+
+#endif // TERMINALREQUESTQUEUE_H
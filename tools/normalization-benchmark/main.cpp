@@ -0,0 +1,154 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+
+// Micro-benchmark of the count normalization kernel (ParticleCounterNormalization) against a straightforward implementation
+// that branches on the output data format and on each difference. Both are run over the same random datasets of mixed formats,
+// their results are compared before the timing is printed.
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QVector>
+#include <stdio.h>
+#include "particlecounternormalization.h"
+
+typedef struct {
+    quint32 counts[8];
+    bool cumulative;
+} Dataset;
+
+static void normalizeReference(const quint32 counts[8], bool cumulativeInput, ParticleCounterNormalization::Counts* normalized)
+{
+    if (cumulativeInput)
+    {
+        for (int ch=0; ch<8; ch++)
+        {
+            normalized->cumulative[ch] = counts[ch];
+            if (ch == 7)
+                normalized->distributive[ch] = counts[ch];
+            else if (counts[ch] > counts[ch + 1])
+                normalized->distributive[ch] = counts[ch] - counts[ch + 1];
+            else
+                normalized->distributive[ch] = 0;
+        }
+    }
+    else
+    {
+        quint32 sum = 0;
+        for (int ch=7; ch>=0; ch--)
+        {
+            sum += counts[ch];
+            normalized->cumulative[ch] = sum;
+            normalized->distributive[ch] = counts[ch];
+        }
+    }
+}
+
+static QVector<Dataset> makeDatasets(int count, quint32 seed)
+{
+    // Typical cleanroom data: few small particles, large channels mostly 0, formats mixed
+    QVector<Dataset> datasets(count);
+    quint32 state = seed;
+    for (int i=0; i<count; i++)
+    {
+        Dataset& dataset = datasets[i];
+        state = state * 1664525u + 1013904223u;
+        dataset.cumulative = (state >> 31) != 0;
+        quint32 level = (state >> 8) % 5000;
+        for (int ch=0; ch<8; ch++)
+        {
+            state = state * 1664525u + 1013904223u;
+            quint32 count = (level >> ch) + ((state >> 16) % 3);
+            dataset.counts[ch] = ((state >> 12) % 4 == 0) ? 0 : count;
+        }
+        if (dataset.cumulative)
+        {
+            for (int ch=6; ch>=0; ch--)
+            {
+                dataset.counts[ch] += dataset.counts[ch + 1];
+            }
+        }
+    }
+    return datasets;
+}
+
+typedef void (*NormalizeFunction)(const quint32 counts[8], bool cumulativeInput, ParticleCounterNormalization::Counts* normalized);
+
+static qint64 run(NormalizeFunction normalize, const QVector<Dataset>& datasets, int rounds, quint64* checksum)
+{
+    ParticleCounterNormalization::Counts normalized;
+    quint64 sum = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for (int r=0; r<rounds; r++)
+    {
+        for (int i=0; i<datasets.size(); i++)
+        {
+            normalize(datasets.at(i).counts, datasets.at(i).cumulative, &normalized);
+            sum += normalized.cumulative[i & 7] + normalized.distributive[(i + r) & 7];
+        }
+    }
+    qint64 elapsedNs = timer.nsecsElapsed();
+    *checksum = sum;    // Keeps the compiler from dropping the loop
+    return elapsedNs;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("openffucontrol-normalization-benchmark");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Throughput of the distributive/cumulative count normalization kernel.");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("datasets", "Number of random datasets, defaults to 100000.", "count", "100000"));
+    parser.addOption(QCommandLineOption("rounds", "Number of passes over the datasets, defaults to 100.", "count", "100"));
+    parser.process(a);
+
+    int datasetCount = qMax(1, parser.value("datasets").toInt());
+    int rounds = qMax(1, parser.value("rounds").toInt());
+    QVector<Dataset> datasets = makeDatasets(datasetCount, 4711);
+
+    for (int i=0; i<datasets.size(); i++)
+    {
+        ParticleCounterNormalization::Counts kernel;
+        ParticleCounterNormalization::Counts reference;
+        ParticleCounterNormalization::normalize(datasets.at(i).counts, datasets.at(i).cumulative, &kernel);
+        normalizeReference(datasets.at(i).counts, datasets.at(i).cumulative, &reference);
+        for (int ch=0; ch<8; ch++)
+        {
+            if ((kernel.cumulative[ch] != reference.cumulative[ch]) || (kernel.distributive[ch] != reference.distributive[ch]))
+            {
+                fprintf(stderr, "Mismatch in dataset %i channel %i\n", i, ch + 1);
+                return 1;
+            }
+        }
+    }
+
+    quint64 checksumKernel;
+    quint64 checksumReference;
+    qint64 kernelNs = run(ParticleCounterNormalization::normalize, datasets, rounds, &checksumKernel);
+    qint64 referenceNs = run(normalizeReference, datasets, rounds, &checksumReference);
+
+    double normalizations = (double)datasetCount * rounds;
+    fprintf(stdout, "%i datasets, %i rounds\n", datasetCount, rounds);
+    fprintf(stdout, "%-12s %11s %14s %10s\n", "", "total[ms]", "datasets/s", "ns/dataset");
+    fprintf(stdout, "%-12s %11.1f %14.0f %10.2f\n", "kernel", kernelNs / 1000000.0, normalizations / (kernelNs / 1000000000.0), kernelNs / normalizations);
+    fprintf(stdout, "%-12s %11.1f %14.0f %10.2f\n", "reference", referenceNs / 1000000.0, normalizations / (referenceNs / 1000000000.0), referenceNs / normalizations);
+
+    return (checksumKernel == checksumReference) ? 0 : 1;
+}
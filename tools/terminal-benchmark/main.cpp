@@ -0,0 +1,201 @@
+/**********************************************************************
+** openffucontrol-particleserver - a daemon for data acquisition from
+** cleanroom particle monitoring devices into an influx time-series database
+** Copyright (C) 2023 Smart Micro Engineering GmbH
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU General Public License for more details.
+** You should have received a copy of the GNU General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**********************************************************************/
+
+// Throughput and latency comparison of the terminal transports (tcp and unix domain socket).
+// The same command is sent repeatedly and the time until its response has been received completely is measured.
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTcpSocket>
+#include <QLocalSocket>
+#include <QElapsedTimer>
+#include <QQueue>
+#include <QVector>
+#include <algorithm>
+#include <stdio.h>
+
+typedef struct {
+    QString transport;
+    int requests;
+    qint64 totalTimeNs;
+    QVector<qint64> latenciesNs;
+    bool ok;
+} BenchmarkResult;
+
+typedef struct {
+    QByteArray command;
+    int requests;
+    int warmupRequests;
+    int pipelineDepth;      // Number of requests in flight, 1 means strict request-response
+    int linesPerResponse;
+    int timeoutMs;
+} BenchmarkOptions;
+
+static bool readLines(QIODevice* device, int count, int timeoutMs)
+{
+    while (count > 0)
+    {
+        while (!device->canReadLine())
+        {
+            if (!device->waitForReadyRead(timeoutMs))
+                return false;
+        }
+        device->readLine();
+        count--;
+    }
+    return true;
+}
+
+static BenchmarkResult runBenchmark(QIODevice* device, QString transport, const BenchmarkOptions& options)
+{
+    BenchmarkResult result;
+    result.transport = transport;
+    result.requests = options.requests;
+    result.totalTimeNs = 0;
+    result.ok = false;
+    result.latenciesNs.reserve(options.requests);
+
+    // Greeting of the server
+    if (!readLines(device, 1, options.timeoutMs))
+        return result;
+
+    for (int i=0; i<options.warmupRequests; i++)
+    {
+        device->write(options.command);
+        if (!readLines(device, options.linesPerResponse, options.timeoutMs))
+            return result;
+    }
+
+    QElapsedTimer timer;
+    QQueue<qint64> sendTimesNs;
+    int sent = 0;
+    int received = 0;
+
+    timer.start();
+    while (received < options.requests)
+    {
+        while ((sent < options.requests) && (sent - received < options.pipelineDepth))
+        {
+            sendTimesNs.enqueue(timer.nsecsElapsed());
+            device->write(options.command);
+            sent++;
+        }
+
+        if (!readLines(device, options.linesPerResponse, options.timeoutMs))
+            return result;
+        result.latenciesNs.append(timer.nsecsElapsed() - sendTimesNs.dequeue());
+        received++;
+    }
+    result.totalTimeNs = timer.nsecsElapsed();
+    result.ok = true;
+
+    return result;
+}
+
+static void printResult(const BenchmarkResult& result)
+{
+    if (!result.ok)
+    {
+        fprintf(stdout, "%-8s failed (timeout or connection closed)\n", result.transport.toUtf8().data());
+        return;
+    }
+
+    QVector<qint64> latencies = result.latenciesNs;
+    std::sort(latencies.begin(), latencies.end());
+    int count = latencies.size();
+
+    double totalMs = result.totalTimeNs / 1000000.0;
+    double throughput = result.requests / (result.totalTimeNs / 1000000000.0);
+
+    fprintf(stdout, "%-8s %9i %11.1f %12.0f %10.1f %10.1f %10.1f %10.1f\n",
+            result.transport.toUtf8().data(),
+            result.requests,
+            totalMs,
+            throughput,
+            latencies.first() / 1000.0,
+            latencies.at(count / 2) / 1000.0,
+            latencies.at(qMin(count - 1, (count * 99) / 100)) / 1000.0,
+            latencies.last() / 1000.0);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("openffucontrol-terminal-benchmark");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Throughput and latency comparison of the particleserver terminal over tcp and unix domain socket.");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("host", "Hostname of the tcp terminal, defaults to localhost.", "host", "localhost"));
+    parser.addOption(QCommandLineOption("port", "Port of the tcp terminal, defaults to 16002. 0 skips the tcp benchmark.", "port", "16002"));
+    parser.addOption(QCommandLineOption("local", "Path of the unix domain socket, skipped if not given.", "path"));
+    parser.addOption(QCommandLineOption("command", "Command to send, defaults to hostname.", "command", "hostname"));
+    parser.addOption(QCommandLineOption("lines", "Number of response lines of the command, defaults to 1.", "lines", "1"));
+    parser.addOption(QCommandLineOption("requests", "Number of measured requests, defaults to 10000.", "count", "10000"));
+    parser.addOption(QCommandLineOption("warmup", "Number of requests before the measurement, defaults to 100.", "count", "100"));
+    parser.addOption(QCommandLineOption("pipeline", "Number of requests in flight, defaults to 1 (request-response).", "depth", "1"));
+    parser.process(a);
+
+    BenchmarkOptions options;
+    options.command = parser.value("command").toUtf8() + "\r\n";
+    options.linesPerResponse = qMax(1, parser.value("lines").toInt());
+    options.requests = qMax(1, parser.value("requests").toInt());
+    options.warmupRequests = qMax(0, parser.value("warmup").toInt());
+    options.pipelineDepth = qMax(1, parser.value("pipeline").toInt());
+    options.timeoutMs = 5000;
+
+    QList<BenchmarkResult> results;
+
+    int port = parser.value("port").toInt();
+    if (port > 0)
+    {
+        QTcpSocket tcpSocket;
+        tcpSocket.connectToHost(parser.value("host"), port);
+        if (tcpSocket.waitForConnected(options.timeoutMs))
+        {
+            tcpSocket.setSocketOption(QAbstractSocket::LowDelayOption, 1);
+            results.append(runBenchmark(&tcpSocket, "tcp", options));
+            tcpSocket.disconnectFromHost();
+        }
+        else
+            fprintf(stderr, "Unable to connect to %s:%i: %s\n", parser.value("host").toUtf8().data(), port, tcpSocket.errorString().toUtf8().data());
+    }
+
+    if (parser.isSet("local"))
+    {
+        QLocalSocket localSocket;
+        localSocket.connectToServer(parser.value("local"));
+        if (localSocket.waitForConnected(options.timeoutMs))
+        {
+            results.append(runBenchmark(&localSocket, "local", options));
+            localSocket.disconnectFromServer();
+        }
+        else
+            fprintf(stderr, "Unable to connect to %s: %s\n", parser.value("local").toUtf8().data(), localSocket.errorString().toUtf8().data());
+    }
+
+    if (results.isEmpty())
+        return 1;
+
+    fprintf(stdout, "Command \"%s\", %i requests, pipeline depth %i\n", parser.value("command").toUtf8().data(), options.requests, options.pipelineDepth);
+    fprintf(stdout, "%-8s %9s %11s %12s %10s %10s %10s %10s\n", "", "requests", "total[ms]", "requests/s", "min[us]", "median[us]", "p99[us]", "max[us]");
+    foreach (BenchmarkResult result, results)
+    {
+        printResult(result);
+    }
+
+    return 0;
+}
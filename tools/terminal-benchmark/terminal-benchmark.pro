@@ -0,0 +1,31 @@
+#**********************************************************************
+#* openffucontrol-particleserver - a daemon for data acquisition from
+#* cleanroom particle monitoring devices into an influx time-series database
+#* Copyright (C) 2023 Smart Micro Engineering GmbH
+#* This program is free software: you can redistribute it and/or modify
+#* it under the terms of the GNU General Public License as published by
+#* the Free Software Foundation, either version 3 of the License, or
+#* (at your option) any later version.
+#* This program is distributed in the hope that it will be useful,
+#* but WITHOUT ANY WARRANTY; without even the implied warranty of
+#* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+#* GNU General Public License for more details.
+#* You should have received a copy of the GNU General Public License
+#* along with this program. If not, see <http://www.gnu.org/licenses/>.
+#*********************************************************************/
+
+QT += core network
+QT -= gui
+
+TARGET = openffucontrol-terminal-benchmark
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+OBJECTS_DIR = .obj/
+MOC_DIR = .moc/
+
+SOURCES += \
+        main.cpp